@@ -1,21 +1,295 @@
 from esphome.components import sensor, uart
+from esphome.components.esp32 import add_idf_sdkconfig_option
 import esphome.config_validation as cv
 import esphome.codegen as cg
-from esphome.const import CONF_ID
+from esphome.const import (
+    CONF_DURATION,
+    CONF_ID,
+    CONF_NAME,
+    CONF_SENSOR,
+    CONF_TEMPERATURE,
+    CONF_TIMEOUT,
+)
+from esphome.core import TimePeriod
+from esphome.helpers import cpp_string_escape
 
 DEPENDENCIES = ["uart"]
 AUTO_LOAD = ["sensor"]
 
 CONF_UART = "uart_id"
+CONF_CRC_TABLE = "crc_table"
+CONF_INIT = "init"
+CONF_STEPS = "steps"
+CONF_GAP = "gap"
+CONF_RECIPES = "recipes"
+CONF_STAGES = "stages"
+CONF_TARGET = "target"
+CONF_RAMP_TO = "ramp_to"
+CONF_HYSTERESIS = "hysteresis"
+CONF_UNTIL = "until"
+CONF_PLATEAU = "plateau"
+CONF_HEATER = "heater"
+CONF_CONTROLLER = "controller"
+CONF_ELEMENT_LAG = "element_lag"
+CONF_SAVE_INTERVAL = "save_interval"
+CONF_RELAY = "relay"
+CONF_WINDOW = "window"
+CONF_MIN_ON_TIME = "min_on_time"
+CONF_MIN_OFF_TIME = "min_off_time"
+CONF_MAX_CYCLES_PER_HOUR = "max_cycles_per_hour"
+CONF_IDLE = "idle"
+CONF_POLL_INTERVAL = "poll_interval"
+CONF_DELAY = "delay"
+CONF_LIGHT_SLEEP = "light_sleep"
+CONF_CONTROL_TASK = "control_task"
+CONF_POLL = "poll"
+CONF_INTERVAL = "interval"
+CONF_FAST_INTERVAL = "fast_interval"
+CONF_RESPONSE_TIMEOUT = "response_timeout"
+CONF_PRIORITY = "priority"
+CONF_CORE = "core"
+CONF_DISPLAY = "display"
+CONF_PAGES = "pages"
+CONF_SCHEDULE = "schedule"
+CONF_MARGIN = "margin"
+CONF_MIN_MARGIN = "min_margin"
+CONF_CHECKPOINT = "checkpoint"
+CONF_RESUME = "resume"
+CONF_MAX_DRIFT = "max_drift"
 
 
 ricecooker_ns = cg.esphome_ns.namespace("ricecooker")
 RiceCooker = ricecooker_ns.class_("RiceCooker", cg.Component, uart.UARTDevice)
+MCUCommunicator = ricecooker_ns.class_("MCUCommunicator")
+Heater = ricecooker_ns.class_("Heater")
+Display = ricecooker_ns.class_("Display")
+
+Recipe = ricecooker_ns.class_("Recipe")
+RecipeStage = ricecooker_ns.class_("RecipeStage")
+RecipeExit = ricecooker_ns.enum("RecipeExit", is_class=True)
+RecipeSensor = ricecooker_ns.enum("RecipeSensor", is_class=True)
+
+InitStep = MCUCommunicator.enum("InitStep", is_class=True)
+INIT_STEPS = {
+    "blank": InitStep.BLANK,
+    "beep": InitStep.BEEP,
+    "beep_all": InitStep.BEEP_ALL,
+    "all": InitStep.ALL,
+    "wait_response": InitStep.WAIT_RESPONSE,
+}
+
+DEFAULT_INIT_STEPS = ["blank", "beep", "beep_all", "beep", "beep_all", "all", "blank"]
+
+INIT_SCHEMA = cv.Schema({
+    cv.Optional(CONF_STEPS, default=DEFAULT_INIT_STEPS): cv.ensure_list(cv.enum(INIT_STEPS, lower=True)),
+    cv.Optional(CONF_GAP, default="50ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_TIMEOUT, default="2s"): cv.positive_time_period_milliseconds,
+})
+
+HeaterControllerType = Heater.enum("ControllerType", is_class=True)
+HEATER_CONTROLLERS = {
+    "predictive": HeaterControllerType.PREDICTIVE,
+    "thermal_mass": HeaterControllerType.THERMAL_MASS,
+}
+
+def validate_relay(config):
+    if config[CONF_MIN_ON_TIME] + config[CONF_MIN_OFF_TIME] > config[CONF_WINDOW]:
+        raise cv.Invalid("min_on_time and min_off_time must fit in the window")
+    return config
+
+
+RELAY_SCHEMA = cv.All(
+    cv.Schema({
+        cv.Optional(CONF_WINDOW, default="120s"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=TimePeriod(seconds=10), max=TimePeriod(minutes=30)),
+        ),
+        cv.Optional(CONF_MIN_ON_TIME, default="5s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MIN_OFF_TIME, default="15s"): cv.positive_time_period_milliseconds,
+        # 0 disables the limit
+        cv.Optional(CONF_MAX_CYCLES_PER_HOUR, default=30): cv.int_range(min=0, max=3600),
+    }),
+    validate_relay,
+)
+
+HEATER_SCHEMA = cv.Schema({
+    cv.Optional(CONF_CONTROLLER, default="predictive"): cv.enum(HEATER_CONTROLLERS, lower=True),
+    cv.Optional(CONF_ELEMENT_LAG, default="20s"): cv.All(
+        cv.positive_time_period_milliseconds,
+        cv.Range(min=TimePeriod(seconds=1), max=TimePeriod(minutes=5)),
+    ),
+    # Learned parameters go to flash at most this often
+    cv.Optional(CONF_SAVE_INTERVAL, default="30min"): cv.All(
+        cv.positive_time_period_milliseconds,
+        cv.Range(min=TimePeriod(minutes=1)),
+    ),
+    cv.Optional(CONF_RELAY, default={}): RELAY_SCHEMA,
+})
+
+def validate_poll(config):
+    if config[CONF_FAST_INTERVAL] > config[CONF_INTERVAL]:
+        raise cv.Invalid("fast_interval cannot be longer than interval")
+    # A poll, its retransmit and both timeouts fit before the next poll
+    if 2 * config[CONF_RESPONSE_TIMEOUT] > config[CONF_FAST_INTERVAL]:
+        raise cv.Invalid("fast_interval must be at least twice the response_timeout")
+    return config
+
+
+# MCU poll while a program runs, fast near the target band or with a key held
+POLL_SCHEMA = cv.All(
+    cv.Schema({
+        cv.Optional(CONF_INTERVAL, default="200ms"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=TimePeriod(milliseconds=50), max=TimePeriod(seconds=1)),
+        ),
+        cv.Optional(CONF_FAST_INTERVAL, default="100ms"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=TimePeriod(milliseconds=50), max=TimePeriod(seconds=1)),
+        ),
+        # A poll and its answer take ~22 ms at 9600 baud
+        cv.Optional(CONF_RESPONSE_TIMEOUT, default="40ms"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=TimePeriod(milliseconds=25)),
+        ),
+    }),
+    validate_poll,
+)
+
+# No program running: slow MCU poll, optionally light sleep in between
+IDLE_SCHEMA = cv.Schema({
+    cv.Optional(CONF_POLL_INTERVAL, default="1s"): cv.All(
+        cv.positive_time_period_milliseconds,
+        cv.Range(min=TimePeriod(milliseconds=100), max=TimePeriod(seconds=10)),
+    ),
+    cv.Optional(CONF_DELAY, default="30s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_LIGHT_SLEEP, default=False): cv.All(cv.boolean, cv.only_with_esp_idf),
+})
+
+# MCU polling and control run in their own task, off the main loop
+CONTROL_TASK_SCHEMA = cv.Schema({
+    cv.Optional(CONF_PRIORITY, default=5): cv.int_range(min=1, max=24),
+    # Ignored on single core builds
+    cv.Optional(CONF_CORE, default=1): cv.int_range(min=0, max=1),
+})
+
+DisplayPage = Display.enum("Page", is_class=True)
+DISPLAY_PAGES = {
+    "eta": DisplayPage.ETA,
+    "temperature": DisplayPage.TEMPERATURE,
+    "stage": DisplayPage.STAGE,
+    "error": DisplayPage.ERROR,
+}
+
+# Pages shown in turn when the panel menu is not in use, 0s leaves one out
+DISPLAY_SCHEMA = cv.Schema({
+    cv.Optional(CONF_PAGES, default={}): cv.Schema({
+        cv.Optional("eta", default="4s"): cv.positive_time_period_milliseconds,
+        cv.Optional("temperature", default="2s"): cv.positive_time_period_milliseconds,
+        cv.Optional("stage", default="2s"): cv.positive_time_period_milliseconds,
+        cv.Optional("error", default="2s"): cv.positive_time_period_milliseconds,
+    }),
+})
+
+# Finish-by: the planned start moves earlier by this much, the estimates run short
+SCHEDULE_SCHEMA = cv.Schema({
+    cv.Optional(CONF_MARGIN, default="10%"): cv.percentage,
+    cv.Optional(CONF_MIN_MARGIN, default="5min"): cv.positive_time_period_milliseconds,
+})
+
+# Resume after a reset: RTC memory every step, NVS on stage changes and this often
+CHECKPOINT_SCHEMA = cv.Schema({
+    cv.Optional(CONF_RESUME, default=True): cv.boolean,
+    cv.Optional(CONF_SAVE_INTERVAL, default="5min"): cv.All(
+        cv.positive_time_period_milliseconds,
+        cv.Range(min=TimePeriod(minutes=1)),
+    ),
+    # ºC the bottom sensor may have moved since the checkpoint
+    cv.Optional(CONF_MAX_DRIFT, default=15): cv.int_range(min=1, max=100),
+})
+
+RECIPE_SENSORS = {
+    "bottom": "BOTTOM",
+    "top": "TOP",
+}
+
+UNTIL_SCHEMA = cv.All(
+    cv.Schema({
+        cv.Exclusive(CONF_TEMPERATURE, CONF_UNTIL): cv.int_range(min=0, max=150),
+        cv.Exclusive(CONF_PLATEAU, CONF_UNTIL): cv.All(
+            cv.positive_time_period_minutes,
+            cv.Range(min=TimePeriod(minutes=1), max=TimePeriod(minutes=255)),
+        ),
+        cv.Optional(CONF_SENSOR, default="bottom"): cv.one_of(*RECIPE_SENSORS, lower=True),
+    }),
+    cv.has_exactly_one_key(CONF_TEMPERATURE, CONF_PLATEAU),
+)
+
+
+def validate_stage(config):
+    if CONF_UNTIL not in config and CONF_DURATION not in config:
+        raise cv.Invalid("A stage needs a duration, an until condition or both")
+    if CONF_RAMP_TO in config and CONF_DURATION not in config:
+        raise cv.Invalid("ramp_to needs a duration")
+    if config[CONF_HYSTERESIS] > min(config[CONF_TARGET], config.get(CONF_RAMP_TO, 255)):
+        raise cv.Invalid("hysteresis cannot be larger than the target")
+    return config
+
+
+STAGE_SCHEMA = cv.All(
+    cv.Schema({
+        cv.Optional(CONF_NAME): cv.string_strict,
+        cv.Required(CONF_TARGET): cv.int_range(min=0, max=150),
+        cv.Optional(CONF_RAMP_TO): cv.int_range(min=1, max=150),
+        cv.Optional(CONF_HYSTERESIS, default=0): cv.int_range(min=0, max=20),
+        cv.Optional(CONF_DURATION): cv.All(
+            cv.positive_time_period_minutes,
+            cv.Range(min=TimePeriod(minutes=1), max=TimePeriod(minutes=65535)),
+        ),
+        cv.Optional(CONF_UNTIL): UNTIL_SCHEMA,
+    }),
+    validate_stage,
+)
+
+RECIPE_SCHEMA = cv.Schema({
+    cv.Required(CONF_NAME): cv.string_strict,
+    cv.Required(CONF_STAGES): cv.All(cv.ensure_list(STAGE_SCHEMA), cv.Length(min=1, max=255)),
+})
+
+
+def stage_initializer(index, stage):
+    name = stage.get(CONF_NAME, f"Stage {index + 1}")
+    until = stage.get(CONF_UNTIL, {})
+
+    if CONF_TEMPERATURE in until:
+        exit_type, until_value = "TEMPERATURE", until[CONF_TEMPERATURE]
+    elif CONF_PLATEAU in until:
+        exit_type, until_value = "PLATEAU", int(until[CONF_PLATEAU].total_minutes)
+    else:
+        exit_type, until_value = "TIME", 0
+
+    sensor = RECIPE_SENSORS[until.get(CONF_SENSOR, "bottom")]
+    duration = int(stage[CONF_DURATION].total_minutes) if CONF_DURATION in stage else 0
+
+    return (
+        f"{{{cpp_string_escape(name)}, {stage[CONF_TARGET]}, {stage.get(CONF_RAMP_TO, 0)}, "
+        f"{stage[CONF_HYSTERESIS]}, {RecipeExit}::{exit_type}, {RecipeSensor}::{sensor}, "
+        f"{until_value}, {duration}}}"
+    )
 
 
 CONFIG_SCHEMA = cv.Schema({
     cv.GenerateID(): cv.declare_id(RiceCooker),
-    cv.Required(CONF_UART): cv.string
+    cv.Required(CONF_UART): cv.string,
+    cv.Optional(CONF_CRC_TABLE, default="full"): cv.one_of("full", "nibble", lower=True),
+    cv.Optional(CONF_INIT, default={}): INIT_SCHEMA,
+    cv.Optional(CONF_HEATER, default={}): HEATER_SCHEMA,
+    cv.Optional(CONF_POLL, default={}): POLL_SCHEMA,
+    cv.Optional(CONF_IDLE, default={}): IDLE_SCHEMA,
+    cv.Optional(CONF_CONTROL_TASK, default={}): CONTROL_TASK_SCHEMA,
+    cv.Optional(CONF_DISPLAY, default={}): DISPLAY_SCHEMA,
+    cv.Optional(CONF_SCHEDULE, default={}): SCHEDULE_SCHEMA,
+    cv.Optional(CONF_CHECKPOINT, default={}): CHECKPOINT_SCHEMA,
+    cv.Optional(CONF_RECIPES, default=[]): cv.ensure_list(RECIPE_SCHEMA),
 }).extend(cv.COMPONENT_SCHEMA).extend(uart.UART_DEVICE_SCHEMA)
 
 
@@ -23,3 +297,70 @@ async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
     await uart.register_uart_device(var, config)
+
+    init = config[CONF_INIT]
+    for step in init[CONF_STEPS]:
+        cg.add(var.add_init_step(step))
+    cg.add(var.set_init_gap(init[CONF_GAP]))
+    cg.add(var.set_init_timeout(init[CONF_TIMEOUT]))
+
+    heater = config[CONF_HEATER]
+    cg.add(var.set_heater_controller(heater[CONF_CONTROLLER]))
+    cg.add(var.set_heater_element_lag(heater[CONF_ELEMENT_LAG]))
+    cg.add(var.set_heater_save_interval(heater[CONF_SAVE_INTERVAL]))
+
+    relay = heater[CONF_RELAY]
+    cg.add(var.set_relay_window(relay[CONF_WINDOW]))
+    cg.add(var.set_relay_min_on_time(relay[CONF_MIN_ON_TIME]))
+    cg.add(var.set_relay_min_off_time(relay[CONF_MIN_OFF_TIME]))
+    cg.add(var.set_relay_cycle_budget(relay[CONF_MAX_CYCLES_PER_HOUR]))
+
+    poll = config[CONF_POLL]
+    cg.add(var.set_poll_interval(poll[CONF_INTERVAL]))
+    cg.add(var.set_fast_poll_interval(poll[CONF_FAST_INTERVAL]))
+    cg.add(var.set_response_timeout(poll[CONF_RESPONSE_TIMEOUT]))
+
+    idle = config[CONF_IDLE]
+    cg.add(var.set_idle_poll_interval(idle[CONF_POLL_INTERVAL]))
+    cg.add(var.set_idle_delay(idle[CONF_DELAY]))
+    if idle[CONF_LIGHT_SLEEP]:
+        cg.add_define("USE_RICECOOKER_LIGHT_SLEEP")
+        # Automatic light sleep: the idle task sleeps while no PM lock is held
+        add_idf_sdkconfig_option("CONFIG_PM_ENABLE", True)
+        add_idf_sdkconfig_option("CONFIG_FREERTOS_USE_TICKLESS_IDLE", True)
+
+    control_task = config[CONF_CONTROL_TASK]
+    cg.add(var.set_task_priority(control_task[CONF_PRIORITY]))
+    cg.add(var.set_task_core(control_task[CONF_CORE]))
+
+    for page, time in config[CONF_DISPLAY][CONF_PAGES].items():
+        cg.add(var.set_display_page_time(DISPLAY_PAGES[page], time))
+
+    schedule = config[CONF_SCHEDULE]
+    cg.add(var.set_schedule_margin(schedule[CONF_MARGIN]))
+    cg.add(var.set_schedule_min_margin(schedule[CONF_MIN_MARGIN]))
+
+    checkpoint = config[CONF_CHECKPOINT]
+    cg.add(var.set_resume(checkpoint[CONF_RESUME]))
+    cg.add(var.set_checkpoint_save_interval(checkpoint[CONF_SAVE_INTERVAL]))
+    cg.add(var.set_resume_max_drift(checkpoint[CONF_MAX_DRIFT]))
+
+    if config[CONF_CRC_TABLE] == "nibble":
+        cg.add_define("USE_RICECOOKER_CRC16_NIBBLE")
+
+    # Stage tables are emitted as constexpr arrays, so they stay in flash
+    for index, recipe in enumerate(config[CONF_RECIPES]):
+        stages_id = f"{config[CONF_ID]}_recipe_{index}_stages"
+        recipe_id = f"{config[CONF_ID]}_recipe_{index}"
+        stages = ",\n    ".join(
+            stage_initializer(i, stage) for i, stage in enumerate(recipe[CONF_STAGES])
+        )
+
+        cg.add_global(cg.RawStatement(
+            f"static constexpr {RecipeStage} {stages_id}[] = {{\n    {stages}\n}};"
+        ))
+        cg.add_global(cg.RawStatement(
+            f"static constexpr {Recipe} {recipe_id} = "
+            f"{{{cpp_string_escape(recipe[CONF_NAME])}, {stages_id}, {len(recipe[CONF_STAGES])}}};"
+        ))
+        cg.add(var.add_recipe(cg.RawExpression(f"&{recipe_id}")))
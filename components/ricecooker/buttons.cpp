@@ -0,0 +1,70 @@
+#include "buttons.h"
+#include "tick_scheduler.h"
+
+namespace esphome {
+namespace ricecooker {
+
+const char *ButtonEvent::key_name(Key key) {
+    switch (key) {
+        case TIMER: return "TIMER";
+        case CANCEL: return "CANCEL";
+        case SELECT: return "SELECT";
+        case START: return "START";
+        default: return "?";
+    }
+}
+
+const char *ButtonEvent::type_name(Type type) {
+    switch (type) {
+        case PRESS: return "press";
+        case SHORT_PRESS: return "short press";
+        case LONG_PRESS: return "long press";
+        case REPEAT: return "repeat";
+        default: return "?";
+    }
+}
+
+void ButtonDecoder::emit(ButtonEvent::Key key, ButtonEvent::Type type, uint32_t now) {
+    if (!events.push(ButtonEvent{key, type, now})) {
+        dropped++;
+    }
+}
+
+void ButtonDecoder::feed(uint8_t keys, uint32_t now) {
+    for (uint8_t i = 0; i < ButtonEvent::KEY_COUNT; i++) {
+        ButtonEvent::Key key = (ButtonEvent::Key) i;
+        KeyState &state = states[i];
+
+        if (!(keys & (1 << i))) {
+            if (state.down && ++state.absent >= RELEASE_SAMPLES) {
+                state.down = false;
+                if (!state.long_sent) {
+                    emit(key, ButtonEvent::SHORT_PRESS, now);
+                }
+            }
+            continue;
+        }
+
+        state.absent = 0;
+
+        if (!state.down) {
+            state.down = true;
+            state.long_sent = false;
+            state.pressed_at = now;
+            emit(key, ButtonEvent::PRESS, now);
+        } else if (!state.long_sent) {
+            if (now - state.pressed_at >= LONG_PRESS_TIME) {
+                state.long_sent = true;
+                state.repeat_at = now + REPEAT_INTERVAL;
+                emit(key, ButtonEvent::LONG_PRESS, now);
+            }
+        } else if (TickScheduler::is_due(now, state.repeat_at)) {
+            // From now, not from the last deadline: slow frames do not burst
+            state.repeat_at = now + REPEAT_INTERVAL;
+            emit(key, ButtonEvent::REPEAT, now);
+        }
+    }
+}
+
+} // namespace ricecooker
+} // namespace esphome
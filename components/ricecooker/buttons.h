@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+#include "spsc.h"
+
+namespace esphome {
+namespace ricecooker {
+
+struct ButtonEvent {
+    // Bit of the key in the MCU status byte
+    enum Key : uint8_t {
+        TIMER = 0,
+        CANCEL,
+        SELECT,
+        START,
+        KEY_COUNT
+    };
+
+    enum Type : uint8_t {
+        PRESS,          // first frame reporting the key
+        SHORT_PRESS,    // released before it became a long press
+        LONG_PRESS,
+        REPEAT,         // every repeat interval after the long press, while held
+    };
+
+    Key key;
+    Type type;
+    // Receive time of the frame that carried it, ms
+    uint32_t time;
+
+    static const char *key_name(Key key);
+    static const char *type_name(Type type);
+};
+
+/*
+    Panel keys from the MCU status frames.
+
+    The MCU reports the keys held in every answer, so a key is a level
+    sampled once per frame. A press is taken on the first frame that has
+    it, without waiting for confirmation: a frame only counts if its CRC
+    is good, so there is no noise to filter. Releases need RELEASE_SAMPLES
+    frames without the key, which rides over a frame that comes without it
+    while the finger is still down.
+*/
+class ButtonDecoder {
+public:
+    static const uint8_t KEY_MASK = 0x0f;
+
+    /* Feeds the key bits of one status frame, received at `now`. */
+    void feed(uint8_t keys, uint32_t now);
+
+    /* Next event, false when there is none. */
+    bool pop(ButtonEvent &event) { return events.pop(event); }
+
+    /* Events lost because nobody was reading them. */
+    uint32_t get_dropped() const { return dropped; }
+
+private:
+    void emit(ButtonEvent::Key key, ButtonEvent::Type type, uint32_t now);
+
+    static const uint32_t LONG_PRESS_TIME = 800;
+    static const uint32_t REPEAT_INTERVAL = 250;
+    static const uint8_t RELEASE_SAMPLES = 2;
+
+    struct KeyState {
+        bool down;
+        bool long_sent;
+        uint8_t absent;
+        uint32_t pressed_at;
+        uint32_t repeat_at;
+    };
+
+    KeyState states[ButtonEvent::KEY_COUNT] {};
+
+    SpscQueue<ButtonEvent, 16> events;
+    uint32_t dropped = 0;
+};
+
+} // namespace ricecooker
+} // namespace esphome
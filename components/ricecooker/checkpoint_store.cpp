@@ -0,0 +1,124 @@
+#include "checkpoint_store.h"
+#include "crc16.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+static const char *const TAG = "ricecooker";
+
+namespace esphome {
+namespace ricecooker {
+
+    // Left alone by the startup code, so it keeps its contents over a reset
+    RTC_NOINIT_ATTR CheckpointStore::Record CheckpointStore::rtc_record;
+
+    // The byte fields are checksummed as one run
+    static_assert(offsetof(ProgramCheckpoint, elapsed) == 8, "ProgramCheckpoint byte fields moved");
+
+    void CheckpointStore::setup() {
+        this->preference = global_preferences->make_preference<Record>(fnv1_hash("ricecooker_checkpoint"), true);
+    }
+
+    // Field by field, padding bytes are not guaranteed to survive a copy
+    uint16_t CheckpointStore::checksum(const Record &record) {
+        const Checkpoint &c = record.checkpoint;
+        const ProgramCheckpoint &p = c.program;
+
+        uint16_t crc = crc16((const uint8_t *) &record.version, sizeof(record.version));
+        crc = crc16(&p.kind, 8, crc);
+        crc = crc16((const uint8_t *) &p.elapsed, sizeof(p.elapsed), crc);
+        crc = crc16((const uint8_t *) &p.value_elapsed, sizeof(p.value_elapsed), crc);
+        crc = crc16(&c.top_temperature, 1, crc);
+        crc = crc16(&c.bottom_temperature, 1, crc);
+        return crc;
+    }
+
+    void CheckpointStore::seal(Record &record, const Checkpoint &checkpoint) {
+        memset(&record, 0, sizeof(record));
+        record.version = VERSION;
+        record.checkpoint = checkpoint;
+        record.crc = checksum(record);
+    }
+
+    bool CheckpointStore::is_valid(const Record &record, const char *where) {
+        if (record.version != VERSION || record.crc != checksum(record)) {
+            ESP_LOGD(TAG, "No program checkpoint in %s", where);
+            return false;
+        }
+        return true;
+    }
+
+    bool CheckpointStore::load(Checkpoint &checkpoint) {
+        Record record;
+
+        memcpy(&record, &rtc_record, sizeof(record));
+        if (is_valid(record, "RTC memory")) {
+            checkpoint = record.checkpoint;
+            return true;
+        }
+
+        if (!this->preference.load(&record) || !is_valid(record, "NVS")) {
+            return false;
+        }
+        checkpoint = record.checkpoint;
+        // The next save compares against what NVS holds
+        stored = record.checkpoint;
+        saved = true;
+        return true;
+    }
+
+    void CheckpointStore::update(const Checkpoint &checkpoint) {
+        Record record;
+        seal(record, checkpoint);
+        memcpy(&rtc_record, &record, sizeof(record));
+    }
+
+    bool CheckpointStore::moved(const ProgramCheckpoint &a, const ProgramCheckpoint &b) {
+        return a.kind != b.kind || a.stage != b.stage || memcmp(a.settings, b.settings, sizeof(a.settings)) != 0;
+    }
+
+    bool CheckpointStore::save(const Checkpoint &checkpoint, uint32_t now) {
+        const ProgramCheckpoint &program = checkpoint.program;
+
+        if (saved && !moved(program, stored.program)) {
+            // Same stage: only the clock and the pot moved, worth a write now and then or when the pot moved far
+            if (program.elapsed == stored.program.elapsed && program.value_elapsed == stored.program.value_elapsed) {
+                return false;
+            }
+            bool drifted = std::abs(checkpoint.bottom_temperature - stored.bottom_temperature) >= TEMPERATURE_STEP;
+            if (now - last_save < min_interval && !drifted) {
+                return false;
+            }
+        }
+        // Nothing running and nothing stored
+        if (!saved && program.kind == ProgramCheckpoint::NONE) {
+            return false;
+        }
+
+        Record record;
+        seal(record, checkpoint);
+        if (!this->preference.save(&record)) {
+            ESP_LOGW(TAG, "Saving the program checkpoint failed");
+            return false;
+        }
+
+        if (program.kind == ProgramCheckpoint::NONE) {
+            global_preferences->sync();
+            ESP_LOGD(TAG, "Cleared the program checkpoint");
+        } else {
+            ESP_LOGV(TAG, "Saved the program checkpoint: stage %u, %u s in", program.stage, (unsigned) program.elapsed);
+        }
+
+        stored = checkpoint;
+        saved = true;
+        last_save = now;
+        return true;
+    }
+
+}
+}
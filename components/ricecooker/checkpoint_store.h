@@ -0,0 +1,84 @@
+#pragma once
+
+#include "esphome/core/datatypes.h"
+#include "esphome/core/preferences.h"
+
+#include "program.h"
+
+namespace esphome {
+namespace ricecooker {
+
+    /* A program checkpoint and the pot it was taken with. */
+    struct Checkpoint {
+        ProgramCheckpoint program;  // kind NONE: nothing to resume
+        uint8_t top_temperature;    // ºC
+        uint8_t bottom_temperature;
+    };
+
+    /*
+        Keeps the running program's checkpoint across resets, in two copies.
+
+        RTC memory survives a brownout, watchdog or software reset (OTA
+        included) but not a power loss; writing it is a memory copy, so it
+        is refreshed every control step. NVS survives everything but wears,
+        so it is rewritten at once when the program or its stage changes
+        or the pot moved TEMPERATURE_STEP since the last write, and
+        otherwise at most once per min interval. The pot temperature
+        decides whether a cook resumes after a power loss, so the NVS copy
+        may not lag it by much more than that step. ESPHome batches NVS
+        writes on its own, a clear is synced to flash right away so a
+        finished cook never comes back.
+
+        Each record carries a layout version and a CRC, like ParameterStore;
+        RTC memory holds garbage after a power up and the CRC rejects it.
+    */
+    class CheckpointStore {
+        public:
+            /* Binds the preference slot, call from setup(). */
+            void setup();
+
+            /*
+                The RTC copy when it survived the reset, the NVS copy
+                otherwise. False when neither is valid.
+            */
+            bool load(Checkpoint &checkpoint);
+
+            /* RTC copy, every control step. */
+            void update(const Checkpoint &checkpoint);
+
+            /* NVS copy, see above. Returns whether a write happened. */
+            bool save(const Checkpoint &checkpoint, uint32_t now);
+
+            void set_min_interval(uint32_t interval) { min_interval = interval; }
+
+        private:
+            static const uint16_t VERSION = 2;
+            // ºC, well inside the default resume max drift of 15
+            static const int TEMPERATURE_STEP = 5;
+
+            struct Record {
+                uint16_t version;
+                uint16_t crc;
+                Checkpoint checkpoint;
+            };
+
+            static uint16_t checksum(const Record &record);
+            static void seal(Record &record, const Checkpoint &checkpoint);
+            static bool is_valid(const Record &record, const char *where);
+            // Another program or another stage, not just later
+            static bool moved(const ProgramCheckpoint &a, const ProgramCheckpoint &b);
+
+            // In RTC memory, see checkpoint_store.cpp
+            static Record rtc_record;
+
+            ESPPreferenceObject preference;
+
+            Checkpoint stored {};
+            bool saved = false;
+
+            uint32_t min_interval = 5 * 60 * 1000;
+            uint32_t last_save = 0;
+    };
+
+}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esphome/core/defines.h"
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    CRC16/XMODEM (poly 0x1021, init 0x0000), used by both directions of the
+    MCU protocol over every byte except the header.
+
+    Table driven and constexpr, so static frames get their CRC at compile
+    time. The default 256-entry table (512 bytes of flash) takes one lookup
+    per byte; `crc_table: nibble` selects a 16-entry table (32 bytes) with two
+    lookups per byte.
+*/
+
+namespace crc16_detail {
+
+static constexpr uint16_t POLY = 0x1021;
+
+#ifdef USE_RICECOOKER_CRC16_NIBBLE
+static constexpr int TABLE_BITS = 4;
+#else
+static constexpr int TABLE_BITS = 8;
+#endif
+
+static constexpr size_t TABLE_SIZE = 1 << TABLE_BITS;
+
+struct Table {
+    uint16_t values[TABLE_SIZE];
+};
+
+// Entry i is the CRC register after shifting in the top TABLE_BITS bits i
+constexpr Table make_table() {
+    Table table {};
+    for (size_t i = 0; i < TABLE_SIZE; i++) {
+        uint16_t crc = i << (16 - TABLE_BITS);
+        for (int bit = 0; bit < TABLE_BITS; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ POLY : crc << 1;
+        }
+        table.values[i] = crc;
+    }
+    return table;
+}
+
+static constexpr Table TABLE = make_table();
+
+constexpr uint16_t update(uint16_t crc, uint8_t byte) {
+#ifdef USE_RICECOOKER_CRC16_NIBBLE
+    crc = (crc << 4) ^ TABLE.values[((crc >> 12) ^ (byte >> 4)) & 0x0f];
+    crc = (crc << 4) ^ TABLE.values[((crc >> 12) ^ byte) & 0x0f];
+    return crc;
+#else
+    return (crc << 8) ^ TABLE.values[((crc >> 8) ^ byte) & 0xff];
+#endif
+}
+
+} // namespace crc16_detail
+
+/* Pass the previous result as `crc` to continue over several buffers. */
+constexpr uint16_t crc16(const uint8_t *data, size_t len, uint16_t crc = 0x0000) {
+    while (len--) {
+        crc = crc16_detail::update(crc, *data++);
+    }
+    return crc;
+}
+
+} // namespace ricecooker
+} // namespace esphome
@@ -0,0 +1,244 @@
+#include "display.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace ricecooker {
+
+// The font as a table from ' ' to '~', built at compile time so it stays in flash
+struct Font {
+    static constexpr char FIRST = ' ';
+    static constexpr char LAST = '~';
+    uint8_t glyphs[LAST - FIRST + 1];
+};
+
+static constexpr Font make_font() {
+    Font font {};
+    for (char c = Font::FIRST; c <= Font::LAST; c++) {
+        font.glyphs[c - Font::FIRST] = glyph(c);
+    }
+    return font;
+}
+
+static constexpr Font FONT = make_font();
+
+// The digits the MCU has always been sent
+static_assert(FONT.glyphs['0' - Font::FIRST] == 0b00111111, "font: 0");
+static_assert(FONT.glyphs['4' - Font::FIRST] == 0b01100110, "font: 4");
+static_assert(FONT.glyphs['9' - Font::FIRST] == 0b01101111, "font: 9");
+
+static uint8_t lookup(char c) {
+    return c >= Font::FIRST && c <= Font::LAST ? FONT.glyphs[c - Font::FIRST] : 0;
+}
+
+// One character and the dot that joins it
+static const char *next_glyph(const char *text) {
+    if (text[0] != '.' && text[1] == '.') {
+        return text + 2;
+    }
+    return text + 1;
+}
+
+void Framebuffer::clear() {
+    memset(digits, 0, sizeof(digits));
+    blink = 0;
+}
+
+void Framebuffer::set_dot(size_t pos, bool on) {
+    if (pos >= DIGITS) {
+        return;
+    }
+    if (on) {
+        digits[pos] |= segment::DOT;
+    } else {
+        digits[pos] &= ~segment::DOT;
+    }
+}
+
+size_t Framebuffer::print(const char *text, size_t pos) {
+    while (*text != '\0' && pos < DIGITS) {
+        const char *next = next_glyph(text);
+        digits[pos++] = lookup(text[0]) | (next - text == 2 ? segment::DOT : 0);
+        text = next;
+    }
+    return pos;
+}
+
+void Framebuffer::print_number(uint32_t value, size_t pos, size_t width, bool zero_pad) {
+    for (size_t i = pos + width; i > pos; i--) {
+        bool blank = value == 0 && i != pos + width && !zero_pad;
+        set(i - 1, blank ? 0 : lookup('0' + value % 10));
+        value /= 10;
+    }
+}
+
+void Framebuffer::print_time(uint8_t left, uint8_t right) {
+    print_number(left, 0, 2, true);
+    print_number(right, 2, 2, true);
+    set_colon(true);
+}
+
+bool Framebuffer::operator==(const Framebuffer &other) const {
+    return memcmp(digits, other.digits, sizeof(digits)) == 0 && blink == other.blink;
+}
+
+void Display::set_overlay(const Framebuffer &frame, uint32_t now) {
+    if (!overlay_shown || frame != overlay) {
+        // A new value is shown lit, then blinks
+        blink_started = now;
+    }
+    overlay = frame;
+    overlay_shown = true;
+}
+
+bool Display::has_content(Page page) const {
+    switch (page) {
+        case ETA:
+            return remaining.has_value();
+        case STAGE:
+            return stage != nullptr;
+        case ERROR:
+            return error != 0;
+        case TEMPERATURE:
+        default:
+            return true;
+    }
+}
+
+size_t Display::text_length(const char *text) {
+    size_t length = 0;
+    for (; *text != '\0'; text = next_glyph(text)) {
+        length++;
+    }
+    return length;
+}
+
+uint32_t Display::time_on(Page page) const {
+    uint32_t time = page_time[page];
+
+    // Long stage names stay until they have scrolled through
+    if (page == STAGE) {
+        size_t length = text_length(stage);
+        if (length > Framebuffer::DIGITS) {
+            time = std::max(time, (uint32_t) (length - Framebuffer::DIGITS) * SCROLL_STEP + 2 * SCROLL_HOLD);
+        }
+    }
+    return time;
+}
+
+void Display::next_page(uint32_t now) {
+    Page next = TEMPERATURE;
+    for (uint8_t i = 1; i <= PAGE_COUNT; i++) {
+        Page candidate = (Page) ((page + i) % PAGE_COUNT);
+        if (has_content(candidate) && page_time[candidate] != 0) {
+            next = candidate;
+            break;
+        }
+    }
+
+    page = next;
+    page_started = now;
+    blink_started = now;
+}
+
+bool Display::render(uint32_t now, uint8_t *out) {
+    if (!started) {
+        started = true;
+        page_started = now;
+    }
+
+    // A new error is shown at once
+    if (error != shown_error) {
+        shown_error = error;
+        if (error != 0) {
+            page = ERROR;
+            page_started = now;
+            blink_started = now;
+        }
+    }
+
+    if (!has_content(page) || page_time[page] == 0 || now - page_started >= time_on(page)) {
+        next_page(now);
+    }
+
+    Framebuffer frame;
+    if (overlay_shown) {
+        frame = overlay;
+    } else {
+        draw(page, now, frame);
+    }
+
+    // Off for every other half period
+    if (frame.get_blink() != 0 && (now - blink_started) / BLINK_TIME % 2 == 1) {
+        for (size_t i = 0; i < Framebuffer::DIGITS; i++) {
+            if (frame.get_blink() & (1 << i)) {
+                frame.set(i, 0);
+            }
+        }
+    }
+
+    bool changed = !rendered_once;
+    for (size_t i = 0; i < Framebuffer::DIGITS; i++) {
+        if (rendered[i] != frame.get(i)) {
+            rendered[i] = frame.get(i);
+            changed = true;
+        }
+    }
+    rendered_once = true;
+
+    memcpy(out, rendered, Framebuffer::DIGITS);
+    return changed;
+}
+
+void Display::draw(Page page, uint32_t now, Framebuffer &frame) const {
+    switch (page) {
+        case ETA: {
+            // Rounded up, 0:00 only when done
+            uint32_t minutes = std::min((*remaining + 59) / 60, MAX_MINUTES);
+            frame.print_time(minutes / 60, minutes % 60);
+            break;
+        }
+
+        case TEMPERATURE:
+            // "95*C", "100*"
+            if (temperature >= 100) {
+                frame.print_number(temperature, 0, 3, false);
+                frame.print("*", 3);
+            } else {
+                frame.print_number(temperature, 0, 2, false);
+                frame.print("*C", 2);
+            }
+            break;
+
+        case STAGE:
+            draw_text(stage, now - page_started, frame);
+            break;
+
+        case ERROR:
+            frame.print("E-");
+            frame.print_number(error, 2, 2, true);
+            frame.set_blink(Framebuffer::BLINK_ALL);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void Display::draw_text(const char *text, uint32_t elapsed, Framebuffer &frame) const {
+    size_t length = text_length(text);
+
+    // Holds the start, steps a digit at a time, holds the end
+    size_t offset = 0;
+    if (length > Framebuffer::DIGITS && elapsed > SCROLL_HOLD) {
+        offset = std::min(length - Framebuffer::DIGITS, (size_t) ((elapsed - SCROLL_HOLD) / SCROLL_STEP));
+    }
+    for (size_t i = 0; i < offset; i++) {
+        text = next_glyph(text);
+    }
+    frame.print(text);
+}
+
+} // namespace ricecooker
+} // namespace esphome
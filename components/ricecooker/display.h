@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    7-segment font. Segment a (top) is bit 0, b to f follow clockwise, g
+    (middle) is bit 6 and the dot bit 7, as the MCU takes them.
+
+    Letters are the usual approximations; where upper and lower case look
+    alike they share a shape. '*' is the degree sign. Anything else is
+    blank.
+*/
+namespace segment {
+static constexpr uint8_t A = 1 << 0;
+static constexpr uint8_t B = 1 << 1;
+static constexpr uint8_t C = 1 << 2;
+static constexpr uint8_t D = 1 << 3;
+static constexpr uint8_t E = 1 << 4;
+static constexpr uint8_t F = 1 << 5;
+static constexpr uint8_t G = 1 << 6;
+static constexpr uint8_t DOT = 1 << 7;
+} // namespace segment
+
+constexpr uint8_t glyph(char c) {
+    switch (c) {
+        case '0': case 'O': return 0x3f;
+        case '1': return 0x06;
+        case '2': case 'Z': case 'z': return 0x5b;
+        case '3': return 0x4f;
+        case '4': return 0x66;
+        case '5': case 'S': case 's': return 0x6d;
+        case '6': return 0x7d;
+        case '7': return 0x07;
+        case '8': return 0x7f;
+        case '9': return 0x6f;
+        case 'A': case 'a': return 0x77;
+        case 'B': case 'b': return 0x7c;
+        case 'C': return 0x39;
+        case 'c': return 0x58;
+        case 'D': case 'd': return 0x5e;
+        case 'E': case 'e': return 0x79;
+        case 'F': case 'f': return 0x71;
+        case 'G': case 'g': return 0x3d;
+        case 'H': case 'X': case 'x': return 0x76;
+        case 'h': return 0x74;
+        case 'I': return 0x30;
+        case 'i': return 0x10;
+        case 'J': case 'j': return 0x1e;
+        case 'K': case 'k': return 0x75;
+        case 'L': case 'l': return 0x38;
+        case 'M': case 'm': return 0x37;
+        case 'N': case 'n': return 0x54;
+        case 'o': return 0x5c;
+        case 'P': case 'p': return 0x73;
+        case 'Q': case 'q': return 0x67;
+        case 'R': case 'r': return 0x50;
+        case 'T': case 't': return 0x78;
+        case 'U': case 'V': return 0x3e;
+        case 'u': case 'v': return 0x1c;
+        case 'W': case 'w': return 0x2a;
+        case 'Y': case 'y': return 0x6e;
+        case '-': return segment::G;
+        case '_': return segment::D;
+        case '=': return segment::D | segment::G;
+        case '*': return segment::A | segment::B | segment::F | segment::G;
+        case '?': return 0x53;
+        case '.': return segment::DOT;
+        default: return 0;
+    }
+}
+
+/*
+    The four digits as the MCU shows them, plus which of them blink. The
+    dots of the two middle digits are the colon.
+*/
+class Framebuffer {
+public:
+    static constexpr size_t DIGITS = 4;
+
+    void clear();
+
+    void set(size_t pos, uint8_t segments) { if (pos < DIGITS) digits[pos] = segments; }
+    uint8_t get(size_t pos) const { return pos < DIGITS ? digits[pos] : 0; }
+    void set_dot(size_t pos, bool on);
+    void set_colon(bool on) { set_dot(1, on); set_dot(2, on); }
+
+    /*
+        Text from `pos`, cut at the last digit. A '.' lights the dot of
+        the digit before it instead of taking one. Returns the position
+        after the text.
+    */
+    size_t print(const char *text, size_t pos = 0);
+
+    /* `value` right aligned in `width` digits ending at `pos + width`, zero or blank padded. */
+    void print_number(uint32_t value, size_t pos, size_t width, bool zero_pad);
+
+    /* "h:mm" style, two zero padded pairs and the colon. */
+    void print_time(uint8_t left, uint8_t right);
+
+    /* Bit n blinks digit n, dot included. */
+    void set_blink(uint8_t mask) { blink = mask; }
+    uint8_t get_blink() const { return blink; }
+
+    static constexpr uint8_t BLINK_ALL = (1 << DIGITS) - 1;
+
+    bool operator==(const Framebuffer &other) const;
+    bool operator!=(const Framebuffer &other) const { return !(*this == other); }
+
+private:
+    uint8_t digits[DIGITS] = {};
+    uint8_t blink = 0;
+};
+
+/*
+    What the display shows when the panel menu is not using it: pages
+    taken in turn, each for its own time, among those that have something
+    to show. The control step sets their content; render() picks the page,
+    scrolls text that does not fit and blinks, and is cheap enough to run
+    before every MCU frame.
+*/
+class Display {
+public:
+    enum Page : uint8_t {
+        ETA,            // h:mm left, while the program has an estimate
+        TEMPERATURE,    // bottom sensor, ºC
+        STAGE,          // stage name, while a program runs
+        ERROR,          // "E-nn", blinking, until the program is cleared
+        PAGE_COUNT
+    };
+
+    /* How long `page` stays before the next, 0 leaves it out. */
+    void set_page_time(Page page, uint32_t time) { page_time[page] = time; }
+
+    // Content, from the control step
+    void set_remaining_time(std::optional<uint32_t> seconds) { remaining = seconds; }
+    void set_temperature(uint8_t temperature) { this->temperature = temperature; }
+    void set_stage(const char *name) { stage = name; }
+    void set_error(uint8_t code) { error = code; }
+
+    /* Shown instead of the pages until clear_overlay(), for the panel menu. */
+    void set_overlay(const Framebuffer &frame, uint32_t now);
+    void clear_overlay() { overlay_shown = false; }
+
+    /*
+        Segments for `now` into `out`. True when they differ from the last
+        render, the only time they need to go to the MCU.
+    */
+    bool render(uint32_t now, uint8_t *out);
+
+    Page get_page() const { return page; }
+
+private:
+    bool has_content(Page page) const;
+    uint32_t time_on(Page page) const;
+    void next_page(uint32_t now);
+    void draw(Page page, uint32_t now, Framebuffer &frame) const;
+    void draw_text(const char *text, uint32_t elapsed, Framebuffer &frame) const;
+    static size_t text_length(const char *text);
+
+    // Half a blink period, and the time per step of scrolled text
+    static constexpr uint32_t BLINK_TIME = 500;
+    static constexpr uint32_t SCROLL_STEP = 350;
+    // Scrolled text stops at both ends for this long
+    static constexpr uint32_t SCROLL_HOLD = 700;
+    // 99:59, the most the ETA page fits
+    static constexpr uint32_t MAX_MINUTES = 99 * 60 + 59;
+
+    uint32_t page_time[PAGE_COUNT] = {4000, 2000, 2000, 2000};
+
+    std::optional<uint32_t> remaining;
+    uint8_t temperature = 0;
+    const char *stage = nullptr;
+    uint8_t error = 0;
+    uint8_t shown_error = 0;
+
+    Framebuffer overlay;
+    bool overlay_shown = false;
+    // Blinking starts lit on every new overlay or page
+    uint32_t blink_started = 0;
+
+    Page page = TEMPERATURE;
+    uint32_t page_started = 0;
+    bool started = false;
+
+    uint8_t rendered[Framebuffer::DIGITS] = {};
+    bool rendered_once = false;
+};
+
+} // namespace ricecooker
+} // namespace esphome
@@ -0,0 +1,57 @@
+#include "frame_parser.h"
+#include "crc16.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace ricecooker {
+
+bool FrameParser::feed(uint8_t byte) {
+    if (n == 0 && byte != HEADER) {
+        // Line noise or the tail of a frame we joined halfway
+        discarded_bytes++;
+        return false;
+    }
+
+    buffer[n++] = byte;
+
+    if (n < LENGTH) {
+        return false;
+    }
+
+    if (check()) {
+        valid_frames++;
+        n = 0;
+        return true;
+    }
+
+    crc_errors++;
+    resync();
+    return false;
+}
+
+bool FrameParser::check() const {
+    // For CRC header is skipped
+    uint16_t crc = crc16(buffer + 1, LENGTH - 3);
+    return buffer[LENGTH - 2] == ((crc >> 8) & 0xFF) && buffer[LENGTH - 1] == (crc & 0xFF);
+}
+
+void FrameParser::resync() {
+    // The header we locked on may have been a data byte: restart from the
+    // next header candidate inside the rejected frame.
+    for (size_t i = 1; i < LENGTH; i++) {
+        if (buffer[i] == HEADER) {
+            n = LENGTH - i;
+            memmove(buffer, buffer + i, n);
+            discarded_bytes += i;
+            resyncs++;
+            return;
+        }
+    }
+
+    discarded_bytes += LENGTH;
+    n = 0;
+}
+
+} // namespace ricecooker
+} // namespace esphome
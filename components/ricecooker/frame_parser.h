@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    Incremental parser for the MCU status frames (0xAA header, fixed length,
+    CRC16/XMODEM over bytes 1..7).
+
+    Bytes are fed one at a time as they arrive, so a frame split across
+    several reads is kept until it is complete. When a frame fails the CRC
+    check the parser resynchronises on the next header byte already
+    buffered instead of dropping everything it has.
+*/
+class FrameParser {
+public:
+    static const uint8_t HEADER = 0xaa;
+    static const size_t LENGTH = 10;
+
+    /*
+        Feeds one received byte.
+
+        Returns true when it completes a valid frame, which stays available
+        through frame() until the next call.
+    */
+    bool feed(uint8_t byte);
+
+    const uint8_t *frame() const { return buffer; }
+
+    void reset() { n = 0; }
+
+    uint32_t get_valid_frames() const { return valid_frames; }
+    uint32_t get_crc_errors() const { return crc_errors; }
+    uint32_t get_resyncs() const { return resyncs; }
+    uint32_t get_discarded_bytes() const { return discarded_bytes; }
+
+private:
+    bool check() const;
+    void resync();
+
+    uint8_t buffer[LENGTH];
+    size_t n = 0;
+
+    // Statistics
+    uint32_t valid_frames = 0;
+    uint32_t crc_errors = 0;
+    uint32_t resyncs = 0;
+    uint32_t discarded_bytes = 0;
+};
+
+} // namespace ricecooker
+} // namespace esphome
@@ -1,5 +1,10 @@
 #include "heater.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <cstdint>
+
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 #include "esp_log.h"
 
@@ -11,14 +16,20 @@ namespace ricecooker {
     void Heater::power_on() {
         if(!this->power){
             ESP_LOGD(TAG, "Heater power: on");
+            trace(TraceEvent::HEATER_POWER, 1);
             this->power = true;
+
+            relay_on_since = millis();
         }
     }
 
     void Heater::power_off() {
         if(this->power){
             ESP_LOGD(TAG, "Heater power: off");
+            trace(TraceEvent::HEATER_POWER, 0);
             this->power = false;
+
+            relay_on_time += millis() - relay_on_since;
         }
     }
 
@@ -35,102 +46,107 @@ namespace ricecooker {
         return bottom_temperature;
     }
 
+    uint8_t Heater::get_min_target() {
+        return min_target;
+    }
+
+    uint8_t Heater::get_max_target() {
+        return max_target;
+    }
+
     void Heater::reset() {
         power_off();
-        just_reset = true;
 
         max_target = 0;
         min_target = 0;
 
-        power_remain = 0;
-        power_wait_remain = 0;
-        power_modulate_last = 0;
-
-        last_max_target = 0;
-        last_power_time = 0;
+        controller->reset();
+        relay_scheduler.reset();
     }
 
     bool Heater::get_power() {
         return this->power;
     }
 
-    void Heater::update(uint8_t top_temp, uint8_t bottom_temp) {
-        this->top_temperature = top_temp;
-        this->bottom_temperature = bottom_temp;
-        this->max_temperature = std::max(max_temperature, bottom_temp);
+    void Heater::set_controller(ControllerType type) {
+        switch (type) {
+            case ControllerType::THERMAL_MASS:
+                controller = &thermal_mass_controller;
+                break;
+            case ControllerType::PREDICTIVE:
+                controller = &predictive_controller;
+                break;
+        }
+        controller->reset();
+        ESP_LOGD(TAG, "Heater controller: %s", controller->get_name());
     }
 
-    void Heater::step(int millis) {
+    void Heater::get_parameters(HeaterParameters &parameters) {
+        parameters.thermal_mass = thermal_mass_controller.get_thermal_mass();
+        predictive_controller.get_model(parameters.bottom_model, parameters.top_model, parameters.model_samples);
+    }
 
-        int lapsed = millis - power_modulate_last;
-        power_modulate_last = millis;
+    void Heater::set_parameters(const HeaterParameters &parameters) {
+        thermal_mass_controller.set_thermal_mass(parameters.thermal_mass);
+        predictive_controller.set_model(parameters.bottom_model, parameters.top_model, parameters.model_samples);
+    }
 
-        if (power_remain != 0) {
-            power_remain = std::max(1, power_remain - lapsed);
-        }
-        
-        power_wait_remain = std::max(0, power_wait_remain - lapsed);
+    void Heater::reset_parameters() {
+        thermal_mass_controller.set_thermal_mass(ThermalMassController::DEFAULT_THERMAL_MASS);
+        predictive_controller.forget();
+        controller->reset();
+    }
 
-        if (bottom_temperature < min_target && power_remain == 0 && power_wait_remain == 0) {
+    uint32_t Heater::estimate_heating_time(float from, float to) {
+        if (to <= from) {
+            return 0;
+        }
+        float lag = std::max(0.0f, (bottom_fine - top_fine) / 256.0f);
+        return controller->estimate_heating_time(from, from - lag, to);
+    }
 
-            power_on();
+    void Heater::update(uint16_t top_temp, uint16_t bottom_temp, int16_t bottom_rate) {
+        this->top_fine = top_temp;
+        this->bottom_fine = bottom_temp;
+        this->bottom_rate = bottom_rate;
 
-            int range = (int) max_temperature - (int) last_min_temp;
-            
-            int time_needed;
-            if (range >= 1) {
-                time_needed = last_power_time / range;
-            } else {
-                // Avoid division by zero.
-                // Temperature did not rise with last_power_time, so increment it
-                time_needed = last_power_time + last_power_time / 4;
-            }
-
-            int diff = (int) last_max_target - (int) max_temperature;
-            diff = std::clamp(diff, -3, 3);
-
-            int error = time_needed - thermal_mass;
-            ESP_LOGD(TAG, "In last heating: error %d ms/ºC, diff %dºC", error, diff);
-
-            if (
-                !just_reset
-                // We cannot estimate thermal mass if heat is used to boil water
-                // instead of raising its temperature.
-                && max_temperature < 100
-            ) {
-                // Change estimated thermal mass in proportion to how different (`diff`)
-                // was the actual max temperature and its target.
-                if (diff == 0) {
-                    thermal_mass += std::clamp(error, -200, 200);
-                } else if (diff > 0) {
-                    thermal_mass += std::clamp(error, 200, 500 * diff);
-                } else {
-                    thermal_mass += std::clamp(error, -500 * diff, -200);
-                }
-            }
-
-            power_remain = (max_target - bottom_temperature) * thermal_mass;
-
-            last_max_target = max_target;
-            max_temperature = bottom_temperature;
-            last_min_temp = bottom_temperature;
-            last_power_time = power_remain;
-            just_reset = false;
-
-            ESP_LOGD(TAG, "Power modulating: heating ON for %d ms, Thermal mass %d ms/ºC", power_remain, thermal_mass);
-
-        } else if (bottom_temperature >= max_target || power_remain == 1) {
+        this->top_temperature = std::min((top_temp + 128) >> 8, 255);
+        this->bottom_temperature = std::min((bottom_temp + 128) >> 8, 255);
+        controller->observe(top_temperature, bottom_temperature);
+    }
 
-            power_off();
+    void Heater::step(uint32_t millis) {
 
-            power_remain = 0;
-            power_wait_remain = 30000;
+        // Unsigned difference survives the millis() wrap
+        uint32_t lapsed = millis - power_modulate_last;
+        power_modulate_last = millis;
 
+        HeaterInput input {
+            top_temperature,
+            bottom_temperature,
+            top_fine,
+            bottom_fine,
+            bottom_rate,
+            min_target,
+            max_target,
+            power,
+            lapsed,
+        };
+
+        float duty = controller->step(input);
+
+        if (relay_scheduler.update(millis, duty, power)) {
+            power_on();
         } else {
-            // Keep last heating state to reduce relay wear.
+            power_off();
+        }
+    }
 
-            ESP_LOGD(TAG, "Power modulating: power remaining %d ms, power waiting %d ms, Thermal mass %d ms/ºC", power_remain, power_wait_remain, thermal_mass);
+    uint64_t Heater::get_relay_on_time() {
+        if (power) {
+            return relay_on_time + (millis() - relay_on_since);
         }
+        return relay_on_time;
     }
 }
 }
@@ -2,10 +2,22 @@
 
 #include "esphome/core/datatypes.h"
 
+#include "heater_controller.h"
+#include "predictive_controller.h"
+#include "relay_scheduler.h"
+
 namespace esphome {
 namespace ricecooker {
 
 
+/* What the controllers learned about the pot, saved across reboots. */
+struct HeaterParameters {
+    int32_t thermal_mass;
+    float bottom_model[4];
+    float top_model[3];
+    uint16_t model_samples;
+};
+
 class Heater {
 
     public:
@@ -17,35 +29,86 @@ class Heater {
         uint8_t get_top_temperature();
         uint8_t get_bottom_temperature();
 
+        uint8_t get_min_target();
+        uint8_t get_max_target();
+
+        /* Holding a target band and near it, where the relay decisions are made. */
+        bool is_modulating() { return max_target != 0 && bottom_temperature + MODULATION_MARGIN >= min_target; }
+
         void reset();
 
-        void update(uint8_t top_temp, uint8_t bottom_temp);
-        void step(int millis);
+        /* Filtered temperatures, Q8.8 ºC, and bottom slope, Q8.8 ºC per minute. See TemperatureFilter. */
+        void update(uint16_t top_temp, uint16_t bottom_temp, int16_t bottom_rate);
+        void step(uint32_t millis);
         bool get_power();
 
+        enum class ControllerType : uint8_t {
+            THERMAL_MASS,
+            PREDICTIVE,
+        };
+
+        /* Selects who decides the relay, the thermal mass estimator is always the fallback. */
+        void set_controller(ControllerType type);
+        HeaterController* get_controller() { return controller; }
+
+        void set_element_lag(uint32_t lag) { predictive_controller.set_element_lag(lag); }
+
+        // Relay switching, see RelayScheduler
+        void set_relay_window(uint32_t window) { relay_scheduler.set_window(window); }
+        void set_relay_min_on_time(uint32_t time) { relay_scheduler.set_min_on_time(time); }
+        void set_relay_min_off_time(uint32_t time) { relay_scheduler.set_min_off_time(time); }
+        void set_relay_cycle_budget(uint16_t budget) { relay_scheduler.set_cycle_budget(budget); }
+
+        /* Relay closings since boot. */
+        uint32_t get_relay_cycles() { return relay_scheduler.get_cycles(); }
+        /* Time the relay has been closed since boot, in ms. */
+        uint64_t get_relay_on_time();
+
+        int get_thermal_mass() { return thermal_mass_controller.get_thermal_mass(); }
+
+        /*
+            Seconds at full power for the bottom to go from `from` to `to` ºC,
+            from what the controller learned. The top is assumed to trail the
+            bottom as much as it does now.
+        */
+        uint32_t estimate_heating_time(float from, float to);
+        /* Same, from the current bottom temperature. */
+        uint32_t estimate_heating_time(float to) { return estimate_heating_time(bottom_fine / 256.0f, to); }
+
+        void get_parameters(HeaterParameters &parameters);
+        void set_parameters(const HeaterParameters &parameters);
+
+        /* Back to the built-in defaults, the pot is learned again from scratch. */
+        void reset_parameters();
+
     private:
 
+        // ºC below the band where modulating starts
+        static const uint8_t MODULATION_MARGIN = 5;
+
         uint8_t max_target = 0;
         uint8_t min_target = 0;
 
-        int power_remain = 0;
-        int power_wait_remain = 0;
-        int power_modulate_last = 0;
+        uint32_t power_modulate_last = 0;
 
         bool power = false;
 
+        uint64_t relay_on_time = 0;
+        uint32_t relay_on_since = 0;
+
+        // Rounded to whole degrees, what programs compare against
         uint8_t top_temperature = 0;
         uint8_t bottom_temperature = 0;
 
-        uint8_t max_temperature = 0;
-        uint8_t last_max_target = 0;
-        uint8_t last_min_temp = 0;
-        int last_power_time = 0;
+        uint16_t top_fine = 0;
+        uint16_t bottom_fine = 0;
+        int16_t bottom_rate = 0;
 
-        bool just_reset = true;
+        ThermalMassController thermal_mass_controller;
+        PredictiveController predictive_controller {&thermal_mass_controller};
+        HeaterController* controller {&predictive_controller};
 
-        /* Estimate of milliseconds of the heater on needed to rise 1ºC bottom_temperature */
-        int thermal_mass = 1500;
+        RelayScheduler relay_scheduler;
 };
 
 
@@ -0,0 +1,107 @@
+#include "heater_controller.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace esphome {
+namespace ricecooker {
+
+    void ThermalMassController::observe(uint8_t /* top_temp */, uint8_t bottom_temp) {
+        this->max_temperature = std::max(max_temperature, bottom_temp);
+    }
+
+    void ThermalMassController::reset() {
+        just_reset = true;
+
+        power_remain = 0;
+        power_wait_remain = 0;
+
+        last_max_target = 0;
+        last_power_time = 0;
+    }
+
+    uint32_t ThermalMassController::estimate_heating_time(float bottom, float /* top */, float to) {
+        // Losses are already in the thermal mass, it is the average cost of a degree
+        return std::max(0.0f, to - bottom) * thermal_mass / 1000;
+    }
+
+    float ThermalMassController::step(const HeaterInput &input) {
+
+        int lapsed = std::min<uint32_t>(input.lapsed, INT32_MAX);
+
+        if (power_remain != 0) {
+            power_remain = std::max(1, power_remain - lapsed);
+        }
+
+        power_wait_remain = std::max(0, power_wait_remain - lapsed);
+
+        // Heating again before the peak would cut the cycle's max_temperature short
+        bool settling = input.bottom_rate > SETTLING_RATE;
+
+        if (input.bottom_temperature < input.min_target && power_remain == 0 && power_wait_remain == 0 && !settling) {
+
+            int range = (int) max_temperature - (int) last_min_temp;
+
+            int time_needed;
+            if (range >= 1) {
+                time_needed = last_power_time / range;
+            } else {
+                // Avoid division by zero.
+                // Temperature did not rise with last_power_time, so increment it
+                time_needed = last_power_time + last_power_time / 4;
+            }
+
+            int diff = (int) last_max_target - (int) max_temperature;
+            diff = std::clamp(diff, -3, 3);
+
+            int error = time_needed - thermal_mass;
+            trace(TraceEvent::HEATER_ESTIMATE, error, diff);
+
+            if (
+                !just_reset
+                // We cannot estimate thermal mass if heat is used to boil water
+                // instead of raising its temperature.
+                && max_temperature < 100
+            ) {
+                // Change estimated thermal mass in proportion to how different (`diff`)
+                // was the actual max temperature and its target.
+                if (diff == 0) {
+                    thermal_mass += std::clamp(error, -200, 200);
+                } else if (diff > 0) {
+                    thermal_mass += std::clamp(error, 200, 500 * diff);
+                } else {
+                    thermal_mass += std::clamp(error, 500 * diff, -200);
+                }
+            }
+
+            power_remain = (input.max_target - input.bottom_temperature) * thermal_mass;
+
+            last_max_target = input.max_target;
+            max_temperature = input.bottom_temperature;
+            last_min_temp = input.bottom_temperature;
+            last_power_time = power_remain;
+            just_reset = false;
+
+            trace(TraceEvent::HEATER_ON, power_remain, thermal_mass);
+
+            return 1.0f;
+
+        } else if (input.bottom_temperature >= input.max_target || power_remain == 1) {
+
+            power_remain = 0;
+            power_wait_remain = 30000;
+
+            return 0.0f;
+
+        } else {
+            // Keep last heating state to reduce relay wear.
+
+            trace(TraceEvent::HEATER_HOLD, power_remain, power_wait_remain, thermal_mass);
+
+            return input.power ? 1.0f : 0.0f;
+        }
+    }
+
+}
+}
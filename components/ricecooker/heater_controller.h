@@ -0,0 +1,94 @@
+#pragma once
+
+#include "esphome/core/datatypes.h"
+
+namespace esphome {
+namespace ricecooker {
+
+    /* What the controller sees on every control step. */
+    struct HeaterInput {
+        uint8_t top_temperature;
+        uint8_t bottom_temperature;
+
+        // Filtered, Q8.8 ºC and Q8.8 ºC per minute
+        uint16_t top_fine;
+        uint16_t bottom_fine;
+        int16_t bottom_rate;
+
+        uint8_t min_target;
+        uint8_t max_target;
+
+        // Relay state now, a program may have switched it in this step
+        bool power;
+        // Milliseconds since the previous step
+        uint32_t lapsed;
+    };
+
+    /*
+        Decides how much the heating element runs to keep the bottom
+        temperature between the program targets. Controllers return a duty
+        fraction, 0 to 1; Heater's RelayScheduler turns it into switching.
+    */
+    class HeaterController {
+        public:
+            virtual ~HeaterController() = default;
+
+            virtual const char* get_name() = 0;
+
+            /* Sees every temperature update, also between control steps. */
+            virtual void observe(uint8_t /* top_temp */, uint8_t /* bottom_temp */) {}
+
+            virtual float step(const HeaterInput &input) = 0;
+
+            /* Forgets the current heating cycle. Learned parameters are kept. */
+            virtual void reset() = 0;
+
+            /*
+                Seconds at full power for the bottom to go from `bottom` to
+                `to` ºC with the top at `top`, from what the controller learned.
+                For time estimates, the relay is not touched.
+            */
+            virtual uint32_t estimate_heating_time(float bottom, float top, float to) = 0;
+    };
+
+    /*
+        Bang-bang control, duty is only 0 or 1: below the target band the
+        element runs for the time the estimated thermal mass needs to reach max
+        target, then waits for the heat to settle: at least 30 s, and until the
+        filtered bottom rate says the peak is past. The thermal mass is
+        corrected after every cycle by how far that peak landed from the target.
+    */
+    class ThermalMassController : public HeaterController {
+        public:
+            const char* get_name() override { return "Thermal mass"; }
+
+            void observe(uint8_t top_temp, uint8_t bottom_temp) override;
+            float step(const HeaterInput &input) override;
+            void reset() override;
+            uint32_t estimate_heating_time(float bottom, float top, float to) override;
+
+            int get_thermal_mass() { return thermal_mass; }
+            void set_thermal_mass(int value) { thermal_mass = value; }
+
+            static const int DEFAULT_THERMAL_MASS = 1500;
+
+            // Q8.8 ºC per minute, above it the bottom is still rising to its peak
+            static const int16_t SETTLING_RATE = 128;
+
+        private:
+            int power_remain = 0;
+            int power_wait_remain = 0;
+
+            uint8_t max_temperature = 0;
+            uint8_t last_max_target = 0;
+            uint8_t last_min_temp = 0;
+            int last_power_time = 0;
+
+            bool just_reset = true;
+
+            /* Estimate of milliseconds of the heater on needed to rise 1ºC bottom_temperature */
+            int thermal_mass = DEFAULT_THERMAL_MASS;
+    };
+
+}
+}
@@ -1,221 +1,256 @@
 #include "mcu_communicator.h"
+#include "send_frame.h"
+#include "profiler.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace esphome {
 namespace ricecooker {
 
 static const char *const TAG = "mcu_communicator";
-static const uint8_t RECV_HEADER = 0xaa;
-static const uint8_t SEND_HEADER = 0x55;
 
-MCUCommunicator::MCUCommunicator(uart::UARTDevice *parent) : Component() {
-    this->uart_device_ = parent;
+MCUCommunicator::MCUCommunicator(MCUTransport *transport) {
+    this->transport = transport;
+
+    send_buffer[0] = SEND_HEADER; // Header
+    send_buffer[1] = SEND_COMMAND_LENGTH; // Command length
 }
 
+// Init sequence frames, CRCs are computed at compile time
+static constexpr SendFrame INIT_BLANK = make_send_frame(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+static constexpr SendFrame INIT_BEEP = make_send_frame(0x10, 0x00, 0x00, 0x00, 0x00, 0x1f, 0x1f);
+static constexpr SendFrame INIT_BEEP_ALL = make_send_frame(0x10, 0xff, 0xff, 0xff, 0xff, 0x1f, 0x1f);
+static constexpr SendFrame INIT_ALL = make_send_frame(0x00, 0xff, 0xff, 0xff, 0xff, 0x1f, 0x1f);
+
+static const MCUCommunicator::InitStep DEFAULT_INIT_STEPS[] = {
+    MCUCommunicator::InitStep::BLANK,
+    MCUCommunicator::InitStep::BEEP,
+    MCUCommunicator::InitStep::BEEP_ALL,
+    MCUCommunicator::InitStep::BEEP,
+    MCUCommunicator::InitStep::BEEP_ALL,
+    MCUCommunicator::InitStep::ALL,
+    MCUCommunicator::InitStep::BLANK,
+};
+
 void MCUCommunicator::setup() {
-    uint8_t reset[][11] = {
-            {0x55,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xc7,0x18}, //Black
-            {0x55,0x07,0x10,0x00,0x00,0x00,0x00,0x1f,0x1f,0x00,0xf0}, //Beep
-            {0x55,0x07,0x10,0xff,0xff,0xff,0xff,0x1f,0x1f,0x8a,0x20}, //Beep
-            {0x55,0x07,0x00,0xff,0xff,0xff,0xff,0x1f,0x1f,0xbd,0x5b}, //All
-            {0x55,0x07,0x00,0xff,0xff,0xff,0xff,0x02,0x18,0xb8,0x93}  //?
-        };
-
-        //register_service(&RiceCooker::send_command, "send_command", {"command"});
-
-        this->uart_device_->write_array(reset[0], 11);
-        vTaskDelay(50);
-        this->uart_device_->write_array(reset[1], 11);
-        vTaskDelay(50);
-        this->uart_device_->write_array(reset[2], 11);
-        vTaskDelay(50);
-        this->uart_device_->write_array(reset[1], 11);
-        vTaskDelay(50);
-        this->uart_device_->write_array(reset[2], 11);
-        vTaskDelay(50);
-        this->uart_device_->write_array(reset[3], 11);
-        vTaskDelay(50);
-        this->uart_device_->write_array(reset[0], 11);
-        vTaskDelay(50);
-}
+    //register_service(&RiceCooker::send_command, "send_command", {"command"});
 
-void MCUCommunicator::loop() {
-    if (millis() > mcu_last + mcu_interval) {
-        mcu_last = millis();
-        send_data();
-        receive_data();
+    if (init_steps.empty()) {
+        init_steps.assign(std::begin(DEFAULT_INIT_STEPS), std::end(DEFAULT_INIT_STEPS));
     }
-}
 
-void MCUCommunicator::send_data() {
-    write_data();
-    if (this->uart_device_ != nullptr) {
-        this->uart_device_->write_array(send_buffer, 11);
-    }
+    // The sequence runs from loop(), so setup() returns right away
+    uint32_t now = millis();
+    init_started = now;
+    init_step = 0;
+    init_step_started = now;
+    init_last = now - init_gap;
+    init_frames_seen = parser.get_valid_frames();
+    ready = false;
 }
 
-void MCUCommunicator::receive_data() {
-    uint8_t ch;
-    uint8_t n = 0;
-
-    if (this->uart_device_ == nullptr) {
-        return;
+void MCUCommunicator::loop() {
+    // Drain the RX FIFO on every loop, responses are parsed as they arrive
+    receive_data();
+
+    // Regular polling is driven by RiceCooker's scheduler
+    if (!ready) {
+        init_loop();
+    } else {
+        check_response(millis());
     }
+}
 
-    while (this->uart_device_->available()) {
-        ch = this->uart_device_->read();
-
-        if (ch == RECV_HEADER || n == 10) {
-            n = 0;
-        }
+void MCUCommunicator::next_init_step(uint32_t now) {
+    init_step++;
+    init_step_started = now;
+    init_frames_seen = parser.get_valid_frames();
+}
 
-        // Extra safety: prevent buffer overflow
-        if (n < 10) {
-            recv_buffer[n] = ch;
-            n++;
-        } else {
-            ESP_LOGD(TAG, "MCU recv buffer full, skipping data");
-            continue;
+void MCUCommunicator::init_loop() {
+    uint32_t now = millis();
+
+    if (init_step < init_steps.size() && init_steps[init_step] == InitStep::WAIT_RESPONSE) {
+        if (parser.get_valid_frames() != init_frames_seen) {
+            ESP_LOGD(TAG, "MCU answered after %u ms", now - init_started);
+            next_init_step(now);
+            // Do not wait a gap after an answer
+            init_last = now - init_gap;
+        } else if (now - init_step_started >= init_timeout) {
+            ESP_LOGW(TAG, "No answer from MCU after %u ms, continuing", now - init_step_started);
+            next_init_step(now);
         }
     }
 
-    // Extra safety: ensure we have enough data for CRC check
-    if (n < 10) {
-        ESP_LOGD(TAG, "Incomplete MCU data packet received");
+    if (now - init_last < init_gap) {
         return;
     }
+    init_last = now;
 
-    // For CRC header is skipped
-    uint16_t crc = crc16(recv_buffer + sizeof(uint8_t), 7); 
-
-    if (recv_buffer[0] != RECV_HEADER || recv_buffer[8] != ((crc >> 8) & 0xFF) || recv_buffer[9] != (crc & 0xFF)) {
-        ESP_LOGD(TAG, "Got an invalid package from MCU");
+    if (init_step >= init_steps.size()) {
+        ready = true;
+        ESP_LOGI(TAG, "MCU init done in %u ms", now - init_started);
         return;
     }
 
-    // Update temperature values from received data
-    top_temperature = recv_buffer[3];
-    bottom_temperature = recv_buffer[4];
-    
-    switch(recv_buffer[2]){
-        case 129:
-            ESP_LOGD(TAG, "TIMER");
+    const SendFrame *frame;
+
+    switch (init_steps[init_step]) {
+        case InitStep::BLANK:
+            frame = &INIT_BLANK;
             break;
-        case 130:
-            ESP_LOGD(TAG, "CANCEL");
+        case InitStep::BEEP:
+            frame = &INIT_BEEP;
             break;
-        case 132:
-            ESP_LOGD(TAG, "SELECT");
+        case InitStep::BEEP_ALL:
+            frame = &INIT_BEEP_ALL;
             break;
-        case 136:
-            ESP_LOGD(TAG, "START");
+        case InitStep::ALL:
+            frame = &INIT_ALL;
             break;
+        case InitStep::WAIT_RESPONSE:
+        default:
+            // Any frame gets an answer, keep polling with the current state
+            send_data();
+            return;
     }
 
+    transmit(frame->data());
+    next_init_step(now);
 }
 
-uint16_t MCUCommunicator::crc16(const uint8_t *data, size_t len) {
-    uint16_t crc = 0x0000;  // Initialize CRC
-
-    while (len--) {
-        crc ^= (*data++) << 8; // XOR data byte with CRC, and shift left to treat as most significant byte
-        for (int i = 0; i < 8; i++) {
-            if (crc & 0x8000) { // Check MOST significant bit
-                crc = (crc << 1) ^ 0x1021; // Left shift and XOR polynomial
-            } else {
-                crc <<= 1; // Left shift
-            }
-        }
+void MCUCommunicator::transmit(const uint8_t *frame) {
+    if (this->transport != nullptr) {
+        this->transport->write(frame, SEND_LENGTH);
     }
-    return crc;
+    frames_sent++;
 }
 
-uint8_t MCUCommunicator::int_7seg(uint8_t value, bool dot) {
-    uint8_t table[] = {
-        0b00111111, // 0
-        0b00000110, // 1
-        0b01011011, // 2
-        0b01001111, // 3
-        0b01100110, // 4
-        0b01101101, // 5
-        0b01111101, // 6
-        0b00000111, // 7
-        0b01111111, // 8
-        0b01101111, // 9
-    };
-
-    uint8_t byte = table[value % 10];
-
-    if (dot) byte |= 0b10000000;
-
-    return byte;
-}
+void MCUCommunicator::send_data() {
+    RICECOOKER_PROFILE(MCU_SEND);
 
-void MCUCommunicator::write_data() {
-    send_buffer[0] = SEND_HEADER; // Header
-    send_buffer[1] = 0x07; // Command length
+    write_data();
+    transmit(send_buffer);
 
-    send_buffer[2] = 0b00000000;
+    // The init handshake waits on its own, only regular polls are tracked
+    if (!ready) {
+        return;
+    }
 
-    send_buffer[2] |= 0b00000001; // Some kind of general ON?
-    //buffer[2] |= 0b00010000; // Beep
-    //buffer[2] |= 0b00000100; // RL
+    if (awaiting) {
+        // Polled faster than the timeout, the last one never got its answer
+        timeouts++;
+    }
+    awaiting = true;
+    retransmitted = 0;
+    request_sent = millis();
+}
 
-    if (power) {
-        send_buffer[2] |= 0b00000100;
+void MCUCommunicator::check_response(uint32_t now) {
+    if (!awaiting || now - request_sent < response_timeout) {
+        return;
     }
 
-    if (sleep) {
-        send_buffer[2] |= 0b00100000; // Sleep
+    timeouts++;
+
+    if (retransmitted >= MAX_RETRANSMITS) {
+        ESP_LOGV(TAG, "No answer from MCU, giving up until the next poll");
+        awaiting = false;
+        return;
     }
 
-    send_buffer[3] = int_7seg(hours / 10, false);
-    send_buffer[4] = int_7seg(hours % 10, true);
-    send_buffer[5] = int_7seg(minutes / 10, true);
-    send_buffer[6] = int_7seg(minutes % 10, false);
+    // Lost or garbled on the way, either way the MCU needs a whole frame again.
+    // Rebuilt in case a register changed since.
+    RICECOOKER_PROFILE(MCU_SEND);
+    write_data();
+    transmit(send_buffer);
 
-    send_buffer[7] = 0b00000000;
+    retransmitted++;
+    retransmits++;
+    request_sent = now;
+}
 
-    // Set LED1-LED5 status in send_buffer[7]
-    if (led1_status) {
-        send_buffer[7] |= 0b00000001; // LED1: bit 0
-    }
-    if (led2_status) {
-        send_buffer[7] |= 0b00000010; // LED2: bit 1
-    }
-    if (led3_status) {
-        send_buffer[7] |= 0b00000100; // LED3: bit 2
-    }
-    if (led4_status) {
-        send_buffer[7] |= 0b00001000; // LED4: bit 3
-    }
-    if (led5_status) {
-        send_buffer[7] |= 0b00010000; // LED5: bit 4
+void MCUCommunicator::get_link_stats(LinkStats &stats) {
+    stats.values[SENT] = frames_sent;
+    stats.values[VALID] = parser.get_valid_frames();
+    stats.values[CRC_ERRORS] = parser.get_crc_errors();
+    stats.values[RESYNCS] = parser.get_resyncs();
+    stats.values[TIMEOUTS] = timeouts;
+    stats.values[RETRANSMITS] = retransmits;
+    stats.values[LATENCY] = (uint32_t) (latency + 0.5f);
+    stats.values[MAX_LATENCY] = max_latency;
+}
+
+void MCUCommunicator::receive_data() {
+    RICECOOKER_PROFILE(MCU_RECEIVE);
+
+    uint8_t chunk[16];
+
+    if (this->transport == nullptr) {
+        return;
     }
 
-    send_buffer[8] = 0b00000000;
+    uint32_t now = millis();
+
+    while (size_t available = this->transport->available()) {
+        size_t len = std::min(available, sizeof(chunk));
 
-    // Set LED6-LED9 status in send_buffer[8]
-    if (led6_status) {
-        send_buffer[8] |= 0b00000001; // LED6: bit 0
+        if (!this->transport->read(chunk, len)) {
+            break;
+        }
+
+        for (size_t i = 0; i < len; i++) {
+            if (parser.feed(chunk[i])) {
+                handle_frame(parser.frame(), now);
+            }
+        }
     }
-    if (led7_status) {
-        send_buffer[8] |= 0b00000010; // LED7: bit 1
+}
+
+void MCUCommunicator::handle_frame(const uint8_t *frame, uint32_t now) {
+    if (awaiting) {
+        awaiting = false;
+
+        // After a retransmit there is no telling which frame was answered
+        if (retransmitted == 0) {
+            uint32_t sample = now - request_sent;
+            latency = latency == 0.0f ? sample : latency + (sample - latency) / LATENCY_SMOOTHING;
+            max_latency = std::max(max_latency, sample);
+        }
     }
-    if (led8_status) {
-        send_buffer[8] |= 0b00000100; // LED8: bit 2
+
+    // Update temperature values from received data
+    top_temperature = frame[3];
+    bottom_temperature = frame[4];
+
+    // 0x80 with one bit per key held: 129 TIMER, 130 CANCEL, 132 SELECT, 136 START
+    uint8_t keys = frame[2] & ButtonDecoder::KEY_MASK;
+    buttons.feed(keys, now);
+
+    if (keys != 0) {
+        key_frames++;
     }
-    if (led9_orange_status) {
-        send_buffer[8] |= 0b00001000; // LED9_ORANGE: bit 3
+}
+
+void MCUCommunicator::write_register(uint8_t index, uint8_t value) {
+    if (registers[index] != value) {
+        registers[index] = value;
+        dirty = true;
     }
-    if (led9_blue_status) {
-        send_buffer[8] |= 0b00010000; // LED9_BLUE: bit 4
+}
+
+void MCUCommunicator::write_data() {
+    if (!dirty) {
+        return;
     }
 
+    memcpy(send_buffer + 2, registers, REGISTER_COUNT);
+    seal_send_frame(send_buffer);
 
-    uint16_t crc = crc16(send_buffer + sizeof(uint8_t), 8);
-    send_buffer[9] = (crc >> 8) & 0xFF;
-    send_buffer[10] = crc & 0xFF;
+    dirty = false;
 }
 
 void MCUCommunicator::set_temperature(uint8_t top_temp, uint8_t bottom_temp) {
@@ -223,17 +258,18 @@ void MCUCommunicator::set_temperature(uint8_t top_temp, uint8_t bottom_temp) {
     this->bottom_temperature = bottom_temp;
 }
 
-void MCUCommunicator::set_time(uint8_t hours, uint8_t minutes) {
-    this->hours = hours;
-    this->minutes = minutes;
+void MCUCommunicator::set_digits(const uint8_t *digits) {
+    for (uint8_t i = 0; i < 4; i++) {
+        write_register(DIGIT0 + i, digits[i]);
+    }
 }
 
 void MCUCommunicator::set_power(bool power) {
-    this->power = power;
+    write_register(CONTROL, power ? registers[CONTROL] | CONTROL_POWER : registers[CONTROL] & ~CONTROL_POWER);
 }
 
 void MCUCommunicator::set_sleep(bool sleep) {
-    this->sleep = sleep;
+    write_register(CONTROL, sleep ? registers[CONTROL] | CONTROL_SLEEP : registers[CONTROL] & ~CONTROL_SLEEP);
 }
 
 uint8_t MCUCommunicator::get_top_temperature() {
@@ -245,43 +281,25 @@ uint8_t MCUCommunicator::get_bottom_temperature() {
 }
 
 void MCUCommunicator::set_led_status(LED_ID led, LED_STATE state) {
-    bool state_bool = (state == LED_STATE::ON);
-    
-    switch (led) {
-        case LED_ID::LED1:
-            led1_status = state_bool;
-            break;
-        case LED_ID::LED2:
-            led2_status = state_bool;
-            break;
-        case LED_ID::LED3:
-            led3_status = state_bool;
-            break;
-        case LED_ID::LED4:
-            led4_status = state_bool;
-            break;
-        case LED_ID::LED5:
-            led5_status = state_bool;
-            break;
-        case LED_ID::LED6:
-            led6_status = state_bool;
-            break;
-        case LED_ID::LED7:
-            led7_status = state_bool;
-            break;
-        case LED_ID::LED8:
-            led8_status = state_bool;
-            break;
-        case LED_ID::LED9_ORANGE:
-            led9_orange_status = state_bool;
-            break;
-        case LED_ID::LED9_BLUE:
-            led9_blue_status = state_bool;
-            break;
-        default:
-            break;
+    set_leds(led_mask(led), state);
+}
+
+void MCUCommunicator::set_leds(uint16_t mask, LED_STATE state) {
+    if (state == LED_STATE::ON) {
+        update_leds(mask, 0);
+    } else {
+        update_leds(0, mask);
     }
 }
 
+void MCUCommunicator::update_leds(uint16_t on, uint16_t off) {
+    // LED1-LED5 are bits 0-4 of LEDS_LOW, LED6-LED9_BLUE bits 0-4 of LEDS_HIGH
+    uint16_t leds = registers[LEDS_LOW] | (registers[LEDS_HIGH] << 5);
+    leds = (leds & ~off) | on;
+
+    write_register(LEDS_LOW, leds & 0x1f);
+    write_register(LEDS_HIGH, (leds >> 5) & 0x1f);
+}
+
 } // namespace ricecooker
 } // namespace esphome
\ No newline at end of file
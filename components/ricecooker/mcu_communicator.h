@@ -1,13 +1,23 @@
 #pragma once
 
-#include "esphome/core/component.h"
 #include "esphome/core/datatypes.h"
-#include "esphome/components/uart/uart.h"
+
+#include <vector>
+
+#include "buttons.h"
+#include "frame_parser.h"
+#include "mcu_transport.h"
+#include "send_frame.h"
 
 namespace esphome {
 namespace ricecooker {
 
-class MCUCommunicator : public Component {
+/*
+    The MCU link: init handshake, polls, status frames and the shadow of
+    the display registers. Talks through an MCUTransport, so the same code
+    runs against the UART and against captures on the host.
+*/
+class MCUCommunicator {
 public:
     enum class LED_ID {
         LED1 = 1,
@@ -27,59 +37,161 @@ public:
         ON = 1
     };
 
-    MCUCommunicator(uart::UARTDevice *parent = nullptr);
+    /*
+        Steps of the init handshake. Frame steps send a fixed frame,
+        WAIT_RESPONSE polls until the MCU answers (or the timeout expires).
+    */
+    enum class InitStep : uint8_t {
+        BLANK,
+        BEEP,
+        BEEP_ALL,
+        ALL,
+        WAIT_RESPONSE
+    };
+
+    MCUCommunicator(MCUTransport *transport = nullptr);
 
     void setup();
     void loop();
 
+    void add_init_step(InitStep step) { init_steps.push_back(step); }
+    void set_init_gap(uint32_t gap) { init_gap = gap; }
+    void set_init_timeout(uint32_t timeout) { init_timeout = timeout; }
+
+    /* True once the init sequence has finished and regular polling runs. */
+    bool is_ready() { return ready; }
+
+    /*
+        How long a poll waits for its answer. An unanswered poll is sent
+        again once, then given up until the next one.
+    */
+    void set_response_timeout(uint32_t timeout) { response_timeout = timeout; }
+
+    /* From a poll until its answer, or until it is given up. */
+    bool is_awaiting_response() { return awaiting; }
+
+    /* Link quality, counters since boot. */
+    enum LinkStat : uint8_t {
+        SENT = 0,       // frames written, init and retransmits included
+        VALID,          // frames received with a good CRC
+        CRC_ERRORS,
+        RESYNCS,
+        TIMEOUTS,       // polls and retransmits left without an answer
+        RETRANSMITS,
+        LATENCY,        // poll to answer, ms, smoothed
+        MAX_LATENCY,    // worst since reset_max_latency(), ms
+        LINK_STAT_COUNT
+    };
+
+    struct LinkStats {
+        uint32_t values[LINK_STAT_COUNT];
+    };
+
+    void get_link_stats(LinkStats &stats);
+    void reset_max_latency() { max_latency = 0; }
+
     void send_data();
     void receive_data();
 
     void set_temperature(uint8_t top_temp, uint8_t bottom_temp);
-    void set_time(uint8_t hours, uint8_t minutes);
+    /* Segments of the four display digits, see display.h. */
+    void set_digits(const uint8_t *digits);
     void set_power(bool power);
     void set_sleep(bool sleep);
     void set_led_status(LED_ID led, LED_STATE state);
 
+    /* Bit of `led` in an LED mask, LED1 is bit 0. */
+    static constexpr uint16_t led_mask(LED_ID led) { return 1 << ((int) led - 1); }
+
+    /* Sets every LED in `mask` to `state`. */
+    void set_leds(uint16_t mask, LED_STATE state);
+
+    /* Turns on the LEDs in `on` and off the ones in `off`, in the same frame. */
+    void update_leds(uint16_t on, uint16_t off);
+
     uint8_t get_top_temperature();
     uint8_t get_bottom_temperature();
 
+    /* Valid frames received so far, changes when new temperatures arrive. */
+    uint32_t get_frame_count() { return parser.get_valid_frames(); }
+
+    /* Received frames that carried a key press. */
+    uint32_t get_key_frames() { return key_frames; }
+
+    /* Next panel key event, false when there is none. */
+    bool pop_button_event(ButtonEvent &event) { return buttons.pop(event); }
+
 private:
-    uint16_t crc16(const uint8_t *data, size_t len);
-    uint8_t int_7seg(uint8_t value, bool dot);
+    void handle_frame(const uint8_t *frame, uint32_t now);
+    void check_response(uint32_t now);
+    void transmit(const uint8_t *frame);
+    void init_loop();
+    void next_init_step(uint32_t now);
     void write_data();
+    void write_register(uint8_t index, uint8_t value);
+
+    // TX frame bytes 2..8
+    enum Register : uint8_t {
+        CONTROL = 0,
+        DIGIT0,
+        DIGIT1,
+        DIGIT2,
+        DIGIT3,
+        LEDS_LOW,   // LED1-LED5
+        LEDS_HIGH,  // LED6-LED9
+        REGISTER_COUNT
+    };
+
+    static const uint8_t CONTROL_ON = 0b00000001;     // Some kind of general ON?
+    static const uint8_t CONTROL_POWER = 0b00000100;
+    static const uint8_t CONTROL_BEEP = 0b00010000;
+    static const uint8_t CONTROL_SLEEP = 0b00100000;
 
     // UART communication buffers
-    uint8_t send_buffer[11];
-    uint8_t recv_buffer[10];
+    uint8_t send_buffer[SEND_LENGTH];
+    FrameParser parser;
+    ButtonDecoder buttons;
+
+    // Init sequence, driven from loop()
+    std::vector<InitStep> init_steps;
+    uint32_t init_gap = 50;
+    uint32_t init_timeout = 2000;
+    size_t init_step = 0;
+    uint32_t init_started = 0;
+    uint32_t init_step_started = 0;
+    uint32_t init_last = 0;
+    uint32_t init_frames_seen = 0;
+    bool ready = false;
 
-    // Communication parameters
-    int mcu_interval = 100;
-    int mcu_last = 0;
-    
-    // UART device reference
-    uart::UARTDevice *uart_device_;
+    // Regular polls, see check_response()
+    uint32_t response_timeout = 40;
+    static const uint8_t MAX_RETRANSMITS = 1;
+    bool awaiting = false;
+    uint8_t retransmitted = 0;
+    uint32_t request_sent = 0;
+
+    // Link statistics, the parser counts the receive side
+    uint32_t frames_sent = 0;
+    uint32_t timeouts = 0;
+    uint32_t retransmits = 0;
+    float latency = 0.0f;
+    uint32_t max_latency = 0;
+    // Answers it takes for the smoothed latency to follow a change, roughly
+    static constexpr float LATENCY_SMOOTHING = 8.0f;
+
+    MCUTransport *transport;
 
     // State
     uint8_t top_temperature = 0;
     uint8_t bottom_temperature = 0;
-    uint8_t hours = 0;
-    uint8_t minutes = 0;
-    bool power = false;
-    bool sleep = false;
-    bool middle_dots = true;
-
-    // LED status tracking
-    bool led1_status = false;
-    bool led2_status = false;
-    bool led3_status = false;
-    bool led4_status = false;
-    bool led5_status = false;
-    bool led6_status = false;
-    bool led7_status = false;
-    bool led8_status = false;
-    bool led9_orange_status = false;
-    bool led9_blue_status = false;
+    uint32_t key_frames = 0;
+
+    /*
+        Shadow of the TX frame payload. Setters flip bits here and mark the
+        frame dirty, send_buffer and its CRC are only rebuilt after a change.
+    */
+    uint8_t registers[REGISTER_COUNT] = {CONTROL_ON};
+    bool dirty = true;
 };
 
 } // namespace ricecooker
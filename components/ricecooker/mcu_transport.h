@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    Byte stream to and from the MCU. The UART on the device (UARTTransport),
+    a capture, a fuzzer or an emulator on the host.
+*/
+class MCUTransport {
+public:
+    virtual ~MCUTransport() = default;
+
+    /* Bytes that can be read without waiting. */
+    virtual size_t available() = 0;
+
+    /* Reads exactly `len` bytes, at most available(). */
+    virtual bool read(uint8_t *data, size_t len) = 0;
+
+    virtual void write(const uint8_t *data, size_t len) = 0;
+};
+
+} // namespace ricecooker
+} // namespace esphome
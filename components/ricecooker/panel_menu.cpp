@@ -0,0 +1,132 @@
+#include "panel_menu.h"
+
+namespace esphome {
+namespace ricecooker {
+
+uint8_t PanelMenu::get_setting() const {
+    switch (entry) {
+        case KEEP_WARM:
+            return keep_warm_temperature;
+        case RICE:
+            return rice_time;
+        case FAST_RICE:
+            return fast_rice_time;
+        default:
+            return 0;
+    }
+}
+
+PanelMenu::Action PanelMenu::handle(const ButtonEvent &event, bool running) {
+    if (event.type == ButtonEvent::SHORT_PRESS) {
+        // Everything happened on the press
+        return NONE;
+    }
+
+    bool held = event.type != ButtonEvent::PRESS;
+    Action action = NONE;
+
+    switch (event.key) {
+        case ButtonEvent::SELECT:
+            if (!running) {
+                // The first press shows where the menu is, the next ones move
+                action = step_entry(held || is_showing(event.time));
+                show(SHOWING_ENTRY, event.time);
+            }
+            break;
+
+        case ButtonEvent::TIMER:
+            if (!running && get_setting() != 0) {
+                action = step_setting(held || (is_showing(event.time) && showing == SHOWING_SETTING));
+                show(SHOWING_SETTING, event.time);
+            }
+            break;
+
+        case ButtonEvent::START:
+            if (event.type == ButtonEvent::PRESS) {
+                showing = SHOWING_NOTHING;
+                action = START;
+            }
+            break;
+
+        case ButtonEvent::CANCEL:
+            if (event.type == ButtonEvent::PRESS) {
+                showing = SHOWING_NOTHING;
+                action = CANCEL;
+            } else if (event.type == ButtonEvent::LONG_PRESS) {
+                action = CLEAR;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return action;
+}
+
+PanelMenu::Action PanelMenu::step_entry(bool advance) {
+    if (advance) {
+        entry = (entry + 1) % entry_count();
+    }
+    return SELECT;
+}
+
+PanelMenu::Action PanelMenu::step_setting(bool advance) {
+    if (!advance) {
+        return NONE;
+    }
+
+    // Round the dial: past the top it starts again from the bottom
+    switch (entry) {
+        case KEEP_WARM:
+            keep_warm_temperature += KEEP_WARM_STEP;
+            if (keep_warm_temperature > KEEP_WARM_MAX) {
+                keep_warm_temperature = KEEP_WARM_MIN;
+            }
+            break;
+        case RICE:
+            rice_time = rice_time >= RICE_TIME_MAX ? RICE_TIME_MIN : rice_time + 1;
+            break;
+        case FAST_RICE:
+            fast_rice_time = fast_rice_time >= RICE_TIME_MAX ? RICE_TIME_MIN : fast_rice_time + 1;
+            break;
+        default:
+            return NONE;
+    }
+    return SELECT;
+}
+
+void PanelMenu::show(Showing what, uint32_t now) {
+    showing = what;
+    shown_at = now;
+}
+
+bool PanelMenu::is_showing(uint32_t now) const {
+    return showing != SHOWING_NOTHING && now - shown_at < SHOW_TIME;
+}
+
+bool PanelMenu::render(uint32_t now, Framebuffer &frame) const {
+    if (!is_showing(now)) {
+        return false;
+    }
+
+    frame.clear();
+    if (showing == SHOWING_ENTRY) {
+        // Numbered from 1, as on the panel LEDs
+        frame.print("P");
+        frame.print_number(entry + 1, 2, 2, false);
+        return true;
+    }
+
+    if (entry == KEEP_WARM) {
+        frame.print_number(keep_warm_temperature, 0, 2, false);
+        frame.print("*C", 2);
+    } else {
+        frame.print_time(get_setting() / 60, get_setting() % 60);
+    }
+    frame.set_blink(Framebuffer::BLINK_ALL);
+    return true;
+}
+
+} // namespace ricecooker
+} // namespace esphome
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+
+#include "buttons.h"
+#include "display.h"
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    The four panel keys, without Home Assistant.
+
+    SELECT steps through the programs and TIMER through the cooking time
+    or keep warm temperature of the selected one; the first press only
+    shows the current choice, holding the key keeps stepping. START starts
+    the selected program, CANCEL stops it and, held, clears the selection.
+    While a program runs only START and CANCEL do anything.
+
+    Everything acts on the press, not the release, so the display answers
+    within a frame. The menu only decides, RiceCooker builds the programs
+    and runs them as it runs Home Assistant's commands.
+*/
+class PanelMenu {
+public:
+    // Built-in programs, the YAML recipes follow
+    enum Entry : uint8_t {
+        KEEP_WARM = 0,
+        RICE,
+        FAST_RICE,
+        FIRST_RECIPE
+    };
+
+    enum Action : uint8_t {
+        NONE,
+        SELECT,     // switch to the selected entry with its setting
+        START,
+        CANCEL,
+        CLEAR,      // no program
+    };
+
+    void set_recipe_count(uint8_t count) { recipe_count = count; }
+
+    /* `running` locks the selection and the settings. */
+    Action handle(const ButtonEvent &event, bool running);
+
+    uint8_t get_entry() const { return entry; }
+
+    /* Cooking minutes for rice, ºC for keep warm, 0 for recipes. */
+    uint8_t get_setting() const;
+
+    /*
+        What the display shows for a while after SELECT or TIMER: the
+        entry number as "P  2", or its setting as h:mm or ºC, blinking
+        while it can be changed. False when the menu is not showing.
+    */
+    bool render(uint32_t now, Framebuffer &frame) const;
+
+private:
+    enum Showing : uint8_t {
+        SHOWING_NOTHING,
+        SHOWING_ENTRY,
+        SHOWING_SETTING,
+    };
+
+    Action step_entry(bool advance);
+    Action step_setting(bool advance);
+    void show(Showing what, uint32_t now);
+    bool is_showing(uint32_t now) const;
+
+    uint8_t entry_count() const { return FIRST_RECIPE + recipe_count; }
+
+    static const uint32_t SHOW_TIME = 5000;
+
+    static const uint8_t RICE_TIME_MIN = 10;
+    static const uint8_t RICE_TIME_MAX = 30;
+    static const uint8_t KEEP_WARM_MIN = 50;
+    static const uint8_t KEEP_WARM_MAX = 90;
+    static const uint8_t KEEP_WARM_STEP = 5;
+
+    uint8_t recipe_count = 0;
+    uint8_t entry = RICE;
+
+    uint8_t keep_warm_temperature = 70;
+    uint8_t rice_time = 15;
+    uint8_t fast_rice_time = 15;
+
+    Showing showing = SHOWING_NOTHING;
+    uint32_t shown_at = 0;
+};
+
+} // namespace ricecooker
+} // namespace esphome
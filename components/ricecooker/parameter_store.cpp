@@ -0,0 +1,114 @@
+#include "parameter_store.h"
+#include "crc16.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+static const char *const TAG = "ricecooker";
+
+namespace esphome {
+namespace ricecooker {
+
+    void ParameterStore::setup() {
+        this->preference = global_preferences->make_preference<Record>(fnv1_hash("ricecooker_heater_parameters"), true);
+    }
+
+    // Field by field, padding bytes are not guaranteed to survive a copy
+    uint16_t ParameterStore::checksum(const Record &record) {
+        const HeaterParameters &p = record.parameters;
+
+        uint16_t crc = crc16((const uint8_t *) &record.version, sizeof(record.version));
+        crc = crc16((const uint8_t *) &p.thermal_mass, sizeof(p.thermal_mass), crc);
+        crc = crc16((const uint8_t *) p.bottom_model, sizeof(p.bottom_model), crc);
+        crc = crc16((const uint8_t *) p.top_model, sizeof(p.top_model), crc);
+        crc = crc16((const uint8_t *) &p.model_samples, sizeof(p.model_samples), crc);
+        return crc;
+    }
+
+    bool ParameterStore::load(HeaterParameters &parameters) {
+        Record record;
+
+        if (!this->preference.load(&record)) {
+            ESP_LOGD(TAG, "No learned heater parameters stored");
+            return false;
+        }
+        if (record.version != VERSION) {
+            ESP_LOGW(TAG, "Learned heater parameters have version %u, expected %u, ignoring", record.version, VERSION);
+            return false;
+        }
+        if (record.crc != checksum(record)) {
+            ESP_LOGW(TAG, "Learned heater parameters are corrupted, ignoring");
+            return false;
+        }
+
+        parameters = record.parameters;
+        stored = record.parameters;
+        has_stored = true;
+        return true;
+    }
+
+    bool ParameterStore::differs(const HeaterParameters &a, const HeaterParameters &b) {
+        if (std::abs(a.thermal_mass - b.thermal_mass) >= 100) {
+            return true;
+        }
+
+        // Enough samples to trust the model is worth a write on its own
+        if ((a.model_samples >= PredictiveController::MIN_SAMPLES) != (b.model_samples >= PredictiveController::MIN_SAMPLES)) {
+            return true;
+        }
+
+        // 5% of the stored value, with a floor for terms that sit close to zero
+        auto moved = [](float x, float y) {
+            return std::fabs(x - y) > 0.05f * std::max(std::fabs(y), 0.01f);
+        };
+        for (uint8_t i = 0; i < 4; i++) {
+            if (moved(a.bottom_model[i], b.bottom_model[i])) {
+                return true;
+            }
+        }
+        for (uint8_t i = 0; i < 3; i++) {
+            if (moved(a.top_model[i], b.top_model[i])) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool ParameterStore::save(const HeaterParameters &parameters, uint32_t now, bool force) {
+        if (!force) {
+            if (has_stored && !differs(parameters, stored)) {
+                return false;
+            }
+            if (saved && now - last_save < min_interval) {
+                return false;
+            }
+        }
+
+        Record record;
+        memset(&record, 0, sizeof(record));
+        record.version = VERSION;
+        record.parameters = parameters;
+        record.crc = checksum(record);
+
+        if (!this->preference.save(&record)) {
+            ESP_LOGW(TAG, "Saving learned heater parameters failed");
+            return false;
+        }
+
+        ESP_LOGD(TAG, "Saved learned heater parameters: thermal mass %d ms/ºC, model %u samples",
+            (int) parameters.thermal_mass, parameters.model_samples);
+
+        stored = parameters;
+        has_stored = true;
+        last_save = now;
+        saved = true;
+        return true;
+    }
+
+}
+}
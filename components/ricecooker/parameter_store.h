@@ -0,0 +1,60 @@
+#pragma once
+
+#include "esphome/core/datatypes.h"
+#include "esphome/core/preferences.h"
+
+#include "heater.h"
+
+namespace esphome {
+namespace ricecooker {
+
+    /*
+        Keeps the learned heater parameters in ESPHome preferences (NVS), so
+        the first cook after a reboot or OTA starts converged.
+
+        Each record carries a layout version and a CRC; a record from another
+        firmware or a torn write is ignored and the defaults are used. Saves
+        are coalesced: a new record is written only when the parameters moved
+        noticeably, and at most once per min interval.
+    */
+    class ParameterStore {
+        public:
+            /* Binds the preference slot, call from setup(). */
+            void setup();
+
+            /* False when there is no valid record. */
+            bool load(HeaterParameters &parameters);
+
+            /*
+                Writes `parameters` if they differ enough from the stored ones
+                and the last write is older than the min interval, or always
+                with `force`. Returns whether a write happened.
+            */
+            bool save(const HeaterParameters &parameters, uint32_t now, bool force = false);
+
+            void set_min_interval(uint32_t interval) { min_interval = interval; }
+
+        private:
+            static const uint16_t VERSION = 1;
+
+            struct Record {
+                uint16_t version;
+                uint16_t crc;
+                HeaterParameters parameters;
+            };
+
+            static uint16_t checksum(const Record &record);
+            static bool differs(const HeaterParameters &a, const HeaterParameters &b);
+
+            ESPPreferenceObject preference;
+
+            HeaterParameters stored {};
+            bool has_stored = false;
+
+            uint32_t min_interval = 30 * 60 * 1000;
+            uint32_t last_save = 0;
+            bool saved = false;
+    };
+
+}
+}
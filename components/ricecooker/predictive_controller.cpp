@@ -0,0 +1,200 @@
+#include "predictive_controller.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace esphome {
+namespace ricecooker {
+
+    void PredictiveController::observe(uint8_t top_temp, uint8_t bottom_temp) {
+        fallback->observe(top_temp, bottom_temp);
+    }
+
+    void PredictiveController::reset() {
+        // The model and the heat left in the element are physical, keep them
+        fallback->reset();
+        fallback_active = true;
+    }
+
+    void PredictiveController::get_model(float (&bottom)[4], float (&top)[3], uint16_t &samples) const {
+        for (uint8_t i = 0; i < 4; i++) {
+            bottom[i] = bottom_model.get(i);
+        }
+        for (uint8_t i = 0; i < 3; i++) {
+            top[i] = top_model.get(i);
+        }
+        samples = std::min(bottom_model.get_samples(), top_model.get_samples());
+    }
+
+    void PredictiveController::set_model(const float (&bottom)[4], const float (&top)[3], uint16_t samples) {
+        // A half learned model is better relearned from scratch
+        if (samples < MIN_SAMPLES) {
+            return;
+        }
+        bottom_model.restore(bottom, samples);
+        top_model.restore(top, samples);
+    }
+
+    void PredictiveController::forget() {
+        bottom_model.reset();
+        top_model.reset();
+        reset();
+    }
+
+    bool PredictiveController::is_trusted() const {
+        return bottom_model.get_samples() >= MIN_SAMPLES
+            && top_model.get_samples() >= MIN_SAMPLES
+            // Heating must warm the bottom and heat must flow from hot to cold
+            && bottom_model.get(0) > 0.01f
+            && bottom_model.get(1) >= 0.0f
+            && top_model.get(0) >= 0.0f;
+    }
+
+    void PredictiveController::sample(const HeaterInput &input) {
+        sample_elapsed += input.lapsed;
+        sample_heat += heat;
+        sample_bottom += input.bottom_fine;
+        sample_top += input.top_fine;
+        sample_count++;
+
+        if (sample_elapsed < SAMPLE_PERIOD) {
+            return;
+        }
+
+        float mean_heat = sample_heat / sample_count;
+        float mean_bottom = (float) sample_bottom / sample_count / 256.0f;
+        float mean_top = (float) sample_top / sample_count / 256.0f;
+
+        // A stalled loop would make one sample cover minutes, drop it
+        if (have_previous && sample_elapsed < 2 * SAMPLE_PERIOD) {
+            float applied = (previous_heat + mean_heat) / 2.0f;
+
+            const float bottom_x[4] = {applied, previous_top - previous_bottom, previous_bottom / 100.0f, 1.0f};
+            bottom_model.update(bottom_x, mean_bottom - previous_bottom);
+
+            // Boiling pins the top, it says nothing about heat flow
+            if (mean_top < BOILING) {
+                const float top_x[3] = {previous_bottom - previous_top, previous_top / 100.0f, 1.0f};
+                top_model.update(top_x, mean_top - previous_top);
+            }
+        }
+
+        have_previous = true;
+        previous_heat = mean_heat;
+        previous_bottom = mean_bottom;
+        previous_top = mean_top;
+
+        sample_elapsed = 0;
+        sample_heat = 0.0f;
+        sample_bottom = 0;
+        sample_top = 0;
+        sample_count = 0;
+    }
+
+    float PredictiveController::predict_peak(float bottom, float top) const {
+        float decay = expf(-(float) SAMPLE_PERIOD / element_lag);
+        float h = heat;
+        float peak = bottom;
+
+        for (uint8_t i = 0; i < HORIZON; i++) {
+            float next_heat = h * decay;
+
+            const float bottom_x[4] = {(h + next_heat) / 2.0f, top - bottom, bottom / 100.0f, 1.0f};
+            const float top_x[3] = {bottom - top, top / 100.0f, 1.0f};
+            float bottom_rise = bottom_model.predict(bottom_x);
+            float top_rise = top_model.predict(top_x);
+
+            bottom += bottom_rise;
+            top = std::min(top + top_rise, 100.0f);
+            h = next_heat;
+
+            if (bottom > peak) {
+                peak = bottom;
+            } else if (bottom_rise < 0.0f && h < 0.05f) {
+                break;
+            }
+        }
+
+        return peak;
+    }
+
+    uint32_t PredictiveController::estimate_heating_time(float bottom, float top, float to) {
+        if (!is_trusted()) {
+            return fallback->estimate_heating_time(bottom, top, to);
+        }
+
+        // As predict_peak, with the relay closed: the element warms up through
+        // its lag and the top draws heat as the bottom runs ahead of it
+        float decay = expf(-(float) SAMPLE_PERIOD / element_lag);
+        float h = heat;
+
+        for (uint16_t i = 0; i < HEATING_HORIZON; i++) {
+            if (bottom >= to) {
+                return (uint32_t) i * SAMPLE_PERIOD / 1000;
+            }
+
+            float next_heat = 1.0f - (1.0f - h) * decay;
+
+            const float bottom_x[4] = {(h + next_heat) / 2.0f, top - bottom, bottom / 100.0f, 1.0f};
+            const float top_x[3] = {bottom - top, top / 100.0f, 1.0f};
+            bottom += bottom_model.predict(bottom_x);
+            top = std::min(top + top_model.predict(top_x), 100.0f);
+            h = next_heat;
+        }
+
+        // Out of reach for the model, the program timeouts decide
+        return (uint32_t) HEATING_HORIZON * SAMPLE_PERIOD / 1000;
+    }
+
+    float PredictiveController::hold_duty(float aim, float top) const {
+        // Duty that keeps the bottom still at `aim`, from bottom' - bottom = 0
+        const float x[4] = {0.0f, top - aim, aim / 100.0f, 1.0f};
+        return -bottom_model.predict(x) / bottom_model.get(0);
+    }
+
+    float PredictiveController::step(const HeaterInput &input) {
+
+        uint32_t lapsed = std::min<uint32_t>(input.lapsed, 10 * SAMPLE_PERIOD);
+
+        heat += ((input.power ? 1.0f : 0.0f) - heat) * (1.0f - expf(-(float) lapsed / element_lag));
+
+        sample(input);
+
+        if (!is_trusted()) {
+            // Start the fallback from a clean cycle, not from where it was
+            // left when the model took over
+            if (!fallback_active) {
+                fallback->reset();
+                fallback_active = true;
+            }
+            return fallback->step(input);
+        }
+        fallback_active = false;
+
+        if (input.bottom_temperature >= input.max_target) {
+            return 0.0f;
+        }
+
+        float aim = (input.min_target + input.max_target) / 2.0f;
+        float bottom = input.bottom_fine / 256.0f;
+        float top = input.top_fine / 256.0f;
+        float peak = predict_peak(bottom, top);
+
+        float duty;
+        if (peak >= aim) {
+            // The heat already stored gets there
+            duty = 0.0f;
+        } else if (bottom < input.min_target && peak < input.min_target) {
+            duty = 1.0f;
+        } else {
+            duty = std::clamp(hold_duty(aim, top) + HOLD_GAIN * (aim - peak), 0.0f, 1.0f);
+        }
+
+        trace(TraceEvent::HEATER_PREDICT, lroundf(peak * 10), lroundf(aim * 10), lroundf(bottom_model.get(0) * 1000), lroundf(duty * 1000));
+
+        return duty;
+    }
+
+}
+}
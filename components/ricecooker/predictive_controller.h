@@ -0,0 +1,185 @@
+#pragma once
+
+#include "esphome/core/datatypes.h"
+
+#include <cstdint>
+
+#include "heater_controller.h"
+
+namespace esphome {
+namespace ricecooker {
+
+    /*
+        Recursive least squares with exponential forgetting, fits
+        y = theta · x one sample at a time.
+    */
+    template<uint8_t N>
+    class RecursiveLeastSquares {
+        public:
+            RecursiveLeastSquares() { reset(); }
+
+            void reset() {
+                for (uint8_t i = 0; i < N; i++) {
+                    theta[i] = 0.0f;
+                    for (uint8_t j = 0; j < N; j++) {
+                        covariance[i][j] = i == j ? INITIAL_COVARIANCE : 0.0f;
+                    }
+                }
+                samples = 0;
+            }
+
+            void update(const float (&x)[N], float y) {
+                float px[N];
+                float denominator = forgetting;
+                for (uint8_t i = 0; i < N; i++) {
+                    px[i] = 0.0f;
+                    for (uint8_t j = 0; j < N; j++) {
+                        px[i] += covariance[i][j] * x[j];
+                    }
+                    denominator += x[i] * px[i];
+                }
+
+                float error = y - predict(x);
+                float trace = 0.0f;
+                for (uint8_t i = 0; i < N; i++) {
+                    theta[i] += px[i] / denominator * error;
+                    for (uint8_t j = 0; j < N; j++) {
+                        covariance[i][j] -= px[i] * px[j] / denominator;
+                    }
+                    trace += covariance[i][i];
+                }
+
+                // Without excitation (long holds) forgetting would blow the
+                // covariance up, stop inflating once it is back at the start.
+                if (trace < N * INITIAL_COVARIANCE) {
+                    for (uint8_t i = 0; i < N; i++) {
+                        for (uint8_t j = 0; j < N; j++) {
+                            covariance[i][j] /= forgetting;
+                        }
+                    }
+                }
+
+                if (samples < UINT16_MAX) {
+                    samples++;
+                }
+            }
+
+            float predict(const float (&x)[N]) const {
+                float y = 0.0f;
+                for (uint8_t i = 0; i < N; i++) {
+                    y += theta[i] * x[i];
+                }
+                return y;
+            }
+
+            float get(uint8_t i) const { return theta[i]; }
+            uint16_t get_samples() const { return samples; }
+
+            /*
+                Restores a saved fit. The covariance starts small: the values are
+                trusted but still follow the pot if it changed.
+            */
+            void restore(const float (&values)[N], uint16_t restored_samples) {
+                reset();
+                for (uint8_t i = 0; i < N; i++) {
+                    theta[i] = values[i];
+                    covariance[i][i] = RESTORED_COVARIANCE;
+                }
+                samples = restored_samples;
+            }
+
+        private:
+            static constexpr float INITIAL_COVARIANCE = 100.0f;
+            static constexpr float RESTORED_COVARIANCE = 1.0f;
+
+            float forgetting = 0.995f;
+            float theta[N];
+            float covariance[N][N];
+            uint16_t samples;
+    };
+
+    /*
+        Model predictive control on a two-node thermal model identified online.
+
+        Every sample period the controller fits, by recursive least squares:
+
+            bottom' - bottom = a·heat + b·(top - bottom) + c·bottom + d
+            top' - top       = e·(bottom - top) + f·top + g
+
+        where `heat` is the relay state through the element lag. Each step it
+        simulates switching off now: if the predicted peak of the bottom
+        reaches the middle of the target band the heat already stored is
+        enough and duty is 0. Below the band, with no stored heat lifting it
+        back, duty is 1. In between it is the duty the model says holds the
+        middle of the band, corrected by how far the peak falls short.
+
+        Until the model has seen enough samples, or if it stops making physical
+        sense, the fallback controller decides.
+    */
+    class PredictiveController : public HeaterController {
+        public:
+            explicit PredictiveController(HeaterController *fallback) : fallback(fallback) {}
+
+            /* Samples the model needs before it drives the relay. */
+            static constexpr uint16_t MIN_SAMPLES = 60;
+
+            const char* get_name() override { return "Predictive"; }
+
+            void observe(uint8_t top_temp, uint8_t bottom_temp) override;
+            float step(const HeaterInput &input) override;
+            void reset() override;
+            uint32_t estimate_heating_time(float bottom, float top, float to) override;
+
+            /* Time constant of the lag between the relay and the pot, in ms. */
+            void set_element_lag(uint32_t lag) { element_lag = lag; }
+
+            /* Identified model for persistence, see HeaterParameters. */
+            void get_model(float (&bottom)[4], float (&top)[3], uint16_t &samples) const;
+            void set_model(const float (&bottom)[4], const float (&top)[3], uint16_t samples);
+
+            /* Drops the identified model, the fallback drives until it is learned again. */
+            void forget();
+
+            /* Whether the identified model is driving the relay. */
+            bool is_trusted() const;
+
+            /* Bottom temperature peak, in ºC, if the relay opens now. */
+            float predict_peak(float bottom, float top) const;
+
+        private:
+            static constexpr uint32_t SAMPLE_PERIOD = 5000;     // ms
+            static constexpr uint8_t HORIZON = 120;             // samples, 10 min
+            static constexpr uint16_t HEATING_HORIZON = 720;    // samples, 1 h
+            static constexpr float BOILING = 99.0f;
+            static constexpr float HOLD_GAIN = 0.1f;            // duty per ºC short
+
+            HeaterController *fallback;
+
+            RecursiveLeastSquares<4> bottom_model;
+            RecursiveLeastSquares<3> top_model;
+
+            uint32_t element_lag = 20000;
+
+            // Relay state through the element lag, 0..1
+            float heat = 0.0f;
+
+            // Running averages over the current sample
+            uint32_t sample_elapsed = 0;
+            float sample_heat = 0.0f;
+            uint32_t sample_bottom = 0;   // Q8.8
+            uint32_t sample_top = 0;      // Q8.8
+            uint16_t sample_count = 0;
+
+            bool have_previous = false;
+            float previous_heat = 0.0f;
+            float previous_bottom = 0.0f;
+            float previous_top = 0.0f;
+
+            bool fallback_active = true;
+
+            void sample(const HeaterInput &input);
+            float hold_duty(float aim, float top) const;
+    };
+
+}
+}
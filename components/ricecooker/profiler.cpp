@@ -0,0 +1,130 @@
+#include "profiler.h"
+
+#ifdef USE_RICECOOKER_PROFILER
+
+#include <algorithm>
+
+#ifdef USE_ESP32
+#include "esp_idf_version.h"
+#include "sdkconfig.h"
+#if ESP_IDF_VERSION_MAJOR >= 5
+#include "esp_cpu.h"
+#else
+#include "soc/cpu.h"
+#endif
+#else
+#include "esphome/core/hal.h"
+#endif
+
+namespace esphome {
+namespace ricecooker {
+
+Profiler global_profiler;
+
+#ifdef USE_ESP32
+// IDF 4, Arduino included, has the older names
+#if ESP_IDF_VERSION_MAJOR >= 5
+static const uint32_t CYCLES_PER_US = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+
+uint32_t Profiler::now_cycles() {
+    return esp_cpu_get_cycle_count();
+}
+#else
+static const uint32_t CYCLES_PER_US = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+
+uint32_t Profiler::now_cycles() {
+    return esp_cpu_get_ccount();
+}
+#endif
+#else
+static const uint32_t CYCLES_PER_US = 1;
+
+uint32_t Profiler::now_cycles() {
+    return micros();
+}
+#endif
+
+void Profiler::record(Section section, uint32_t cycles) {
+    Stats &s = stats[section];
+    uint32_t us = cycles / CYCLES_PER_US;
+
+    if (s.count == 0 || us < s.min) {
+        s.min = us;
+    }
+    s.max = std::max(s.max, us);
+    s.sum += us;
+    s.count++;
+
+    if (us > budgets[section]) {
+        s.overruns++;
+    }
+
+    uint8_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    bucket = std::min<uint8_t>(bucket, BUCKETS - 1);
+    if (s.histogram[bucket] < UINT16_MAX) {
+        s.histogram[bucket]++;
+    }
+}
+
+uint32_t Profiler::percentile(Section section, uint8_t percent) const {
+    const Stats &s = stats[section];
+    uint32_t wanted = ((uint64_t) s.count * percent + 99) / 100;
+    uint32_t seen = 0;
+
+    for (uint8_t bucket = 0; bucket < BUCKETS; bucket++) {
+        seen += s.histogram[bucket];
+        if (seen >= wanted) {
+            // Upper edge of the bucket, never above what was measured
+            uint32_t edge = bucket == 0 ? 0 : (1u << bucket) - 1;
+            return std::min(edge, s.max);
+        }
+    }
+    return s.max;
+}
+
+float Profiler::get(Section section, Stat stat) const {
+    const Stats &s = stats[section];
+
+    switch (stat) {
+        case MIN:
+            return s.min;
+        case AVG:
+            return s.count == 0 ? 0.0f : (float) s.sum / s.count;
+        case MAX:
+            return s.max;
+        case P99:
+            return s.count == 0 ? 0 : percentile(section, 99);
+        case OVERRUNS:
+            return s.overruns;
+        default:
+            return 0;
+    }
+}
+
+void Profiler::reset(Section section) {
+    stats[section] = Stats {};
+}
+
+void Profiler::harvest(Section section, Report &report) {
+    for (uint8_t stat = 0; stat < STAT_COUNT; stat++) {
+        report.values[section][stat] = get(section, (Stat) stat);
+    }
+    report.counts[section] = get_count(section);
+    reset(section);
+}
+
+const char *Profiler::section_name(Section section) {
+    switch (section) {
+        case LOOP: return "loop";
+        case MCU_SEND: return "mcu_send";
+        case MCU_RECEIVE: return "mcu_receive";
+        case PROGRAM_STEP: return "program_step";
+        case HEATER_STEP: return "heater_step";
+        default: return "";
+    }
+}
+
+} // namespace ricecooker
+} // namespace esphome
+
+#endif
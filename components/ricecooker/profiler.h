@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+
+#include "esphome/core/defines.h"
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    Lightweight hot-path profiler.
+
+    Sections are timed with the CPU cycle counter and accumulated into
+    min/avg/max, a log2 histogram (for the p99) and an overrun counter
+    against a per-section budget. Enabled by configuring any profiler
+    sensor; otherwise RICECOOKER_PROFILE() expands to nothing.
+*/
+class Profiler {
+public:
+    enum Section : uint8_t {
+        LOOP = 0,
+        MCU_SEND,
+        MCU_RECEIVE,
+        PROGRAM_STEP,
+        HEATER_STEP,
+        SECTION_COUNT
+    };
+
+    enum Stat : uint8_t {
+        MIN = 0,
+        AVG,
+        MAX,
+        P99,
+        OVERRUNS,
+        STAT_COUNT
+    };
+
+    static uint32_t now_cycles();
+
+    void record(Section section, uint32_t cycles);
+
+    /* Value of `stat` in µs (count for OVERRUNS) since the last reset(). */
+    float get(Section section, Stat stat) const;
+
+    uint32_t get_count(Section section) const { return stats[section].count; }
+
+    /* Executions longer than `budget` µs count as overruns. */
+    void set_budget(Section section, uint32_t budget) { budgets[section] = budget; }
+
+    void reset(Section section);
+
+    /* Stats as published, for handing them to another task. */
+    struct Report {
+        float values[SECTION_COUNT][STAT_COUNT];
+        uint32_t counts[SECTION_COUNT];
+    };
+
+    /*
+        Copies the stats of `section` into `report` and resets them. Only
+        the task that records a section may harvest it.
+    */
+    void harvest(Section section, Report &report);
+
+    static const char *section_name(Section section);
+
+private:
+    // Bucket b holds durations in [2^(b-1), 2^b) µs, bucket 0 is < 1 µs
+    static const uint8_t BUCKETS = 24;
+
+    struct Stats {
+        uint32_t count;
+        uint32_t min;
+        uint32_t max;
+        uint64_t sum;
+        uint32_t overruns;
+        uint16_t histogram[BUCKETS];
+    };
+
+    uint32_t percentile(Section section, uint8_t percent) const;
+
+    Stats stats[SECTION_COUNT] {};
+
+    uint32_t budgets[SECTION_COUNT] = {
+        20000,  // LOOP
+        2000,   // MCU_SEND
+        2000,   // MCU_RECEIVE
+        5000,   // PROGRAM_STEP
+        5000,   // HEATER_STEP
+    };
+};
+
+class ProfileScope {
+public:
+    ProfileScope(Profiler &profiler, Profiler::Section section)
+        : profiler(profiler)
+        , section(section)
+        , start(Profiler::now_cycles())
+    {}
+
+    ~ProfileScope() { profiler.record(section, Profiler::now_cycles() - start); }
+
+private:
+    Profiler &profiler;
+    Profiler::Section section;
+    uint32_t start;
+};
+
+#ifdef USE_RICECOOKER_PROFILER
+extern Profiler global_profiler;
+
+#define RICECOOKER_PROFILE_CONCAT_(a, b) a##b
+#define RICECOOKER_PROFILE_NAME_(line) RICECOOKER_PROFILE_CONCAT_(profile_scope_, line)
+#define RICECOOKER_PROFILE(section) \
+    ::esphome::ricecooker::ProfileScope RICECOOKER_PROFILE_NAME_(__LINE__)( \
+        ::esphome::ricecooker::global_profiler, ::esphome::ricecooker::Profiler::section)
+#else
+#define RICECOOKER_PROFILE(section)
+#endif
+
+} // namespace ricecooker
+} // namespace esphome
@@ -1,8 +1,14 @@
 #include "program.h"
+#include "trace.h"
 
+#include <algorithm>
+
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 #include "esp_log.h"
 
+static const char *const TAG = "ricecooker";
+
 namespace esphome {
 namespace ricecooker {
 
@@ -14,12 +20,11 @@ namespace ricecooker {
         switch (stage) {
 
             case Wait:
-                ESP_LOGD(TAG, "Keep warm waiting. Temperature: top: %dºC, bottom: %dºC", top_temp, bottom_temp);
+                trace(TraceEvent::KEEPWARM_STEP, stage, top_temp, bottom_temp, 0);
                 break;
 
             case Warm:
-                ESP_LOGD(TAG, "Keep Warm. Temperatures: top: %dºC, bottom: %dºC, target: %dºC, hysteresis: %dºC",
-                    top_temp, bottom_temp, target_temp, hysteresis);
+                trace(TraceEvent::KEEPWARM_STEP, stage, top_temp, bottom_temp, target_temp);
 
                 heater->power_modulate(target_temp, hysteresis);
 
@@ -32,10 +37,18 @@ namespace ricecooker {
         , hysteresis(hysteresis)
     {}
 
-    char* KeepWarm::get_name() {
+    const char* KeepWarm::get_name() {
         return keepwarm_name;
     }
 
+    const char* KeepWarm::get_stage_name() {
+        switch (stage) {
+            case Wait: return "Wait";
+            case Warm: return "Warm";
+        }
+        return "";
+    }
+
     void KeepWarm::start() {
         this->stage = Warm;
     }
@@ -44,6 +57,26 @@ namespace ricecooker {
         this->stage = Wait;
     }
 
+    bool KeepWarm::checkpoint(ProgramCheckpoint &checkpoint) {
+        if (stage == Wait) {
+            return false;
+        }
+        checkpoint = {};
+        checkpoint.kind = ProgramCheckpoint::KEEP_WARM;
+        checkpoint.settings[0] = target_temp;
+        checkpoint.settings[1] = hysteresis;
+        checkpoint.stage = stage;
+        return true;
+    }
+
+    bool KeepWarm::resume(const ProgramCheckpoint &checkpoint) {
+        if (checkpoint.kind != ProgramCheckpoint::KEEP_WARM || checkpoint.stage != Warm) {
+            return false;
+        }
+        this->stage = Warm;
+        return true;
+    }
+
     RiceProgram::RiceProgram(uint8_t cooking_time)
         : stage_started(millis())
         , cooking_time(cooking_time)
@@ -68,7 +101,7 @@ namespace ricecooker {
         , fast(fast)
     {}
 
-    char* RiceProgram::get_name() {
+    const char* RiceProgram::get_name() {
 
         if (fast) {
             return fast_rice_name;
@@ -78,51 +111,114 @@ namespace ricecooker {
     }
 
 
+    const char* RiceProgram::get_stage_name() {
+        switch (stage) {
+            case Wait: return "Wait";
+            case Start: return "Start";
+            case Soak: return "Soak";
+            case Heat: return "Heat";
+            case Cook: return "Cook";
+            case Vapor: return "Vapor";
+            case Rest: return "Rest";
+        }
+        return "";
+    }
+
     void RiceProgram::start() {
+        finished = false;
+        error = ProgramError::NONE;
         set_stage(Start);
     }
 
     void RiceProgram::cancel() {
+        finished = false;
         set_stage(Wait);
     }
 
+    bool RiceProgram::checkpoint(ProgramCheckpoint &checkpoint) {
+        if (!is_running()) {
+            return false;
+        }
+        checkpoint = {};
+        checkpoint.kind = ProgramCheckpoint::RICE;
+        checkpoint.settings[0] = cooking_time;
+        checkpoint.settings[1] = cooking_temp;
+        checkpoint.settings[2] = fast;
+        checkpoint.stage = stage;
+        checkpoint.value = vapor_max;
+        checkpoint.elapsed = (millis() - stage_started) / 1000;
+        return true;
+    }
+
+    bool RiceProgram::resume(const ProgramCheckpoint &checkpoint) {
+        if (checkpoint.kind != ProgramCheckpoint::RICE || checkpoint.stage == Wait || checkpoint.stage > Rest) {
+            return false;
+        }
+        this->stage = (Stage) checkpoint.stage;
+        this->stage_started = millis() - checkpoint.elapsed * 1000;
+        this->vapor_max = checkpoint.value;
+        this->error = ProgramError::NONE;
+        this->finished = false;
+        return true;
+    }
+
     static const unsigned int RICE_PROGRAM_SOAK_MINUTES = 45;
     static const unsigned int RICE_PROGRAM_REST_MINUTES = 10;
+    static const unsigned int RICE_PROGRAM_HEAT_TIMEOUT_MINUTES = 30;
 
-    std::optional<unsigned int> RiceProgram::remaining_time() {
+    std::optional<uint32_t> RiceProgram::remaining_time(Heater* heater) {
 
         if (finished)
             return 0;
 
-        unsigned int res = 0;
-        
+        if (stage == Wait)
+            return std::nullopt;
+
+        // Never report 0 while still running, that means finished
+        return std::max<uint32_t>(estimate(stage, (millis() - stage_started) / 1000, heater), 1);
+    }
+
+    std::optional<uint32_t> RiceProgram::planned_time(Heater* heater) {
+        return estimate(Start, 0, heater);
+    }
+
+    uint32_t RiceProgram::estimate(Stage stage, uint32_t elapsed, Heater* heater) {
+
+        auto left = [elapsed](uint32_t duration) { return duration > elapsed ? duration - elapsed : 0; };
+
+        const uint32_t soak = RICE_PROGRAM_SOAK_MINUTES * 60;
+        const uint32_t cook = this->cooking_time / 2 * 60;
+        const uint32_t rest = RICE_PROGRAM_REST_MINUTES * 60;
+
+        uint32_t res = 0;
+
         switch (stage) {
-            Wait:
-                return std::nullopt;
-            Start:
-                // Just a guess
-                // TODO: calculate time needed to step up the temperature
-                res += 2;
-            Soak:
-                if (!fast)
-                    res += RICE_PROGRAM_SOAK_MINUTES;
-            Heat:
+            case Wait:
+            case Start:
+                res += heater->estimate_heating_time(60);
+                [[fallthrough]];
+            case Soak:
                 if (!fast)
-                    res += 2;
+                    res += stage == Soak ? left(soak) : soak;
+                [[fallthrough]];
+            case Heat:
+                if (stage == Heat)
+                    res += std::min(heater->estimate_heating_time(95), left(RICE_PROGRAM_HEAT_TIMEOUT_MINUTES * 60));
                 else
-                    // Guess more time as fast program starts from lower temperature
-                    res += 4;
-            Cook:
-                res += cooking_time / 2;
-            Vapor:
-                res += cooking_time / 2;
-            Rest:
+                    // Soak leaves the pot at 65ºC, the fast program goes on from 60ºC
+                    res += heater->estimate_heating_time(fast ? 60 : 65, 95);
+                [[fallthrough]];
+            case Cook:
+                res += stage == Cook ? left(cook) : cook;
+                [[fallthrough]];
+            case Vapor:
+                res += stage == Vapor ? left(cook) : cook;
+                [[fallthrough]];
+            case Rest:
                 if (!fast)
-                    res += RICE_PROGRAM_REST_MINUTES;
+                    res += stage == Rest ? left(rest) : rest;
         }
 
-        res -= (millis() - stage_started) / 1000 / 60;
-
         return res;
     }
 
@@ -145,8 +241,7 @@ namespace ricecooker {
 
             case Wait:
 
-                ESP_LOGD(TAG, "Rice: Waiting, Temperature: top: %dºC, bottom: %dºC",
-                    top_temp, bottom_temp);
+                trace(TraceEvent::RICE_STEP, stage, top_temp, bottom_temp, 0);
 
                 heater->power_off();
 
@@ -156,8 +251,7 @@ namespace ricecooker {
 
                 target = 60;
 
-                ESP_LOGD(TAG, "Rice: Soaking, Temperature: top: %dºC, bottom: %dºC, target: %dºC",
-                    top_temp, bottom_temp, target);
+                trace(TraceEvent::RICE_STEP, stage, top_temp, bottom_temp, target);
 
                 heater->power_modulate(target, 0);
 
@@ -171,12 +265,11 @@ namespace ricecooker {
 
                 target = 65;
 
-                if (this->fast || now > stage_started + RICE_PROGRAM_SOAK_MINUTES * 60 * 1000) {
+                if (this->fast || now - stage_started > RICE_PROGRAM_SOAK_MINUTES * 60 * 1000) {
                     set_stage(Heat);
                 }
 
-                ESP_LOGD(TAG, "Rice: Soaking, Temperature: top: %dºC, bottom: %dºC, target: %dºC",
-                    top_temp, bottom_temp, target);
+                trace(TraceEvent::RICE_STEP, stage, top_temp, bottom_temp, target);
 
                 heater->power_modulate(target, 5);
 
@@ -186,8 +279,7 @@ namespace ricecooker {
 
                 target = 95;
 
-                ESP_LOGD(TAG, "Rice: Heating, Temperature: top: %dºC, bottom: %dºC, target: %dºC",
-                    top_temp, bottom_temp, target);
+                trace(TraceEvent::RICE_STEP, stage, top_temp, bottom_temp, target);
 
                 heater->power_modulate(target, 2);
 
@@ -195,11 +287,9 @@ namespace ricecooker {
                     set_stage(Cook);
                 }
 
-                if (now > stage_started + 30 * 60 * 1000) {
+                if (now - stage_started > RICE_PROGRAM_HEAT_TIMEOUT_MINUTES * 60 * 1000) {
                     // Heating is taking too long, something must be wrong
-
-                    // TODO: display error
-                    
+                    error = ProgramError::HEAT_TIMEOUT;
                     heater->power_off();
                     finished = true;
                 }
@@ -211,8 +301,7 @@ namespace ricecooker {
                 target = cooking_temp;
                 vapor_max = std::clamp(top_temp, vapor_max, (uint8_t) 100);
 
-                ESP_LOGD(TAG, "Rice: Cooking, Temperature: top: %dºC, bottom: %dºC, target: %dºC",
-                    top_temp, bottom_temp, target);
+                trace(TraceEvent::RICE_STEP, stage, top_temp, bottom_temp, target);
 
                 if (top_temp < vapor_max) {
                     heater->power_on();
@@ -220,7 +309,7 @@ namespace ricecooker {
 
                 heater->power_modulate(target, 1);   
 
-                if (now > stage_started + this->cooking_time / 2 * 60 * 1000) {
+                if (now - stage_started > this->cooking_time / 2 * 60 * 1000) {
                     heater->power_on();
                     set_stage(Vapor);
                 }
@@ -232,12 +321,11 @@ namespace ricecooker {
                 // Temperature curve from `cooking_temp` to 120ºC in `cooking_time / 2` minutes
                 target = cooking_temp + (120-cooking_temp) * (now - this->stage_started) / 1000 / 60 / (this->cooking_time/2) ; 
 
-                ESP_LOGD(TAG, "Rice: Vapor, Temperature: top: %dºC, bottom: %dºC, target: %dºC",
-                    top_temp, bottom_temp, target);
+                trace(TraceEvent::RICE_STEP, stage, top_temp, bottom_temp, target);
 
                 heater->power_modulate(target, 0);
 
-                if (now > stage_started + this->cooking_time / 2 * 60 * 1000) {
+                if (now - stage_started > this->cooking_time / 2 * 60 * 1000) {
                     heater->power_off();
                     set_stage(Rest);
                 }
@@ -248,12 +336,11 @@ namespace ricecooker {
 
                 target = 65;
 
-                ESP_LOGD(TAG, "Rice: Rest, Temperature: top: %dºC, bottom: %dºC, target: %dºC",
-                    top_temp, bottom_temp, target);
+                trace(TraceEvent::RICE_STEP, stage, top_temp, bottom_temp, target);
 
                 heater->power_modulate(target, 4);
 
-                if (this->fast || now > stage_started + RICE_PROGRAM_REST_MINUTES * 60 * 1000) {
+                if (this->fast || now - stage_started > RICE_PROGRAM_REST_MINUTES * 60 * 1000) {
                     finished = true;
                 }
 
@@ -262,5 +349,201 @@ namespace ricecooker {
         }
     }
 
+    RecipeProgram::RecipeProgram(const Recipe *recipe)
+        : recipe(recipe)
+        , stage_started(millis())
+    {}
+
+    const char* RecipeProgram::get_name() {
+        return recipe->name;
+    }
+
+    const char* RecipeProgram::get_stage_name() {
+        if (!running) {
+            return "Wait";
+        }
+        return recipe->stages[stage].name;
+    }
+
+    void RecipeProgram::start() {
+        running = true;
+        finished = false;
+        set_stage(0);
+    }
+
+    void RecipeProgram::cancel() {
+        running = false;
+        finished = false;
+        set_stage(0);
+    }
+
+    bool RecipeProgram::checkpoint(ProgramCheckpoint &checkpoint) {
+        if (!is_running()) {
+            return false;
+        }
+        auto now = millis();
+        checkpoint = {};
+        checkpoint.kind = ProgramCheckpoint::RECIPE;
+        checkpoint.stage = stage;
+        checkpoint.value = plateau_temp;
+        checkpoint.elapsed = (now - stage_started) / 1000;
+        checkpoint.value_elapsed = (now - plateau_started) / 1000;
+        return true;
+    }
+
+    bool RecipeProgram::resume(const ProgramCheckpoint &checkpoint) {
+        // A reflash may have changed the recipe
+        if (checkpoint.kind != ProgramCheckpoint::RECIPE || checkpoint.stage >= recipe->stage_count) {
+            return false;
+        }
+        auto now = millis();
+        this->running = true;
+        this->finished = false;
+        this->stage = checkpoint.stage;
+        this->stage_started = now - checkpoint.elapsed * 1000;
+        this->plateau_temp = checkpoint.value;
+        this->plateau_started = now - checkpoint.value_elapsed * 1000;
+        return true;
+    }
+
+    void RecipeProgram::set_stage(uint8_t stage) {
+        this->stage = stage;
+        this->stage_started = millis();
+        this->plateau_temp = 0;
+        this->plateau_started = this->stage_started;
+    }
+
+    std::optional<uint32_t> RecipeProgram::remaining_time(Heater* heater) {
+
+        if (finished)
+            return 0;
+
+        if (!running)
+            return std::nullopt;
+
+        auto now = millis();
+        uint32_t elapsed = (now - stage_started) / 1000;
+        uint32_t flat = (now - plateau_started) / 1000;
+
+        // Never report 0 while still running, that means finished
+        return std::max<uint32_t>(estimate(stage, elapsed, flat, heater), 1);
+    }
+
+    std::optional<uint32_t> RecipeProgram::planned_time(Heater* heater) {
+        return estimate(0, 0, 0, heater);
+    }
+
+    uint32_t RecipeProgram::estimate(uint8_t first, uint32_t elapsed, uint32_t flat, Heater* heater) {
+
+        // Where the pot is when each stage starts
+        float from = heater->get_bottom_temperature();
+        uint32_t res = 0;
+
+        for (uint8_t i = first; i < recipe->stage_count; i++) {
+            const RecipeStage &s = recipe->stages[i];
+            bool current = i == first;
+
+            uint32_t limit = (uint32_t) s.duration * 60;
+            if (current) {
+                limit = limit > elapsed ? limit - elapsed : 0;
+            }
+
+            uint32_t time = 0;
+            uint8_t end = s.ramp_to != 0 ? s.ramp_to : s.target;
+
+            switch (s.until) {
+
+                case RecipeExit::TIME:
+                    time = limit;
+                    break;
+
+                case RecipeExit::TEMPERATURE:
+                    // The top trails the bottom, the bottom estimate is a lower bound for it
+                    time = heater->estimate_heating_time(from, s.until_value);
+                    if (s.sensor == RecipeSensor::BOTTOM)
+                        end = s.until_value;
+                    if (s.duration > 0)
+                        time = std::min(time, limit);
+                    break;
+
+                case RecipeExit::PLATEAU: {
+                    uint32_t plateau = (uint32_t) s.until_value * 60;
+                    uint32_t on_plateau = current ? flat : 0;
+                    time = heater->estimate_heating_time(from, s.target) + (plateau > on_plateau ? plateau - on_plateau : 0);
+                    if (s.duration > 0)
+                        time = std::min(time, limit);
+                    break;
+                }
+            }
+
+            res += time;
+            from = end;
+        }
+
+        return res;
+    }
+
+    void RecipeProgram::step(Heater* heater) {
+
+        uint8_t bottom_temp = heater->get_bottom_temperature();
+        uint8_t top_temp = heater->get_top_temperature();
+
+        if (!running || finished) {
+            trace(TraceEvent::RECIPE_STEP, -1, top_temp, bottom_temp, 0);
+            heater->power_off();
+            return;
+        }
+
+        auto now = millis();
+        const RecipeStage &s = recipe->stages[stage];
+
+        uint32_t elapsed = now - stage_started;
+        uint32_t duration = (uint32_t) s.duration * 60 * 1000;
+
+        int target = s.target;
+        if (s.ramp_to != 0 && duration > 0) {
+            target += ((int) s.ramp_to - (int) s.target) * (int64_t) std::min(elapsed, duration) / duration;
+        }
+
+        trace(TraceEvent::RECIPE_STEP, stage, top_temp, bottom_temp, target);
+
+        heater->power_modulate(target, s.hysteresis);
+
+        uint8_t temp = s.sensor == RecipeSensor::TOP ? top_temp : bottom_temp;
+        bool done = false;
+
+        switch (s.until) {
+
+            case RecipeExit::TIME:
+                done = elapsed >= duration;
+                break;
+
+            case RecipeExit::TEMPERATURE:
+                done = temp >= s.until_value
+                    || (duration > 0 && elapsed >= duration);
+                break;
+
+            case RecipeExit::PLATEAU:
+                if (temp > plateau_temp) {
+                    plateau_temp = temp;
+                    plateau_started = now;
+                }
+                done = now - plateau_started >= (uint32_t) s.until_value * 60 * 1000
+                    || (duration > 0 && elapsed >= duration);
+                break;
+        }
+
+        if (!done) {
+            return;
+        }
+
+        if (stage + 1 < recipe->stage_count) {
+            set_stage(stage + 1);
+        } else {
+            heater->power_off();
+            finished = true;
+        }
+    }
+
 }
 }
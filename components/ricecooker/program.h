@@ -1,24 +1,57 @@
 #pragma once
 
 #include <optional>
+#include <variant>
 
-#include "ricecooker.h"
 #include "heater.h"
 
 namespace esphome {
 namespace ricecooker {
 
-class RiceCooker;
-
 static char fast_rice_name[] = "Fast Rice";
 static char rice_name[] = "Rice";
 static char keepwarm_name[] = "Keep Warm";
 static char none_name[] = "None";
 
+/* Why a program gave up, shown on the display as E-nn. */
+enum class ProgramError : uint8_t {
+    NONE = 0,
+    HEAT_TIMEOUT = 1,   // the pot did not reach cooking temperature in time
+};
+
+/*
+    Where a running program is, enough to pick it up again after a reset:
+    which program with which settings, the stage, how far into it and what
+    the stage carries. Plain bytes, RiceCooker keeps it in RTC memory and
+    NVS, see CheckpointStore.
+*/
+struct ProgramCheckpoint {
+    enum Kind : uint8_t {
+        NONE = 0,
+        KEEP_WARM,
+        RICE,
+        RECIPE,
+    };
+
+    uint8_t kind;
+    // KeepWarm: target, hysteresis; Rice: time, temperature, fast; Recipe: index
+    uint8_t settings[3];
+    uint8_t stage;
+    uint8_t value;          // Rice: vapor_max; Recipe: plateau_temp
+    uint8_t reserved[2];
+    uint32_t elapsed;       // s into the stage
+    uint32_t value_elapsed; // Recipe: s since plateau_temp was reached
+};
+
 class Program {
     public:
+        virtual ~Program() = default;
+
         virtual void step(Heater* heater) = 0;
-        virtual char* get_name() = 0;
+        virtual const char* get_name() = 0;
+
+        /* Name of the current stage, for logs and diagnostics. */
+        virtual const char* get_stage_name() = 0;
 
         /*
             Starts the program.
@@ -30,23 +63,60 @@ class Program {
 
         virtual void cancel() = 0;
 
+        /* True from start() until the program finishes or is cancelled. */
+        virtual bool is_running() = 0;
+
+        /* Set when the program stopped on a fault, cleared by start(). */
+        virtual ProgramError get_error() { return ProgramError::NONE; }
+
         /*
-            Returns the remaining time to finish the program in minutes.
+            Returns the remaining time to finish the program in seconds,
+            0 once finished.
 
             If the program will never finish, it returns nullopt.
 
-            If the remaining time is not well defined,
-            a best try estimate is returned.
+            Timed stages count what is left of them. Stages that end on a
+            temperature are estimated with the heating rate `heater` learned,
+            from the current temperature for the running stage and from where
+            the previous stage leaves the pot for the rest. The estimate
+            sharpens as stages complete and the heater learns.
+
+            Not free: RiceCooker calls it once per control step and caches it.
+        */
+        virtual std::optional<uint32_t> remaining_time(Heater* /* heater */) { return std::nullopt; }
+
+        /*
+            Seconds the program would take if started now, estimated as
+            remaining_time() is from the current temperature. nullopt if it
+            never finishes. What a finish-by schedule plans the start with.
+        */
+        virtual std::optional<uint32_t> planned_time(Heater* /* heater */) { return std::nullopt; }
+
+        /*
+            Fills `checkpoint` while the program runs, false otherwise. A
+            program that gave up is finished, so there is no error to keep.
+            Recipes leave their index to RiceCooker, which has the list.
         */
-        virtual std::optional<unsigned int> remaining_time() { return std::nullopt; }
+        virtual bool checkpoint(ProgramCheckpoint & /* checkpoint */) { return false; }
+
+        /*
+            Continues from `checkpoint` as if the program had run all along,
+            the stage clock set back by its elapsed time. False when the
+            checkpoint does not fit this program.
+        */
+        virtual bool resume(const ProgramCheckpoint & /* checkpoint */) { return false; }
 };
 
 class KeepWarm : public Program {
     public:
         void step(Heater* heater) override;
-        char* get_name() override;
+        const char* get_name() override;
+        const char* get_stage_name() override;
         void start() override;
         void cancel() override;
+        bool is_running() override { return stage != Wait; }
+        bool checkpoint(ProgramCheckpoint &checkpoint) override;
+        bool resume(const ProgramCheckpoint &checkpoint) override;
 
         KeepWarm(uint8_t target_temp, uint8_t hysteresis);
 
@@ -60,10 +130,16 @@ class KeepWarm : public Program {
 class RiceProgram : public Program {
     public:
         void step(Heater* heater) override;
-        char* get_name() override;
+        const char* get_name() override;
+        const char* get_stage_name() override;
         void start() override;
         void cancel() override;
-        std::optional<unsigned int> remaining_time() override;
+        bool is_running() override { return stage != Wait && !finished; }
+        ProgramError get_error() override { return error; }
+        std::optional<uint32_t> remaining_time(Heater* heater) override;
+        std::optional<uint32_t> planned_time(Heater* heater) override;
+        bool checkpoint(ProgramCheckpoint &checkpoint) override;
+        bool resume(const ProgramCheckpoint &checkpoint) override;
 
         RiceProgram(uint8_t cooking_time);
         RiceProgram(uint8_t cooking_time, uint8_t cooking_temp);
@@ -78,13 +154,90 @@ class RiceProgram : public Program {
 
         // State
         enum Stage { Wait, Start, Soak, Heat, Cook, Vapor, Rest } stage = Wait;
-        int stage_started;
+        uint32_t stage_started;
         bool finished = false;
+        ProgramError error = ProgramError::NONE;
 
         void set_stage(Stage stage);
+        // From `stage`, `elapsed` seconds into it
+        uint32_t estimate(Stage stage, uint32_t elapsed, Heater* heater);
 
         uint8_t vapor_max = 0;
 };
 
+/*
+    Cooking recipes declared in YAML (`recipes:`) and compiled to constant
+    stage tables in flash. A single interpreter, RecipeProgram, runs them.
+*/
+
+enum class RecipeExit : uint8_t {
+    TIME,           // after `duration`
+    TEMPERATURE,    // when the sensor reaches `until_value` ºC
+    PLATEAU,        // when the sensor has not risen for `until_value` minutes
+};
+
+enum class RecipeSensor : uint8_t {
+    BOTTOM,
+    TOP,
+};
+
+struct RecipeStage {
+    const char *name;
+    uint8_t target;         // ºC
+    uint8_t ramp_to;        // ºC reached linearly at the end of `duration`, 0 for a constant target
+    uint8_t hysteresis;     // ºC
+    RecipeExit until;
+    RecipeSensor sensor;    // sensor checked by the exit condition
+    uint8_t until_value;
+    uint16_t duration;      // minutes; a time limit for TEMPERATURE and PLATEAU, 0 for none
+};
+
+struct Recipe {
+    const char *name;
+    const RecipeStage *stages;
+    uint8_t stage_count;
+};
+
+class RecipeProgram : public Program {
+    public:
+        void step(Heater* heater) override;
+        const char* get_name() override;
+        const char* get_stage_name() override;
+        void start() override;
+        void cancel() override;
+        bool is_running() override { return running && !finished; }
+        std::optional<uint32_t> remaining_time(Heater* heater) override;
+        std::optional<uint32_t> planned_time(Heater* heater) override;
+        bool checkpoint(ProgramCheckpoint &checkpoint) override;
+        bool resume(const ProgramCheckpoint &checkpoint) override;
+
+        explicit RecipeProgram(const Recipe *recipe);
+
+        const Recipe *get_recipe() const { return recipe; }
+
+    private:
+        const Recipe *recipe;
+
+        // State
+        bool running = false;
+        bool finished = false;
+        uint8_t stage = 0;
+        uint32_t stage_started;
+
+        // Highest temperature seen in the stage and when it was reached
+        uint8_t plateau_temp = 0;
+        uint32_t plateau_started = 0;
+
+        void set_stage(uint8_t stage);
+        // From stage `first`, `elapsed` seconds into it and `flat` seconds on a plateau
+        uint32_t estimate(uint8_t first, uint32_t elapsed, uint32_t flat, Heater* heater);
+};
+
+/*
+    In-place storage for the active program, sized for the largest one.
+    Switching programs constructs the new one over the old, without heap use.
+*/
+using ProgramStorage = std::variant<std::monostate, KeepWarm, RiceProgram, RecipeProgram>;
+
 }
 }
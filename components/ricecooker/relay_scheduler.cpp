@@ -0,0 +1,129 @@
+#include "relay_scheduler.h"
+#include "trace.h"
+
+#include <algorithm>
+
+namespace esphome {
+namespace ricecooker {
+
+    void RelayScheduler::reset() {
+        // Relay timing and tokens are physical, only the owed on time goes
+        planned = 0;
+        carry = 0.0f;
+    }
+
+    bool RelayScheduler::take_token() {
+        if (cycle_budget == 0) {
+            return true;
+        }
+        if (tokens < 1.0f) {
+            return false;
+        }
+        tokens -= 1.0f;
+        return true;
+    }
+
+    void RelayScheduler::start_window(uint32_t now, float duty, bool relay) {
+        window_start = now;
+
+        float on = duty * window + carry;
+        carry = 0.0f;
+
+        if (on < min_on_time && !relay) {
+            // Too short to be worth a switch, deliver it later
+            carry = on;
+            on = 0.0f;
+        } else if (window - on < min_off_time) {
+            // Too short a pause, stay on and take it back later
+            carry = on - window;
+            on = window;
+        }
+
+        if (on > 0.0f && !relay && (now - switched_at < min_off_time || !take_token())) {
+            carry += on;
+            on = 0.0f;
+        }
+
+        // Only what rounding needs: the controller is closed loop and asks
+        // for more if it is short, a large carry would overshoot
+        carry = std::clamp(carry, -(float) min_off_time, (float) min_on_time);
+        planned = on;
+
+        trace(TraceEvent::RELAY_WINDOW, planned, (int32_t) carry, (int32_t) tokens);
+    }
+
+    bool RelayScheduler::update(uint32_t now, float duty, bool relay) {
+        duty = std::clamp(duty, 0.0f, 1.0f);
+
+        if (!started) {
+            started = true;
+            relay_last = relay;
+            switched_at = now - min_off_time;
+            tokens_updated = now;
+            start_window(now, duty, relay);
+        }
+
+        if (cycle_budget != 0) {
+            tokens = std::min<float>(cycle_budget, tokens + (now - tokens_updated) * (cycle_budget / 3600000.0f));
+        }
+        tokens_updated = now;
+
+        if (relay != relay_last) {
+            if (!relay) {
+                // A program opened the relay, that wins
+                relay_last = false;
+                switched_at = now;
+                planned = 0;
+                carry = 0.0f;
+                return false;
+            }
+
+            // A program closed it since the last update. Nothing reached the
+            // MCU yet, so it only stands if the controller wants heat.
+            if (duty <= 0.0f) {
+                return false;
+            }
+
+            if (cycle_budget != 0) {
+                tokens = std::max(0.0f, tokens - 1.0f);
+            }
+            relay_last = true;
+            switched_at = now;
+            cycles++;
+            window_start = now;
+            planned = duty >= 1.0f ? window : std::max<uint32_t>(duty * window, min_on_time);
+            carry = 0.0f;
+        }
+
+        if (duty <= 0.0f) {
+            planned = 0;
+            carry = 0.0f;
+        } else if (duty >= 1.0f && !relay_last && now - switched_at >= min_off_time && take_token()) {
+            // Full power does not wait for the next window
+            window_start = now;
+            planned = window;
+            carry = 0.0f;
+        }
+
+        if (now - window_start >= window) {
+            start_window(now, duty, relay_last);
+        }
+
+        bool desired = now - window_start < planned;
+
+        if (relay_last && !desired && now - switched_at < min_on_time) {
+            desired = true;
+        }
+
+        if (desired != relay_last) {
+            relay_last = desired;
+            switched_at = now;
+            if (desired) {
+                cycles++;
+            }
+        }
+        return desired;
+    }
+
+}
+}
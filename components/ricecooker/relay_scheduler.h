@@ -0,0 +1,76 @@
+#pragma once
+
+#include "esphome/core/datatypes.h"
+
+#include <cstdint>
+
+namespace esphome {
+namespace ricecooker {
+
+    /*
+        Turns the controller duty fraction into relay switching.
+
+        Time is split in windows; the relay closes at the start of a window
+        for duty × window and stays open for the rest. Pulses shorter than the
+        min on time and pauses shorter than the min off time are not made:
+        the on time they would have delivered is carried to the next windows,
+        so small duties still get their average power. Full duty keeps the
+        relay closed across windows without switching.
+
+        Every closing costs a token from a bucket that refills at the cycle
+        budget per hour. Without tokens windows are skipped until one is
+        back; the controller sees the shortfall and asks for more duty.
+
+        Duty 0 opens the relay as soon as the min on time allows and full
+        duty closes it without waiting for the next window, so bang-bang
+        controllers keep their timing.
+    */
+    class RelayScheduler {
+        public:
+            void set_window(uint32_t window) { this->window = window; }
+            void set_min_on_time(uint32_t time) { min_on_time = time; }
+            void set_min_off_time(uint32_t time) { min_off_time = time; }
+
+            /* Relay closings allowed per hour, 0 for no limit. */
+            void set_cycle_budget(uint16_t budget) { cycle_budget = budget; tokens = budget; }
+
+            /*
+                Relay state for `duty` (0..1) at `now`. `relay` is the current
+                state, programs may have switched it since the last call.
+            */
+            bool update(uint32_t now, float duty, bool relay);
+
+            void reset();
+
+            /*
+                Relay closings that stood, a program closing it only for the
+                controller to open it in the same step does not count.
+            */
+            uint32_t get_cycles() const { return cycles; }
+
+        private:
+            void start_window(uint32_t now, float duty, bool relay);
+            bool take_token();
+
+            uint32_t window = 120000;
+            uint32_t min_on_time = 5000;
+            uint32_t min_off_time = 15000;
+            uint16_t cycle_budget = 30;
+
+            bool started = false;
+            bool relay_last = false;
+            uint32_t switched_at = 0;
+            uint32_t window_start = 0;
+
+            // On time of the current window and owed to the next ones, ms
+            uint32_t planned = 0;
+            float carry = 0.0f;
+
+            uint32_t cycles = 0;
+
+            float tokens = 30.0f;
+            uint32_t tokens_updated = 0;
+    };
+
+}
+}
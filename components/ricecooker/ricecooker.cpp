@@ -2,154 +2,1056 @@
 #include "mcu_communicator.h"
 #include "esphome/core/log.h"
 
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+#include "esphome/components/uart/uart_component_esp_idf.h"
+#include "driver/uart.h"
+#include "esp_idf_version.h"
+#include "esp_sleep.h"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <variant>
+
 namespace esphome {
 namespace ricecooker {
 
-    RiceCooker::RiceCooker() : Component(), UARTDevice() {}
+    RiceCooker::RiceCooker() : Component(), UARTDevice() {
+        mcu_communicator = new MCUCommunicator(&uart_transport);
+    }
 
-    // Control
+    // Commands, from the ESPHome loop
+
+    bool RiceCooker::send(const ControlCommand &command) {
+        if (!commands.push(command)) {
+            ESP_LOGW(TAG, "Control queue full, command %u dropped", command.type);
+            return false;
+        }
+        // Runs it now instead of at the end of the task period
+        if (task_handle != nullptr) {
+            xTaskNotifyGive(task_handle);
+        }
+        return true;
+    }
 
     void RiceCooker::power_on(){
-        heater.power_on();
-        mcu_communicator->set_power(true);
+        send({ControlCommand::POWER_ON});
     }
 
     void RiceCooker::power_off(){
-        heater.power_off();
-        mcu_communicator->set_power(false);
+        send({ControlCommand::POWER_OFF});
+    }
+
+    void RiceCooker::start() {
+        send({ControlCommand::START});
+    }
+
+    void RiceCooker::cancel() {
+        send({ControlCommand::CANCEL});
+    }
+
+    void RiceCooker::finish_in(uint32_t seconds) {
+        if (seconds > MAX_SCHEDULE) {
+            ESP_LOGW(TAG, "Ready in %u min is too far, scheduling for %u min", (unsigned) (seconds / 60), (unsigned) (MAX_SCHEDULE / 60));
+            seconds = MAX_SCHEDULE;
+        }
+        ControlCommand command {ControlCommand::SCHEDULE};
+        command.seconds = seconds;
+        send(command);
+    }
+
+#ifdef USE_RICECOOKER_CLOCK
+    bool RiceCooker::finish_at(uint8_t hour, uint8_t minute) {
+        if (clock_ == nullptr) {
+            return false;
+        }
+        ESPTime now = clock_->now();
+        if (!now.is_valid()) {
+            ESP_LOGW(TAG, "No time yet, cannot schedule for %02u:%02u", hour, minute);
+            return false;
+        }
+
+        // The next time the clock shows it, tomorrow if it is past
+        int32_t seconds = (hour * 60 + minute) * 60 - ((now.hour * 60 + now.minute) * 60 + now.second);
+        if (seconds <= 0) {
+            seconds += 24 * 60 * 60;
+        }
+        finish_in(seconds);
+        return true;
+    }
+#endif
+
+    void RiceCooker::wake() {
+        send({ControlCommand::WAKE});
+    }
+
+    void RiceCooker::clear_program(){
+        send({ControlCommand::SET_PROGRAM});
+    }
+
+    void RiceCooker::set_wifi(bool status){
+        send({ControlCommand::SET_WIFI, status});
     }
 
+    void RiceCooker::dump_trace() {
+        send({ControlCommand::DUMP_TRACE});
+    }
+
+    void RiceCooker::reset_learned() {
+        // Saved from loop() once the control task has done it
+        send({ControlCommand::RESET_LEARNED});
+    }
+
+    // State, from the ESPHome loop
+
     uint8_t RiceCooker::get_top_temperature(){
-        return mcu_communicator->get_top_temperature();
+        return state().top_temperature;
     }
 
     uint8_t RiceCooker::get_bottom_temperature(){
-        return mcu_communicator->get_bottom_temperature();
+        return state().bottom_temperature;
+    }
+
+    bool RiceCooker::is_ready(){
+        return state().ready;
+    }
+
+    bool RiceCooker::is_idle(){
+        return state().idle;
+    }
+
+    bool RiceCooker::is_scheduled(){
+        return state().scheduled;
     }
 
     bool RiceCooker::get_power(){
-        return heater.get_power();
+        return state().power;
     }
 
-    void RiceCooker::set_program(Program* program){
+    std::optional<uint32_t> RiceCooker::get_remaining_time() {
+        return state().remaining_time;
+    }
 
-        if (program == nullptr) {
-            ESP_LOGD(TAG, "Setting Program: null");
-        } else {
-            ESP_LOGD(TAG, "Setting Program: %s", program->get_name());
+    bool RiceCooker::select_recipe(const std::string &name){
+        for (const Recipe *recipe : recipes) {
+            if (name == recipe->name) {
+                emplace_program<RecipeProgram>(recipe);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const char* RiceCooker::get_program_name() {
+        const char *name = state().program_name;
+        return name != nullptr ? name : none_name;
+    }
+
+    void RiceCooker::setup() {
+        // Starts the MCU init sequence, the control task runs it
+        mcu_communicator->setup();
+        current_state = &control_state.read();
+        menu.set_recipe_count(recipes.size());
+
+        top_filter.set_sample_period(mcu_interval);
+        bottom_filter.set_sample_period(mcu_interval);
+
+        // Warm start: the controllers begin with what they learned last time
+        parameter_store.setup();
+        HeaterParameters parameters;
+        if (parameter_store.load(parameters)) {
+            heater.set_parameters(parameters);
+            ESP_LOGI(TAG, "Restored learned heater parameters: thermal mass %d ms/ºC, model %u samples",
+                (int) parameters.thermal_mass, parameters.model_samples);
+        }
+
+        // Picked up once the MCU reports temperatures, see resume_program()
+        checkpoint_store.setup();
+        if (resume_enabled && checkpoint_store.load(resume_checkpoint)
+            && resume_checkpoint.program.kind != ProgramCheckpoint::NONE) {
+            resume_pending = true;
+            ESP_LOGI(TAG, "Program checkpoint found: stage %u, %u s in, bottom %u ºC",
+                resume_checkpoint.program.stage, (unsigned) resume_checkpoint.program.elapsed,
+                resume_checkpoint.bottom_temperature);
+        }
+
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+        setup_light_sleep();
+#endif
+
+        // Control runs shortly after each poll so it sees the fresh answer
+        mcu_task = scheduler.add("mcu", mcu_interval, 0, [this]() {
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+            // The UART stops in light sleep, stay up until the answer is in
+            hold_awake(true);
+#endif
+            // Blinks and page changes go out with the frame
+            render_display(millis());
+            mcu_communicator->send_data();
+
+            if (button_pending) {
+                button_pending = false;
+                button_latency = std::max(button_latency, millis() - button_time);
+            }
+        });
+        control_task = scheduler.add("control", control_interval, 50, [this]() {
+            control();
+        });
+
+#ifdef USE_RICECOOKER_PROFILER
+        // Sections timed in the control task are handed over, see publish_profiler()
+        scheduler.add("profiler", profiler_interval, 0, [this]() {
+            Profiler::Report report {};
+            for (uint8_t section = 0; section < Profiler::SECTION_COUNT; section++) {
+                if (section != Profiler::LOOP) {
+                    global_profiler.harvest((Profiler::Section) section, report);
+                }
+            }
+            profiler_report.write(report);
+        });
+#endif
+
+        // ESPHome loop side, only reads snapshots
+        publish_task = publish_scheduler.add("publish", publish_interval, 75, [this]() {
+            publish();
+        });
+        publish_scheduler.add("persist", persist_interval, 0, [this]() {
+            persist();
+        });
+#ifdef USE_RICECOOKER_PROFILER
+        publish_scheduler.add("profiler", profiler_interval, 0, [this]() {
+            publish_profiler();
+        });
+#endif
+
+        // Last, everything the task touches is set up
+#if CONFIG_FREERTOS_UNICORE
+        BaseType_t created = xTaskCreate(task_main, "ricecooker", TASK_STACK, this, task_priority, &task_handle);
+#else
+        BaseType_t created = xTaskCreatePinnedToCore(task_main, "ricecooker", TASK_STACK, this, task_priority, &task_handle, task_core);
+#endif
+        if (created != pdPASS) {
+            ESP_LOGE(TAG, "Could not create the control task");
+            task_handle = nullptr;
+            mark_failed();
+        }
+    }
+
+    // Control task
+
+    void RiceCooker::task_main(void *arg) {
+        RiceCooker *cooker = static_cast<RiceCooker *>(arg);
+
+        for (;;) {
+            uint32_t wait = cooker->task_tick(millis());
+            // A command cuts the wait short
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
+        }
+    }
+
+    uint32_t RiceCooker::task_tick(uint32_t now) {
+        // Drains the answers and runs the init sequence
+        mcu_communicator->loop();
+
+        ControlCommand command;
+        while (commands.pop(command)) {
+            run_command(command, now);
+        }
+
+        // No temperatures until the MCU has been initialized
+        if (!mcu_communicator->is_ready()) {
+            share_state();
+            return TASK_PERIOD;
+        }
+
+        if (!scheduler_started) {
+            scheduler.start(now);
+            scheduler_started = true;
+            last_activity = now;
+        }
+
+        handle_buttons(now);
+
+        // Filter once per received frame, not once per tick
+        uint32_t frames = mcu_communicator->get_frame_count();
+        if (frames != filtered_frames) {
+            filtered_frames = frames;
+            top_filter.update(mcu_communicator->get_top_temperature());
+            bottom_filter.update(mcu_communicator->get_bottom_temperature());
+            heater.update(top_filter.get_temperature(), bottom_filter.get_temperature(), bottom_filter.get_rate());
+        }
+
+        // Before the first control step, with the first temperatures in
+        if (resume_pending && frames > 0) {
+            resume_program();
+        }
+
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+        // Answered or given up, including the retransmit
+        if (idle && !mcu_communicator->is_awaiting_response()) {
+            hold_awake(false);
+        }
+#endif
+
+        update_idle(now);
+        update_poll(now);
+
+        if (stats_reset.exchange(false)) {
+            scheduler.reset_stats(control_task);
+            mcu_communicator->reset_max_latency();
+            button_latency = 0;
+        }
+
+        scheduler.run(now);
+        share_state();
+
+        // An answer may be on its way, or need a retransmit
+        if (!idle || mcu_communicator->is_awaiting_response()) {
+            return TASK_PERIOD;
+        }
+        // Nothing to read before the next poll, the control step follows it
+        return std::max(TASK_PERIOD, scheduler.time_to_next(millis()));
+    }
+
+    void RiceCooker::run_command(ControlCommand &command, uint32_t now) {
+        // Every command is activity
+        last_activity = now;
+        if (idle) {
+            set_idle(false, now);
+        }
+
+        switch (command.type) {
+            case ControlCommand::SET_PROGRAM:
+                error = ProgramError::NONE;
+                scheduled = false;
+                run_planned = 0;
+                resume_pending = false;
+                set_program(std::move(command.program));
+                break;
+
+            case ControlCommand::START:
+                error = ProgramError::NONE;
+                scheduled = false;
+                resume_pending = false;
+                if (this->program != nullptr)
+                    start_program(millis());
+                break;
+
+            case ControlCommand::CANCEL:
+                error = ProgramError::NONE;
+                scheduled = false;
+                run_planned = 0;
+                resume_pending = false;
+                heater.reset();
+                if (this->program != nullptr)
+                    program->cancel();
+                break;
+
+            case ControlCommand::POWER_ON:
+                heater.power_on();
+                mcu_communicator->set_power(true);
+                break;
+
+            case ControlCommand::POWER_OFF:
+                heater.power_off();
+                mcu_communicator->set_power(false);
+                break;
+
+            case ControlCommand::RESET_LEARNED:
+                ESP_LOGI(TAG, "Resetting learned heater parameters");
+                heater.reset_parameters();
+                plan_ratio = 1.0f;
+                plan_runs = 0;
+                parameters_reset++;
+                break;
+
+            case ControlCommand::SET_WIFI:
+                mcu_communicator->set_led_status(
+                    MCUCommunicator::LED_ID::LED9_BLUE,
+                    command.value ? MCUCommunicator::LED_STATE::ON : MCUCommunicator::LED_STATE::OFF
+                );
+                break;
+
+            case ControlCommand::DUMP_TRACE:
+                dump_trace_now();
+                break;
+
+            case ControlCommand::WAKE:
+                break;
+
+            case ControlCommand::SCHEDULE:
+                if (this->program == nullptr) {
+                    ESP_LOGW(TAG, "No program to schedule");
+                    break;
+                }
+                // Held from the start until the plan says go
+                error = ProgramError::NONE;
+                heater.reset();
+                program->cancel();
+                scheduled = true;
+                deadline = now + command.seconds * 1000;
+                ESP_LOGI(TAG, "%s to be ready in %u min", program->get_name(), (unsigned) (command.seconds / 60));
+                break;
         }
+    }
 
+    void RiceCooker::set_program(ProgramStorage &&program) {
         heater.reset();
 
-        if (this->program != nullptr) {
-            delete this->program;
+        this->program_storage = std::move(program);
+        this->program = std::visit([](auto &stored) -> Program * {
+            if constexpr (std::is_same_v<std::decay_t<decltype(stored)>, std::monostate>) {
+                return nullptr;
+            } else {
+                return &stored;
+            }
+        }, this->program_storage);
+
+        ESP_LOGD(TAG, "Setting Program: %s", this->program != nullptr ? this->program->get_name() : "null");
+    }
+
+    void RiceCooker::handle_buttons(uint32_t now) {
+        ButtonEvent event;
+        bool handled = false;
+
+        while (mcu_communicator->pop_button_event(event)) {
+            ESP_LOGD(TAG, "Key %s: %s", ButtonEvent::key_name(event.key), ButtonEvent::type_name(event.type));
+
+            bool running = this->program != nullptr && this->program->is_running();
+            PanelMenu::Action action = menu.handle(event, running);
+
+            // Same path as Home Assistant's commands
+            ControlCommand command {ControlCommand::WAKE};
+            switch (action) {
+                case PanelMenu::SELECT:
+                    command.type = ControlCommand::SET_PROGRAM;
+                    command.program = menu_program();
+                    break;
+                case PanelMenu::START:
+                    if (this->program == nullptr) {
+                        ControlCommand select {ControlCommand::SET_PROGRAM};
+                        select.program = menu_program();
+                        run_command(select, now);
+                    }
+                    command.type = ControlCommand::START;
+                    break;
+                case PanelMenu::CANCEL:
+                    command.type = ControlCommand::CANCEL;
+                    break;
+                case PanelMenu::CLEAR:
+                    command.type = ControlCommand::SET_PROGRAM;
+                    break;
+                case PanelMenu::NONE:
+                    break;
+            }
+            run_command(command, now);
+
+            if (event.type != ButtonEvent::SHORT_PRESS && !handled) {
+                handled = true;
+                button_time = event.time;
+            }
+        }
+
+        if (handled) {
+            // Shown now and sent now, not at the next poll
+            remaining_time = this->program != nullptr ? this->program->remaining_time(&heater) : std::nullopt;
+            display();
+            scheduler.restart(mcu_task, now);
+            button_pending = true;
+        }
+    }
+
+    ProgramStorage RiceCooker::menu_program() {
+        uint8_t entry = menu.get_entry();
+        switch (entry) {
+            case PanelMenu::KEEP_WARM:
+                return ProgramStorage(std::in_place_type<KeepWarm>, menu.get_setting(), 5);
+            case PanelMenu::RICE:
+                return ProgramStorage(std::in_place_type<RiceProgram>, menu.get_setting());
+            case PanelMenu::FAST_RICE:
+                return ProgramStorage(std::in_place_type<RiceProgram>, menu.get_setting(), true);
+            default:
+                return ProgramStorage(std::in_place_type<RecipeProgram>, recipes[entry - PanelMenu::FIRST_RECIPE]);
+        }
+    }
+
+    int RiceCooker::program_entry() {
+        // By name, Home Assistant picks programs too
+        if (this->program == nullptr) {
+            return -1;
+        }
+        const char *name = this->program->get_name();
+        if (strcmp(name, keepwarm_name) == 0) {
+            return PanelMenu::KEEP_WARM;
+        }
+        if (strcmp(name, rice_name) == 0) {
+            return PanelMenu::RICE;
+        }
+        if (strcmp(name, fast_rice_name) == 0) {
+            return PanelMenu::FAST_RICE;
+        }
+        for (size_t i = 0; i < recipes.size(); i++) {
+            if (strcmp(name, recipes[i]->name) == 0) {
+                return PanelMenu::FIRST_RECIPE + i;
+            }
+        }
+        return -1;
+    }
+
+    void RiceCooker::dump_trace_now() {
+        // The trace is recorded and drained in the control task only
+        ESP_LOGI(TAG, "Trace dump: %u records, %u lost", (unsigned) global_trace.size(), global_trace.get_lost());
+
+        Trace::Record record;
+        uint8_t bytes[Trace::ENCODED_MAX];
+        char hex[Trace::ENCODED_MAX * 2 + 1];
+
+        while (global_trace.pop(record)) {
+            size_t len = Trace::encode(record, bytes);
+            for (size_t i = 0; i < len; i++) {
+                snprintf(hex + i * 2, 3, "%02x", bytes[i]);
+            }
+            ESP_LOGI(TAG, "TRACE:%s", hex);
         }
-        this->program = program;
+
+        ESP_LOGI(TAG, "Trace dump end");
+    }
+
+    void RiceCooker::share_state() {
+        ControlState state;
+
+        state.ready = mcu_communicator->is_ready();
+        state.idle = idle;
+        state.power = heater.get_power();
+        state.heating = heater.get_power() || heater.get_bottom_temperature() < heater.get_min_target();
+
+        state.top_temperature = mcu_communicator->get_top_temperature();
+        state.bottom_temperature = mcu_communicator->get_bottom_temperature();
+        state.top_fine = top_filter.get_temperature();
+        state.bottom_fine = bottom_filter.get_temperature();
+        state.bottom_rate = bottom_filter.get_rate();
+
+        state.program_name = this->program != nullptr ? this->program->get_name() : nullptr;
+        state.remaining_time = remaining_time;
+        state.scheduled = scheduled;
+
+        state.relay_cycles = heater.get_relay_cycles();
+        state.relay_on_time = heater.get_relay_on_time();
+        state.control_lateness = scheduler.get_max_lateness(control_task);
+        state.button_latency = button_latency;
+        mcu_communicator->get_link_stats(state.link);
+
+        heater.get_parameters(state.parameters);
+        state.parameters_reset = parameters_reset;
+
+        state.checkpoint = checkpoint;
+        state.checkpoint_valid = checkpoint_taken;
+
+        control_state.write(state);
     }
 
-    char* RiceCooker::get_program_name() {
+    void RiceCooker::control() {
         if (this->program != nullptr) {
-            return this->program->get_name();
+            {
+                RICECOOKER_PROFILE(PROGRAM_STEP);
+                this->program->step(&heater);
+            }
+            {
+                RICECOOKER_PROFILE(HEATER_STEP);
+                heater.step(millis());
+            }
+
+            // Stays on the display after the program makes way for keep warm
+            if (this->program->get_error() != ProgramError::NONE && error == ProgramError::NONE) {
+                error = this->program->get_error();
+                ESP_LOGW(TAG, "%s stopped, error %u", this->program->get_name(), (unsigned) error);
+            }
+
+            // Once per step, the display and the sensors use this one
+            remaining_time = this->program->remaining_time(&heater);
+            if (remaining_time.has_value() && *remaining_time == 0) {
+                learn_plan(millis());
+                heater.power_off();
+                set_program(ProgramStorage(std::in_place_type<KeepWarm>, 65, 2));
+                this->program->start();
+                remaining_time = this->program->remaining_time(&heater);
+            }
+            if (scheduled) {
+                update_schedule(millis());
+            }
         } else {
-            return none_name;
+            remaining_time.reset();
         }
-            
-    };
 
-    void RiceCooker::set_wifi(bool status){
-        if(status){
-            this->mcu_communicator->set_led_status(
-                MCUCommunicator::LED_ID::LED9_BLUE, 
-                MCUCommunicator::LED_STATE::ON
-            );
-        }else{
-            this->mcu_communicator->set_led_status(
-                MCUCommunicator::LED_ID::LED9_BLUE, 
-                MCUCommunicator::LED_STATE::OFF
-            );
+        update_checkpoint();
+        display();
+    }
+
+    void RiceCooker::display() {
+        uint32_t now = millis();
+
+        // The panel menu while it is in use, the pages otherwise
+        Framebuffer menu_frame;
+        if (menu.render(now, menu_frame)) {
+            screen.set_overlay(menu_frame, now);
+        } else {
+            screen.clear_overlay();
         }
+
+        bool running = this->program != nullptr && this->program->is_running();
+        screen.set_remaining_time(this->remaining_time);
+        screen.set_temperature(mcu_communicator->get_bottom_temperature());
+        screen.set_stage(running ? this->program->get_stage_name() : nullptr);
+        screen.set_error((uint8_t) error);
+        render_display(now);
+
+        // Registers only change, and the frame is only rebuilt, on a difference
+        mcu_communicator->set_power(heater.get_power());
+        mcu_communicator->set_sleep(this->sleep);
+
+        // Mode LEDs: entry n of the panel menu lights LED n
+        int entry = program_entry();
+        uint16_t mode = entry >= 0 && entry < MODE_LEDS ? MCUCommunicator::led_mask((MCUCommunicator::LED_ID) (entry + 1)) : 0;
+        mcu_communicator->update_leds(mode, MODE_LED_MASK & ~mode);
     }
 
-    void RiceCooker::start() {
-        if (this->program != nullptr)
-            program->start();
+    void RiceCooker::update_schedule(uint32_t now) {
+        // Signed, a deadline already past starts at once
+        int32_t left = (int32_t) (deadline - now) / 1000;
+
+        // Planned again every step: the pot's temperature and what the
+        // heater learned move it
+        std::optional<uint32_t> planned = this->program->planned_time(&heater);
+        uint32_t needed = 0;
+        if (planned.has_value()) {
+            uint32_t expected = *planned * plan_ratio;
+            uint32_t margin = std::max((uint32_t) (expected * schedule_margin), schedule_min_margin / 1000);
+            needed = expected + margin;
+        }
+
+        if (planned.has_value() && left > (int32_t) needed) {
+            // Counts down to the deadline meanwhile
+            remaining_time = left;
+            return;
+        }
+
+        if (planned.has_value()) {
+            ESP_LOGI(TAG, "Starting %s, planned %u min (x%.2f), %d min to the deadline",
+                this->program->get_name(), (unsigned) (*planned / 60), plan_ratio, (int) (left / 60));
+        } else {
+            ESP_LOGW(TAG, "%s never finishes, starting now", this->program->get_name());
+        }
+        scheduled = false;
+        start_program(now);
+        remaining_time = this->program->remaining_time(&heater);
     }
 
-    void RiceCooker::cancel() {
-        this->heater.reset();
+    void RiceCooker::start_program(uint32_t now) {
+        // Planned before the start, from the pot as it is now
+        run_planned = this->program->planned_time(&heater).value_or(0);
+        run_started = now;
+        this->program->start();
+    }
+
+    void RiceCooker::resume_program() {
+        resume_pending = false;
+        const ProgramCheckpoint &saved = resume_checkpoint.program;
+
+        // Much colder: it sat unpowered for long, the food with it. Much hotter: another pot
+        int bottom = mcu_communicator->get_bottom_temperature();
+        if (std::abs(bottom - resume_checkpoint.bottom_temperature) > resume_max_drift) {
+            ESP_LOGW(TAG, "Not resuming, bottom at %d ºC, %u ºC at the checkpoint",
+                bottom, resume_checkpoint.bottom_temperature);
+            return;
+        }
 
-        if (this->program != nullptr)
-            program->cancel();
+        ProgramStorage storage;
+        if (!program_from(saved, storage)) {
+            ESP_LOGW(TAG, "Not resuming, the checkpoint is for an unknown program");
+            return;
+        }
+        set_program(std::move(storage));
+        if (!this->program->resume(saved)) {
+            ESP_LOGW(TAG, "Not resuming, the checkpoint does not fit %s", this->program->get_name());
+            set_program(ProgramStorage());
+            return;
+        }
+
+        remaining_time = this->program->remaining_time(&heater);
+        ESP_LOGI(TAG, "Resumed %s in %s, %u s into the stage",
+            this->program->get_name(), this->program->get_stage_name(), (unsigned) saved.elapsed);
     }
 
-    void RiceCooker::timer(){
-        minutes++;
+    bool RiceCooker::program_from(const ProgramCheckpoint &checkpoint, ProgramStorage &storage) {
+        const uint8_t *settings = checkpoint.settings;
+        switch (checkpoint.kind) {
+            case ProgramCheckpoint::KEEP_WARM:
+                storage.emplace<KeepWarm>(settings[0], settings[1]);
+                return true;
+            case ProgramCheckpoint::RICE:
+                storage.emplace<RiceProgram>(settings[0], settings[1], settings[2] != 0);
+                return true;
+            case ProgramCheckpoint::RECIPE:
+                if (settings[0] >= recipes.size()) {
+                    return false;
+                }
+                storage.emplace<RecipeProgram>(recipes[settings[0]]);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void RiceCooker::update_checkpoint() {
+        // Until the boot resume is decided, the stored checkpoint is the one to keep
+        if (resume_pending) {
+            return;
+        }
 
-        if(minutes == 60){
-            hours = ++hours % 100;
-            minutes = 0;
+        Checkpoint next {};
+        if (this->program != nullptr && this->program->checkpoint(next.program)) {
+            if (const RecipeProgram *recipe = std::get_if<RecipeProgram>(&program_storage)) {
+                auto found = std::find(recipes.begin(), recipes.end(), recipe->get_recipe());
+                next.program.settings[0] = found - recipes.begin();
+            }
+            next.top_temperature = mcu_communicator->get_top_temperature();
+            next.bottom_temperature = mcu_communicator->get_bottom_temperature();
         }
+
+        checkpoint = next;
+        checkpoint_taken = true;
+        checkpoint_store.update(checkpoint);
     }
 
-    void RiceCooker::setup() {
-        // Initialize MCU communicator
-        mcu_communicator = new MCUCommunicator(this);
-        mcu_communicator->setup();
+    void RiceCooker::learn_plan(uint32_t now) {
+        // Runs that gave up say nothing about how long a good one takes
+        if (run_planned == 0 || this->program->get_error() != ProgramError::NONE) {
+            run_planned = 0;
+            return;
+        }
+
+        float ratio = std::clamp((now - run_started) / 1000.0f / run_planned, PLAN_RATIO_MIN, PLAN_RATIO_MAX);
+        // The first run replaces the guess, later ones are smoothed
+        if (plan_runs == 0) {
+            plan_ratio = ratio;
+        } else {
+            plan_ratio += (ratio - plan_ratio) / std::min<float>(plan_runs + 1, PLAN_SMOOTHING);
+        }
+        if (plan_runs < UINT8_MAX) {
+            plan_runs++;
+        }
+        ESP_LOGD(TAG, "%s took %.2fx its plan, plans now x%.2f", this->program->get_name(), ratio, plan_ratio);
+        run_planned = 0;
     }
 
-    void RiceCooker::loop() {
-        // Update MCU communication
-        mcu_communicator->loop();
+    void RiceCooker::render_display(uint32_t now) {
+        uint8_t digits[Framebuffer::DIGITS];
+        if (screen.render(now, digits)) {
+            mcu_communicator->set_digits(digits);
+        }
+    }
+
+    void RiceCooker::update_idle(uint32_t now) {
+        // A key on the panel is activity too, the MCU reports it in its answers
+        uint32_t keys = mcu_communicator->get_key_frames();
+        bool key = keys != key_frames_seen;
+        if (key) {
+            key_frames_seen = keys;
+            last_key = now;
+        }
+        bool active = key
+            || heater.get_power()
+            || (this->program != nullptr && this->program->is_running());
+
+        if (active) {
+            last_activity = now;
+            if (idle) {
+                set_idle(false, now);
+            }
+        } else if (!idle && now - last_activity >= idle_delay) {
+            set_idle(true, now);
+        }
+    }
+
+    void RiceCooker::set_idle(bool idle, uint32_t now) {
+        this->idle = idle;
+
+        uint32_t poll = idle ? idle_poll_interval : mcu_interval;
+        set_poll(poll);
+        scheduler.set_period(control_task, idle ? idle_poll_interval : control_interval);
+
+        if (!idle) {
+            // Within one frame, not at the end of the slow period
+            scheduler.restart(mcu_task, now);
+            scheduler.restart(control_task, now);
+        }
+
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+        hold_awake(!idle);
+#endif
+
+        ESP_LOGD(TAG, "%s, MCU poll every %u ms", idle ? "Idle" : "Active", (unsigned) poll);
+    }
+
+    void RiceCooker::update_poll(uint32_t now) {
+        if (idle) {
+            return;
+        }
 
-        // Update heater with latest temperature data
-        uint8_t top_temp = mcu_communicator->get_top_temperature();
-        uint8_t bottom_temp = mcu_communicator->get_bottom_temperature();
+        // Near the band the filter slope drives the relay, and a held key
+        // should not wait for the display
+        bool fast = heater.is_modulating() || now - last_key < KEY_HOLD_TIME;
+        set_poll(fast ? mcu_fast_interval : mcu_interval);
+    }
+
+    void RiceCooker::set_poll(uint32_t poll) {
+        if (scheduler.get_period(mcu_task) == poll) {
+            return;
+        }
+
+        // Keeps the next deadline, the new rate starts after it
+        scheduler.set_period(mcu_task, poll);
+
+        // The filter slopes are per sample
+        top_filter.set_sample_period(poll);
+        bottom_filter.set_sample_period(poll);
+
+        ESP_LOGV(TAG, "MCU poll every %u ms", (unsigned) poll);
+    }
+
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+    void RiceCooker::setup_light_sleep() {
+        esp_err_t err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "ricecooker", &pm_lock);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "No light sleep, PM lock failed: %s", esp_err_to_name(err));
+            pm_lock = nullptr;
+            return;
+        }
+        // Awake until idle mode starts
+        hold_awake(true);
+
+        // Same frequency at both ends: scaling the APB clock would move the UART baud rate
+#if ESP_IDF_VERSION_MAJOR >= 5
+        esp_pm_config_t config {};
+        config.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+        config.min_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+#else
+        esp_pm_config_esp32_t config {};
+        config.max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+        config.min_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+#endif
+        config.light_sleep_enable = true;
+
+        err = esp_pm_configure(&config);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "No light sleep, PM config failed: %s", esp_err_to_name(err));
+            return;
+        }
+
+        // The MCU only talks when polled, but a frame in sleep still wakes the chip
+        auto *uart = static_cast<uart::IDFUARTComponent *>(this->parent_);
+        uart_port_t port = (uart_port_t) uart->get_hw_serial_number();
+        uart_set_wakeup_threshold(port, 3);
+        esp_sleep_enable_uart_wakeup(port);
+    }
+
+    void RiceCooker::hold_awake(bool hold) {
+        if (pm_lock == nullptr || hold == awake) {
+            return;
+        }
+        awake = hold;
+        if (hold) {
+            esp_pm_lock_acquire(pm_lock);
+        } else {
+            esp_pm_lock_release(pm_lock);
+        }
+    }
+#endif
+
+    void RiceCooker::publish() {
+        uint32_t now = millis();
+        uint32_t since_last = now - publish_last;
+
+        const ControlState &state = this->state();
 
+        uint8_t top_temp = state.top_temperature;
+        uint8_t bottom_temp = state.bottom_temperature;
+        uint16_t top_fine = state.top_fine;
+        uint16_t bottom_fine = state.bottom_fine;
 
-        heater.update(top_temp, bottom_temp);
+        bool top_changed = top_temp != published_top;
+        bool bottom_changed = bottom_temp != published_bottom;
+        bool top_fine_changed = sensor_top_filtered_ != nullptr
+            && std::abs(top_fine - published_top_fine) >= FINE_PUBLISH_STEP;
+        bool bottom_fine_changed = (sensor_bottom_filtered_ != nullptr || sensor_bottom_rate_ != nullptr)
+            && std::abs(bottom_fine - published_bottom_fine) >= FINE_PUBLISH_STEP;
 
-        if (millis() > relay_last + relay_interval){
-            relay_last = millis();
+        // Heating up: temperatures move fast, follow them closely
+        bool heating = state.heating;
+        uint32_t min_interval = heating ? publish_fast_interval : publish_min_interval;
+
+        // Refresh everything at least every max interval, however often
+        // the temperatures went out in between
+        bool heartbeat = published_top < 0 || now - heartbeat_last >= publish_max_interval;
+        if (heartbeat) {
+            heartbeat_last = now;
+        }
+
+        // Changes once a minute at most, not held back by the temperatures
+        publish_remaining_time(heartbeat);
+
+        if (!heartbeat) {
+            if (since_last < min_interval) {
+                return;
+            }
+            if (publish_on_change && !top_changed && !bottom_changed && !top_fine_changed && !bottom_fine_changed) {
+                return;
+            }
+        }
 
+        // Both sensors go out in the same cycle
+        bool all = heartbeat || !publish_on_change;
 
+        if (sensor_top_ != nullptr && (all || top_changed))
             sensor_top_->publish_state(top_temp);
+        if (sensor_bottom_ != nullptr && (all || bottom_changed))
             sensor_bottom_->publish_state(bottom_temp);
+        if (sensor_top_filtered_ != nullptr && (all || top_fine_changed))
+            sensor_top_filtered_->publish_state(top_fine / 256.0f);
+        if (sensor_bottom_filtered_ != nullptr && (all || bottom_fine_changed))
+            sensor_bottom_filtered_->publish_state(bottom_fine / 256.0f);
+        if (sensor_bottom_rate_ != nullptr && (all || bottom_fine_changed))
+            sensor_bottom_rate_->publish_state(state.bottom_rate / 256.0f);
 
-            if (this->program != nullptr) {
-                this->program->step(&heater);
-                heater.step(millis());
+        published_top = top_temp;
+        published_bottom = bottom_temp;
+        if (all || top_fine_changed)
+            published_top_fine = top_fine;
+        if (all || bottom_fine_changed)
+            published_bottom_fine = bottom_fine;
+        publish_last = now;
+
+        if (heartbeat && sensor_relay_cycles_ != nullptr)
+            sensor_relay_cycles_->publish_state(state.relay_cycles);
+        if (heartbeat && sensor_relay_on_time_ != nullptr)
+            sensor_relay_on_time_->publish_state(state.relay_on_time / 1000);
+
+        if (!heartbeat) {
+            return;
+        }
+
+        if (sensor_tick_jitter_ != nullptr)
+            sensor_tick_jitter_->publish_state(state.control_lateness);
+        if (sensor_button_latency_ != nullptr)
+            sensor_button_latency_->publish_state(state.button_latency);
+
+        for (uint8_t stat = 0; stat < MCUCommunicator::LINK_STAT_COUNT; stat++) {
+            if (link_sensors_[stat] != nullptr)
+                link_sensors_[stat]->publish_state(state.link.values[stat]);
+        }
 
-                // Extra safety: check remaining_time() returns valid value
-                std::optional<unsigned int> remaining = this->program->remaining_time();
-                if (remaining.has_value() && *remaining <= 0) {
-                    heater.power_off();
-                    set_program(new KeepWarm(65, 2));
-                    start();
+        // Worst cases are per heartbeat. The control task owns them, it clears them.
+        stats_reset = true;
+    }
+
+    void RiceCooker::publish_remaining_time(bool heartbeat) {
+        std::optional<uint32_t> remaining_time = state().remaining_time;
+
+        // Whole minutes, the estimate is not better than that
+        std::optional<uint32_t> remaining;
+        if (remaining_time.has_value()) {
+            remaining = (*remaining_time + 59) / 60;
+        }
+
+        if (!heartbeat && remaining == published_remaining) {
+            return;
+        }
+        published_remaining = remaining;
+
+        if (sensor_remaining_time_ != nullptr) {
+            sensor_remaining_time_->publish_state(remaining.has_value() ? *remaining : NAN);
+        }
+
+        if (sensor_completion_time_ != nullptr) {
+            float completion = NAN;
+#ifdef USE_RICECOOKER_CLOCK
+            if (clock_ != nullptr && remaining_time.has_value()) {
+                ESPTime now = clock_->now();
+                if (now.is_valid()) {
+                    completion = now.timestamp + *remaining_time;
                 }
-            } else {
-                ESP_LOGD(TAG, "No program selected");
             }
+#endif
+            sensor_completion_time_->publish_state(completion);
         }
+    }
 
-        // Update display time based on program or temperature
-        if (this->program != nullptr) {
-            std::optional<unsigned int> remaining = this->program->remaining_time();
-            if (remaining.has_value()) {
-                this->hours = *remaining / 60;
-                this->minutes = *remaining % 60;
-            } else {
-                this->hours = top_temp;
-                this->minutes = bottom_temp;
+    void RiceCooker::persist() {
+        parameter_store.save(state().parameters, millis());
+    }
+
+#ifdef USE_RICECOOKER_PROFILER
+    void RiceCooker::publish_profiler() {
+        // The control task's sections come from its last report, the loop is timed here
+        Profiler::Report report = profiler_report.read();
+        global_profiler.harvest(Profiler::LOOP, report);
+
+        for (uint8_t section = 0; section < Profiler::SECTION_COUNT; section++) {
+            for (uint8_t stat = 0; stat < Profiler::STAT_COUNT; stat++) {
+                sensor::Sensor *sensor = profiler_sensors_[section][stat];
+                if (sensor != nullptr) {
+                    sensor->publish_state(report.values[section][stat]);
+                }
             }
-        } else {
-            this->hours = top_temp;
-            this->minutes = bottom_temp;
+
+            ESP_LOGV(TAG, "Profile %s: %u runs, max %.0f us, overruns %.0f",
+                Profiler::section_name((Profiler::Section) section),
+                report.counts[section],
+                report.values[section][Profiler::MAX],
+                report.values[section][Profiler::OVERRUNS]);
         }
+    }
+#endif
 
-        // Update MCU display
-        mcu_communicator->set_time(this->hours, this->minutes);
-        mcu_communicator->set_power(heater.get_power());
-        mcu_communicator->set_sleep(this->sleep);
+    void RiceCooker::loop() {
+        RICECOOKER_PROFILE(LOOP);
+
+        // Latest from the control task, held until the next loop
+        current_state = &control_state.read();
+        const ControlState &state = *current_state;
+
+        if (!state.ready) {
+            return;
+        }
+
+        uint32_t now = millis();
+
+        if (!publish_started) {
+            publish_scheduler.start(now);
+            publish_started = true;
+        }
+
+        // Publishing slows down with the MCU poll
+        if (state.idle != published_idle) {
+            published_idle = state.idle;
+            publish_scheduler.set_period(publish_task, state.idle ? idle_poll_interval : publish_interval);
+        }
+
+        // reset_learned() stores the defaults without waiting for persist()
+        if (state.parameters_reset != saved_parameters_reset) {
+            saved_parameters_reset = state.parameters_reset;
+            parameter_store.save(state.parameters, now, true);
+        }
+
+        // Cheap unless the program or its stage moved, see CheckpointStore
+        if (state.checkpoint_valid) {
+            checkpoint_store.save(state.checkpoint, now);
+        }
+
+        publish_scheduler.run(now);
     }
 
 }
@@ -2,12 +2,37 @@
 
 #include "esphome/core/component.h"
 #include "esphome/core/datatypes.h"
+#include "esphome/core/log.h"
 #include "esphome/components/uart/uart.h"
 #include "esphome/components/sensor/sensor.h"
+#ifdef USE_RICECOOKER_CLOCK
+#include "esphome/components/time/real_time_clock.h"
+#endif
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+#include "esp_pm.h"
+#endif
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <atomic>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "program.h"
 #include "heater.h"
+#include "temperature_filter.h"
+#include "parameter_store.h"
+#include "checkpoint_store.h"
 #include "mcu_communicator.h"
+#include "uart_transport.h"
+#include "display.h"
+#include "panel_menu.h"
+#include "tick_scheduler.h"
+#include "profiler.h"
+#include "spsc.h"
+#include "trace.h"
 
 namespace esphome {
 namespace ricecooker {
@@ -16,6 +41,92 @@ class Program;
 
 static const char *const TAG = "ricecooker";
 
+/*
+    What the control task shows the ESPHome side. Written whole every
+    control tick, read through a SnapshotBuffer.
+*/
+struct ControlState {
+    bool ready;
+    bool idle;
+    bool power;
+    // Relay on or below the target band, temperatures move fast
+    bool heating;
+
+    // MCU readings, ºC
+    uint8_t top_temperature;
+    uint8_t bottom_temperature;
+
+    // Filtered, Q8.8 ºC and Q8.8 ºC per minute
+    uint16_t top_fine;
+    uint16_t bottom_fine;
+    int16_t bottom_rate;
+
+    const char *program_name;
+    std::optional<uint32_t> remaining_time;
+    // Waiting to start for a finish-by deadline
+    bool scheduled;
+
+    uint32_t relay_cycles;
+    uint64_t relay_on_time;
+
+    // Worst control task lateness since the last stats reset, ms
+    uint32_t control_lateness;
+
+    MCUCommunicator::LinkStats link;
+
+    // Worst panel key to display frame since the last stats reset, ms
+    uint32_t button_latency;
+
+    HeaterParameters parameters;
+    // Bumped by reset_learned(), the defaults are saved without waiting
+    uint32_t parameters_reset;
+
+    // For NVS, valid once the boot resume is decided
+    Checkpoint checkpoint;
+    bool checkpoint_valid;
+};
+
+/*
+    What the ESPHome side asks the control task to do, through an SpscQueue.
+    Programs are built on the caller's side and copied over.
+*/
+struct ControlCommand {
+    enum Type : uint8_t {
+        SET_PROGRAM,
+        START,
+        CANCEL,
+        POWER_ON,
+        POWER_OFF,
+        RESET_LEARNED,
+        SET_WIFI,
+        DUMP_TRACE,
+        WAKE,
+        SCHEDULE,
+    };
+
+    Type type = WAKE;
+    bool value = false;         // SET_WIFI
+    uint32_t seconds = 0;       // SCHEDULE, until the program is to be ready
+    ProgramStorage program {};  // SET_PROGRAM, monostate clears it
+};
+
+/*
+    Every queued command carries room for the largest program, the queue
+    of 8 costs 8 times this: 48 bytes on a 64 bit host, less on the ESP32.
+    Checked so a bigger program shows up here.
+*/
+static_assert(sizeof(ControlCommand) <= 48, "ControlCommand grew, check the command queue's RAM");
+
+/*
+    MCU polling, programs and the heater run in their own FreeRTOS task,
+    at a fixed period and above the ESPHome loop, so WiFi, API or OTA work
+    cannot hold a relay decision back. The ESPHome side only publishes:
+    state comes over as ControlState snapshots, requests go as
+    ControlCommands. Both are lock free, neither side ever waits.
+
+    Public methods are for the ESPHome loop; they do not touch the control
+    task's objects.
+*/
 class RiceCooker : public Component, public uart::UARTDevice {
 
     public:
@@ -23,9 +134,134 @@ class RiceCooker : public Component, public uart::UARTDevice {
 
         void set_sensor_temp_top(sensor::Sensor *sensor_top) { sensor_top_ = sensor_top; }
         void set_sensor_temp_bottom(sensor::Sensor *sensor_bottom) { sensor_bottom_ = sensor_bottom; }
+        void set_sensor_tick_jitter(sensor::Sensor *sensor_tick_jitter) { sensor_tick_jitter_ = sensor_tick_jitter; }
+        void set_sensor_temp_top_filtered(sensor::Sensor *sensor) { sensor_top_filtered_ = sensor; }
+        void set_sensor_temp_bottom_filtered(sensor::Sensor *sensor) { sensor_bottom_filtered_ = sensor; }
+        void set_sensor_temp_bottom_rate(sensor::Sensor *sensor) { sensor_bottom_rate_ = sensor; }
+        void set_sensor_relay_cycles(sensor::Sensor *sensor) { sensor_relay_cycles_ = sensor; }
+        void set_sensor_relay_on_time(sensor::Sensor *sensor) { sensor_relay_on_time_ = sensor; }
+        void set_sensor_remaining_time(sensor::Sensor *sensor) { sensor_remaining_time_ = sensor; }
+        void set_sensor_completion_time(sensor::Sensor *sensor) { sensor_completion_time_ = sensor; }
+        void set_sensor_button_latency(sensor::Sensor *sensor) { sensor_button_latency_ = sensor; }
+#ifdef USE_RICECOOKER_CLOCK
+        /* Wall clock for the completion time sensor. */
+        void set_clock(time::RealTimeClock *clock) { clock_ = clock; }
+#endif
+
+        /*
+            Temperature publishing policy. With on_change only new values are
+            sent, no more often than min_interval (fast_interval while heating
+            up); every max_interval all sensors are refreshed regardless.
+        */
+        void set_publish_on_change(bool on_change) { publish_on_change = on_change; }
+        void set_publish_min_interval(uint32_t interval) { publish_min_interval = interval; }
+        void set_publish_fast_interval(uint32_t interval) { publish_fast_interval = interval; }
+        void set_publish_max_interval(uint32_t interval) { publish_max_interval = interval; }
+
+        /* Link quality, diagnostic. */
+        void set_link_sensor(MCUCommunicator::LinkStat stat, sensor::Sensor *sensor) { link_sensors_[stat] = sensor; }
+
+#ifdef USE_RICECOOKER_PROFILER
+        void set_profiler_sensor(Profiler::Section section, Profiler::Stat stat, sensor::Sensor *sensor) {
+            profiler_sensors_[section][stat] = sensor;
+        }
+        void set_profiler_budget(Profiler::Section section, uint32_t budget) {
+            global_profiler.set_budget(section, budget);
+        }
+#endif
+
+        // MCU init sequence
+        void add_init_step(MCUCommunicator::InitStep step) { mcu_communicator->add_init_step(step); }
+        void set_init_gap(uint32_t gap) { mcu_communicator->set_init_gap(gap); }
+        void set_init_timeout(uint32_t timeout) { mcu_communicator->set_init_timeout(timeout); }
+
+        /*
+            MCU polling: every `interval`, or every `fast_interval` while the
+            heater is modulating or a key is held. Idle mode has its own.
+        */
+        void set_poll_interval(uint32_t interval) { mcu_interval = interval; }
+        void set_fast_poll_interval(uint32_t interval) { mcu_fast_interval = interval; }
+        void set_response_timeout(uint32_t timeout) { mcu_communicator->set_response_timeout(timeout); }
+
+        /*
+            Finish-by scheduling: the planned start is pushed back by
+            `margin` of the planned time, and at least `min_margin` ms, for
+            estimates that come out short.
+        */
+        void set_schedule_margin(float margin) { schedule_margin = margin; }
+        void set_schedule_min_margin(uint32_t margin) { schedule_min_margin = margin; }
+
+        /* How long each display page shows in turn, 0 leaves it out. See Display. */
+        void set_display_page_time(Display::Page page, uint32_t time) { screen.set_page_time(page, time); }
+
+        /* Heater control, see Heater::set_controller. */
+        void set_heater_controller(Heater::ControllerType type) { heater.set_controller(type); }
+        void set_heater_element_lag(uint32_t lag) { heater.set_element_lag(lag); }
+
+        // Relay switching, see RelayScheduler
+        void set_relay_window(uint32_t window) { heater.set_relay_window(window); }
+        void set_relay_min_on_time(uint32_t time) { heater.set_relay_min_on_time(time); }
+        void set_relay_min_off_time(uint32_t time) { heater.set_relay_min_off_time(time); }
+        void set_relay_cycle_budget(uint16_t budget) { heater.set_relay_cycle_budget(budget); }
+
+        /* Learned heater parameters are saved at most once per interval. */
+        void set_heater_save_interval(uint32_t interval) { parameter_store.set_min_interval(interval); }
+
+        /*
+            The running program is checkpointed to RTC memory every control
+            step and to NVS at most once per interval, and on each stage
+            change. After a reset the program resumes where it was, if the
+            bottom sensor is within `max_drift` ºC of the checkpoint.
+        */
+        void set_resume(bool resume) { resume_enabled = resume; }
+        void set_checkpoint_save_interval(uint32_t interval) { checkpoint_store.set_min_interval(interval); }
+        void set_resume_max_drift(uint8_t drift) { resume_max_drift = drift; }
+
+        /* Forgets what the heater learned and stores the defaults. */
+        void reset_learned();
+
+        /*
+            Control task scheduling. The core is ignored on single core
+            builds; the ESPHome loop runs at priority 1.
+        */
+        void set_task_priority(uint8_t priority) { task_priority = priority; }
+        void set_task_core(uint8_t core) { task_core = core; }
+
+        /*
+            Idle mode: with no program running for `delay` the MCU is polled
+            every `interval` instead of every 100 ms and, if built with light
+            sleep, the chip sleeps between exchanges. A key on the panel or
+            any command brings back the full rate.
+        */
+        void set_idle_poll_interval(uint32_t interval) { idle_poll_interval = interval; }
+        void set_idle_delay(uint32_t delay) { idle_delay = delay; }
+
+        /* Leaves idle mode now, every command does it. */
+        void wake();
+        bool is_idle();
+
+        /* True once the MCU handshake is done and the control loop runs. */
+        bool is_ready();
 
         void start();
         void cancel();
+
+        /*
+            Has the selected program ready in `seconds` instead of starting
+            it now. The pot stays cold and the program starts at the latest
+            moment it can still finish in time, planned from the heating
+            rate the heater learned and the stage durations, and planned
+            again every control step as the pot's temperature comes in.
+            START, CANCEL or another program drop the schedule.
+        */
+        void finish_in(uint32_t seconds);
+#ifdef USE_RICECOOKER_CLOCK
+        /* Same, ready at the next hour:minute on the clock. False without a valid time. */
+        bool finish_at(uint8_t hour, uint8_t minute);
+#endif
+        /* True while a program waits for its planned start. */
+        bool is_scheduled();
+
         void set_cooking_mode();
         void manual_temperature_set(uint8_t temp);
         void manual_timer_set();
@@ -33,42 +269,238 @@ class RiceCooker : public Component, public uart::UARTDevice {
         void power_on();
         void power_off();
 
-        void set_program(Program* program);
+        /*
+            Replaces the current program with a new T, e.g.
+            `emplace_program<KeepWarm>(70, 5)`. Never allocates. The control
+            task switches on its next tick; false if its queue is full.
+        */
+        template<typename T, typename... Args>
+        bool emplace_program(Args&&... args) {
+            ControlCommand command {ControlCommand::SET_PROGRAM};
+            command.program.template emplace<T>(std::forward<Args>(args)...);
+            return send(command);
+        }
+
+        void clear_program();
+
+        /* Recipes from the YAML `recipes:` list, stage tables live in flash. */
+        void add_recipe(const Recipe *recipe) { recipes.push_back(recipe); }
+
+        /* Switches to the recipe called `name`. Returns false if there is none. */
+        bool select_recipe(const std::string &name);
 
         uint8_t get_top_temperature();
         uint8_t get_bottom_temperature();
 
         bool get_power();
 
-        char* get_program_name();
+        const char* get_program_name();
+
+        /*
+            Seconds until the program finishes, nullopt if it never does.
+            Cached from the last control step.
+        */
+        std::optional<uint32_t> get_remaining_time();
 
         void set_wifi(bool status);
 
+        /* Drains the control trace to the log, decode with tools/trace_decode.py. */
+        void dump_trace();
+
         void setup() override;
         void loop() override;
-        void update();
         //void dump_config() override;
 
     protected:
-        sensor::Sensor *sensor_top_;
-        sensor::Sensor *sensor_bottom_;
+        sensor::Sensor *sensor_top_ {nullptr};
+        sensor::Sensor *sensor_bottom_ {nullptr};
+        sensor::Sensor *sensor_tick_jitter_ {nullptr};
+        sensor::Sensor *sensor_top_filtered_ {nullptr};
+        sensor::Sensor *sensor_bottom_filtered_ {nullptr};
+        sensor::Sensor *sensor_bottom_rate_ {nullptr};
+        sensor::Sensor *sensor_relay_cycles_ {nullptr};
+        sensor::Sensor *sensor_relay_on_time_ {nullptr};
+        sensor::Sensor *sensor_remaining_time_ {nullptr};
+        sensor::Sensor *sensor_completion_time_ {nullptr};
+        sensor::Sensor *sensor_button_latency_ {nullptr};
+#ifdef USE_RICECOOKER_CLOCK
+        time::RealTimeClock *clock_ {nullptr};
+#endif
+        sensor::Sensor *link_sensors_[MCUCommunicator::LINK_STAT_COUNT] {};
+#ifdef USE_RICECOOKER_PROFILER
+        sensor::Sensor *profiler_sensors_[Profiler::SECTION_COUNT][Profiler::STAT_COUNT] {};
+#endif
 
     private:
-        void timer();
+        // ESPHome side
+        bool send(const ControlCommand &command);
+        const ControlState &state() { return *current_state; }
+        void publish();
+        void publish_remaining_time(bool heartbeat);
+        void persist();
+#ifdef USE_RICECOOKER_PROFILER
+        void publish_profiler();
+        uint32_t profiler_interval = 60000;
+#endif
 
-        // Tickers
-        int relay_interval = 500;
-        int relay_last = 0;
+        // Control task side
+        static void task_main(void *arg);
+        uint32_t task_tick(uint32_t now);
+        void run_command(ControlCommand &command, uint32_t now);
+        void set_program(ProgramStorage &&program);
+        void handle_buttons(uint32_t now);
+        ProgramStorage menu_program();
+        int program_entry();
+        void control();
+        void display();
+        void render_display(uint32_t now);
+        void share_state();
+        void update_schedule(uint32_t now);
+        void start_program(uint32_t now);
+        void resume_program();
+        bool program_from(const ProgramCheckpoint &checkpoint, ProgramStorage &storage);
+        void update_checkpoint();
+        void learn_plan(uint32_t now);
+        void update_idle(uint32_t now);
+        void set_idle(bool idle, uint32_t now);
+        void update_poll(uint32_t now);
+        void set_poll(uint32_t poll);
+        void dump_trace_now();
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+        void setup_light_sleep();
+        void hold_awake(bool hold);
+#endif
 
-        // State
-        int hours = 0;
-        int minutes = 0;
-        bool middle_dots = true;
+        // Between the two sides
+        SnapshotBuffer<ControlState> control_state;
+        // Read once per ESPHome loop, getters in between see the same state
+        const ControlState *current_state {nullptr};
+        SpscQueue<ControlCommand, 8> commands;
+        // Set on the heartbeat, the task clears its worst-case stats
+        std::atomic<bool> stats_reset {false};
+#ifdef USE_RICECOOKER_PROFILER
+        SnapshotBuffer<Profiler::Report> profiler_report;
+#endif
 
+        // Control task
+        TaskHandle_t task_handle {nullptr};
+        uint8_t task_priority = 5;
+        uint8_t task_core = 1;
+        static const uint32_t TASK_STACK = 4096;
+        // Wakes at least this often while active, to read MCU answers as they come
+        static constexpr uint32_t TASK_PERIOD = 10;
+
+        // Tickers, `scheduler` runs in the control task and `publish_scheduler` in the ESPHome loop
+        TickScheduler scheduler;
+        TickScheduler publish_scheduler;
+        bool scheduler_started = false;
+        bool publish_started = false;
+
+        uint32_t mcu_interval = 200;
+        uint32_t mcu_fast_interval = 100;
+        uint32_t control_interval = 500;
+        uint32_t publish_interval = 500;
+        uint32_t persist_interval = 60000;
+
+        // Publishing
+        bool publish_on_change = true;
+        uint32_t publish_min_interval = 5000;
+        uint32_t publish_fast_interval = 1000;
+        uint32_t publish_max_interval = 60000;
+        uint32_t publish_last = 0;
+        uint32_t heartbeat_last = 0;
+        int16_t published_top = -1;
+        int16_t published_bottom = -1;
+        uint16_t published_top_fine = 0;
+        uint16_t published_bottom_fine = 0;
+        std::optional<uint32_t> published_remaining;
+        bool published_idle = false;
+        uint32_t saved_parameters_reset = 0;
+
+        // Filtered values are sent again once they move this much, Q8.8
+        static const uint16_t FINE_PUBLISH_STEP = 51;  // 0.2 ºC
+
+        uint8_t mcu_task;
+        uint8_t control_task;
+        uint8_t publish_task;
+
+        // Idle mode
+        uint32_t idle_poll_interval = 1000;
+        uint32_t idle_delay = 30000;
+        bool idle = false;
+        uint32_t parameters_reset = 0;
+        uint32_t last_activity = 0;
+        uint32_t key_frames_seen = 0;
+        // Keys repeat in every answer while held
+        uint32_t last_key = 0;
+        static constexpr uint32_t KEY_HOLD_TIME = 1000;
+#ifdef USE_RICECOOKER_LIGHT_SLEEP
+        // Held while not idle and, when idle, from a poll until its answer
+        esp_pm_lock_handle_t pm_lock {nullptr};
+        bool awake = false;
+#endif
+
+        // Panel keys, see PanelMenu
+        PanelMenu menu;
+        bool button_pending = false;
+        uint32_t button_time = 0;
+        uint32_t button_latency = 0;
+        // Digits, rendered before every MCU frame
+        Display screen;
+        // Latched from the program, cleared by the next command for one
+        ProgramError error = ProgramError::NONE;
+
+        // Finish-by schedule, see finish_in()
+        bool scheduled = false;
+        uint32_t deadline = 0;
+        float schedule_margin = 0.1f;
+        uint32_t schedule_min_margin = 5 * 60 * 1000;
+        // A day, finish_at() never needs more
+        static const uint32_t MAX_SCHEDULE = 24 * 60 * 60;
+
+        /*
+            Actual over planned run time. The heating estimates assume full
+            power and the programs modulate near their targets, so plans
+            run short; every run that finishes corrects the next plan.
+        */
+        float plan_ratio = 1.0f;
+        uint8_t plan_runs = 0;
+        uint32_t run_planned = 0;   // s, 0 when the run teaches nothing
+        uint32_t run_started = 0;
+        static constexpr float PLAN_RATIO_MIN = 0.5f;
+        static constexpr float PLAN_RATIO_MAX = 2.0f;
+        // Runs it takes for the ratio to follow a change, roughly
+        static constexpr float PLAN_SMOOTHING = 4.0f;
+
+        // LED1-LED8, the mode LEDs
+        static const int MODE_LEDS = 8;
+        static const uint16_t MODE_LED_MASK = 0xff;
+
+        // State
         bool sleep = false;
 
+        ProgramStorage program_storage;
+        std::vector<const Recipe *> recipes;
         Program* program {nullptr};
+        // Program::remaining_time() of the last control step, in seconds
+        std::optional<uint32_t> remaining_time;
+        // Between the whole-degree MCU readings and the heater
+        TemperatureFilter top_filter;
+        TemperatureFilter bottom_filter;
+        uint32_t filtered_frames = 0;
+
         Heater heater;
+        ParameterStore parameter_store;
+
+        // See set_resume()
+        CheckpointStore checkpoint_store;
+        Checkpoint checkpoint {};
+        bool checkpoint_taken = false;
+        Checkpoint resume_checkpoint {};
+        bool resume_pending = false;
+        bool resume_enabled = true;
+        uint8_t resume_max_drift = 15;
+        UARTTransport uart_transport {this};
         MCUCommunicator* mcu_communicator;
 };
 }
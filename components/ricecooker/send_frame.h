@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "crc16.h"
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    Frames sent from the ESP32 to the MCU: header 0x55, length 0x07, the
+    control byte, four display digits, two LED bytes and the CRC of bytes 1..8.
+*/
+
+static constexpr uint8_t SEND_HEADER = 0x55;
+static constexpr uint8_t SEND_COMMAND_LENGTH = 0x07;
+static constexpr size_t SEND_LENGTH = 11;
+
+using SendFrame = std::array<uint8_t, SEND_LENGTH>;
+
+/* Writes the CRC of bytes 1..8 into bytes 9 and 10. */
+constexpr void seal_send_frame(uint8_t *frame) {
+    uint16_t crc = crc16(frame + 1, SEND_LENGTH - 3);
+    frame[SEND_LENGTH - 2] = (crc >> 8) & 0xFF;
+    frame[SEND_LENGTH - 1] = crc & 0xFF;
+}
+
+constexpr SendFrame make_send_frame(
+    uint8_t control,
+    uint8_t digit0, uint8_t digit1, uint8_t digit2, uint8_t digit3,
+    uint8_t leds_low, uint8_t leds_high
+) {
+    SendFrame frame {
+        SEND_HEADER, SEND_COMMAND_LENGTH,
+        control,
+        digit0, digit1, digit2, digit3,
+        leds_low, leds_high,
+        0, 0
+    };
+    seal_send_frame(frame.data());
+    return frame;
+}
+
+// Captured from the stock firmware
+static_assert(make_send_frame(0x10, 0xff, 0xff, 0xff, 0xff, 0x1f, 0x1f)[9] == 0x8a
+    && make_send_frame(0x10, 0xff, 0xff, 0xff, 0xff, 0x1f, 0x1f)[10] == 0x20,
+    "CRC16/XMODEM does not match the captured frame");
+
+} // namespace ricecooker
+} // namespace esphome
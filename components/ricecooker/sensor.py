@@ -1,8 +1,22 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import sensor
-from esphome.const import CONF_ID, UNIT_CELSIUS, ICON_THERMOMETER
-from . import RiceCooker, ricecooker_ns
+from esphome.components import sensor, time
+from esphome.const import (
+    CONF_ID,
+    CONF_TIME_ID,
+    DEVICE_CLASS_DURATION,
+    DEVICE_CLASS_TIMESTAMP,
+    UNIT_MINUTE,
+    UNIT_CELSIUS,
+    UNIT_MILLISECOND,
+    UNIT_SECOND,
+    ICON_COUNTER,
+    STATE_CLASS_TOTAL_INCREASING,
+    ICON_THERMOMETER,
+    ICON_TIMER,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+)
+from . import MCUCommunicator, RiceCooker, ricecooker_ns
 
 DEPENDENCIES = ["ricecooker"]
 
@@ -10,13 +24,134 @@ CONF_RICECOOKER_ID = "ricecooker_id"
 
 CONF_SENSOR_TEMP_TOP = "top_temperature_sensor"
 CONF_SENSOR_TEMP_BOTTOM = "bottom_temperature_sensor"
+CONF_SENSOR_TICK_JITTER = "tick_jitter_sensor"
+CONF_SENSOR_TEMP_TOP_FILTERED = "filtered_top_temperature_sensor"
+CONF_SENSOR_TEMP_BOTTOM_FILTERED = "filtered_bottom_temperature_sensor"
+CONF_SENSOR_TEMP_BOTTOM_RATE = "bottom_temperature_rate_sensor"
+CONF_SENSOR_RELAY_CYCLES = "relay_cycles_sensor"
+CONF_SENSOR_RELAY_ON_TIME = "relay_on_time_sensor"
+CONF_SENSOR_REMAINING_TIME = "remaining_time_sensor"
+CONF_SENSOR_COMPLETION_TIME = "completion_time_sensor"
+CONF_SENSOR_BUTTON_LATENCY = "button_latency_sensor"
+CONF_LINK = "link"
+CONF_PROFILER = "profiler"
+CONF_PUBLISH = "publish"
+CONF_MODE = "mode"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
+CONF_FAST_INTERVAL = "fast_interval"
+CONF_BUDGET = "budget"
+
+UNIT_MICROSECOND = "µs"
+UNIT_CELSIUS_PER_MINUTE = "°C/min"
+
+Profiler = ricecooker_ns.class_("Profiler")
+ProfilerSection = Profiler.enum("Section", is_class=True)
+ProfilerStat = Profiler.enum("Stat", is_class=True)
+
+PROFILER_SECTIONS = {
+    "loop": ProfilerSection.LOOP,
+    "mcu_send": ProfilerSection.MCU_SEND,
+    "mcu_receive": ProfilerSection.MCU_RECEIVE,
+    "program_step": ProfilerSection.PROGRAM_STEP,
+    "heater_step": ProfilerSection.HEATER_STEP,
+}
+
+LinkStat = MCUCommunicator.enum("LinkStat", is_class=True)
+
+LINK_COUNTERS = {
+    "frames_sent": LinkStat.SENT,
+    "frames_valid": LinkStat.VALID,
+    "crc_errors": LinkStat.CRC_ERRORS,
+    "resyncs": LinkStat.RESYNCS,
+    "timeouts": LinkStat.TIMEOUTS,
+    "retransmits": LinkStat.RETRANSMITS,
+}
+
+LINK_LATENCIES = {
+    "latency": LinkStat.LATENCY,
+    "max_latency": LinkStat.MAX_LATENCY,
+}
+
+# Published with the heartbeat, max_latency is the worst since the last one
+LINK_SCHEMA = cv.Schema({
+    **{
+        cv.Optional(stat): sensor.sensor_schema(
+            sensor.Sensor,
+            icon=ICON_COUNTER,
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        )
+        for stat in LINK_COUNTERS
+    },
+    **{
+        cv.Optional(stat): sensor.sensor_schema(
+            sensor.Sensor,
+            unit_of_measurement=UNIT_MILLISECOND,
+            icon=ICON_TIMER,
+            accuracy_decimals=0,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        )
+        for stat in LINK_LATENCIES
+    },
+})
+
+PUBLISH_SCHEMA = cv.Schema({
+    cv.Optional(CONF_MODE, default="on_change"): cv.one_of("on_change", "always", lower=True),
+    cv.Optional(CONF_MIN_INTERVAL, default="5s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_FAST_INTERVAL, default="1s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_MAX_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+})
+
+PROFILER_STATS = {
+    "min": ProfilerStat.MIN,
+    "avg": ProfilerStat.AVG,
+    "max": ProfilerStat.MAX,
+    "p99": ProfilerStat.P99,
+    "overruns": ProfilerStat.OVERRUNS,
+}
+
+
+def profiler_stat_schema(stat):
+    if stat == "overruns":
+        return sensor.sensor_schema(
+            sensor.Sensor,
+            icon=ICON_TIMER,
+            accuracy_decimals=0,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        )
+    return sensor.sensor_schema(
+        sensor.Sensor,
+        unit_of_measurement=UNIT_MICROSECOND,
+        icon=ICON_TIMER,
+        accuracy_decimals=0,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    )
+
+
+PROFILER_SECTION_SCHEMA = cv.Schema({
+    cv.Optional(CONF_BUDGET): cv.positive_time_period_microseconds,
+    **{cv.Optional(stat): profiler_stat_schema(stat) for stat in PROFILER_STATS},
+})
+
+PROFILER_SCHEMA = cv.Schema({
+    cv.Optional(section): PROFILER_SECTION_SCHEMA for section in PROFILER_SECTIONS
+})
+
+
+def validate_completion_time(config):
+    if CONF_SENSOR_COMPLETION_TIME in config and CONF_TIME_ID not in config:
+        raise cv.Invalid(f"{CONF_SENSOR_COMPLETION_TIME} needs {CONF_TIME_ID}")
+    return config
 
 
 # RiceCookerSensor = ricecooker_ns.class_(
 #     "RiceCookerSensor", cg.PollingComponent
 # )
 
-CONFIG_SCHEMA = cv.Schema(
+
+CONFIG_SCHEMA = cv.All(cv.Schema(
     {
         cv.Required(CONF_RICECOOKER_ID): cv.use_id(RiceCooker),
         
@@ -32,8 +167,92 @@ CONFIG_SCHEMA = cv.Schema(
             unit_of_measurement=UNIT_CELSIUS,
             icon=ICON_THERMOMETER,
             accuracy_decimals=0,
-        ).extend(),         
-    }).extend(cv.polling_component_schema("5s"))
+        ).extend(),
+
+        # Sub-degree values from the temperature filter the heater uses
+        cv.Optional(CONF_SENSOR_TEMP_TOP_FILTERED): sensor.sensor_schema(
+            sensor.Sensor,
+            unit_of_measurement=UNIT_CELSIUS,
+            icon=ICON_THERMOMETER,
+            accuracy_decimals=1,
+        ),
+
+        cv.Optional(CONF_SENSOR_TEMP_BOTTOM_FILTERED): sensor.sensor_schema(
+            sensor.Sensor,
+            unit_of_measurement=UNIT_CELSIUS,
+            icon=ICON_THERMOMETER,
+            accuracy_decimals=1,
+        ),
+
+        cv.Optional(CONF_SENSOR_TEMP_BOTTOM_RATE): sensor.sensor_schema(
+            sensor.Sensor,
+            unit_of_measurement=UNIT_CELSIUS_PER_MINUTE,
+            icon=ICON_THERMOMETER,
+            accuracy_decimals=1,
+        ),
+
+        # Relay wear, counted since boot
+        cv.Optional(CONF_SENSOR_RELAY_CYCLES): sensor.sensor_schema(
+            sensor.Sensor,
+            icon=ICON_COUNTER,
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+
+        cv.Optional(CONF_SENSOR_RELAY_ON_TIME): sensor.sensor_schema(
+            sensor.Sensor,
+            unit_of_measurement=UNIT_SECOND,
+            icon=ICON_TIMER,
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+
+        # Program ETA, recomputed every control step
+        cv.Optional(CONF_SENSOR_REMAINING_TIME): sensor.sensor_schema(
+            sensor.Sensor,
+            unit_of_measurement=UNIT_MINUTE,
+            icon=ICON_TIMER,
+            accuracy_decimals=0,
+            device_class=DEVICE_CLASS_DURATION,
+        ),
+
+        # Needs a wall clock, `time_id`
+        cv.Optional(CONF_SENSOR_COMPLETION_TIME): sensor.sensor_schema(
+            sensor.Sensor,
+            icon=ICON_TIMER,
+            accuracy_decimals=0,
+            device_class=DEVICE_CLASS_TIMESTAMP,
+        ),
+
+        cv.Optional(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
+
+        cv.Optional(CONF_SENSOR_TICK_JITTER): sensor.sensor_schema(
+            sensor.Sensor,
+            unit_of_measurement=UNIT_MILLISECOND,
+            icon=ICON_TIMER,
+            accuracy_decimals=0,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+
+        # Panel key to display frame, worst per heartbeat
+        cv.Optional(CONF_SENSOR_BUTTON_LATENCY): sensor.sensor_schema(
+            sensor.Sensor,
+            unit_of_measurement=UNIT_MILLISECOND,
+            icon=ICON_TIMER,
+            accuracy_decimals=0,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+
+        cv.Optional(CONF_LINK): LINK_SCHEMA,
+
+        cv.Optional(CONF_PUBLISH, default={}): PUBLISH_SCHEMA,
+
+        cv.Optional(CONF_PROFILER): PROFILER_SCHEMA,
+    }).extend(cv.polling_component_schema("5s")),
+    validate_completion_time,
+)
 
 
 async def to_code(config):
@@ -53,4 +272,68 @@ async def to_code(config):
         cg.add(paren.set_sensor_temp_bottom(sens))
         
         #await sensor.register_sensor(var, config[CONF_SENSOR_TEMP_BOTTOM])
-        #cg.add(paren.register_sensor(var))
\ No newline at end of file
+        #cg.add(paren.register_sensor(var))
+
+    if CONF_SENSOR_TEMP_TOP_FILTERED in config:
+        sens = await sensor.new_sensor(config[CONF_SENSOR_TEMP_TOP_FILTERED])
+        cg.add(paren.set_sensor_temp_top_filtered(sens))
+
+    if CONF_SENSOR_TEMP_BOTTOM_FILTERED in config:
+        sens = await sensor.new_sensor(config[CONF_SENSOR_TEMP_BOTTOM_FILTERED])
+        cg.add(paren.set_sensor_temp_bottom_filtered(sens))
+
+    if CONF_SENSOR_TEMP_BOTTOM_RATE in config:
+        sens = await sensor.new_sensor(config[CONF_SENSOR_TEMP_BOTTOM_RATE])
+        cg.add(paren.set_sensor_temp_bottom_rate(sens))
+
+    if CONF_SENSOR_RELAY_CYCLES in config:
+        sens = await sensor.new_sensor(config[CONF_SENSOR_RELAY_CYCLES])
+        cg.add(paren.set_sensor_relay_cycles(sens))
+
+    if CONF_SENSOR_RELAY_ON_TIME in config:
+        sens = await sensor.new_sensor(config[CONF_SENSOR_RELAY_ON_TIME])
+        cg.add(paren.set_sensor_relay_on_time(sens))
+
+    if CONF_SENSOR_REMAINING_TIME in config:
+        sens = await sensor.new_sensor(config[CONF_SENSOR_REMAINING_TIME])
+        cg.add(paren.set_sensor_remaining_time(sens))
+
+    if CONF_SENSOR_COMPLETION_TIME in config:
+        cg.add_define("USE_RICECOOKER_CLOCK")
+        clock = await cg.get_variable(config[CONF_TIME_ID])
+        cg.add(paren.set_clock(clock))
+        sens = await sensor.new_sensor(config[CONF_SENSOR_COMPLETION_TIME])
+        cg.add(paren.set_sensor_completion_time(sens))
+
+    publish = config[CONF_PUBLISH]
+    cg.add(paren.set_publish_on_change(publish[CONF_MODE] == "on_change"))
+    cg.add(paren.set_publish_min_interval(publish[CONF_MIN_INTERVAL]))
+    cg.add(paren.set_publish_fast_interval(publish[CONF_FAST_INTERVAL]))
+    cg.add(paren.set_publish_max_interval(publish[CONF_MAX_INTERVAL]))
+
+    if CONF_SENSOR_TICK_JITTER in config:
+        sens = await sensor.new_sensor(config[CONF_SENSOR_TICK_JITTER])
+        cg.add(paren.set_sensor_tick_jitter(sens))
+
+    if CONF_SENSOR_BUTTON_LATENCY in config:
+        sens = await sensor.new_sensor(config[CONF_SENSOR_BUTTON_LATENCY])
+        cg.add(paren.set_sensor_button_latency(sens))
+
+    if CONF_LINK in config:
+        for stat, stat_enum in {**LINK_COUNTERS, **LINK_LATENCIES}.items():
+            if stat in config[CONF_LINK]:
+                sens = await sensor.new_sensor(config[CONF_LINK][stat])
+                cg.add(paren.set_link_sensor(stat_enum, sens))
+
+    if CONF_PROFILER in config:
+        cg.add_define("USE_RICECOOKER_PROFILER")
+
+        for section, section_config in config[CONF_PROFILER].items():
+            if CONF_BUDGET in section_config:
+                cg.add(paren.set_profiler_budget(
+                    PROFILER_SECTIONS[section], section_config[CONF_BUDGET]))
+
+            for stat, stat_enum in PROFILER_STATS.items():
+                if stat in section_config:
+                    sens = await sensor.new_sensor(section_config[stat])
+                    cg.add(paren.set_profiler_sensor(PROFILER_SECTIONS[section], stat_enum, sens))
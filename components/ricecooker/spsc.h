@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    Latest-value exchange between one producer and one consumer, lock free.
+
+    Triple buffering: the producer writes into its own buffer and swaps it
+    with the middle one, the consumer swaps the middle one with its own
+    when it is fresh. Neither side ever waits or sees a half written value;
+    the consumer skips values it was too slow to read.
+*/
+template<typename T>
+class SnapshotBuffer {
+public:
+    /* Producer side. */
+    void write(const T &value) {
+        buffers[back] = value;
+        uint8_t previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & INDEX;
+    }
+
+    /*
+        Consumer side: the latest value written, or the one returned last
+        time if nothing new came. Valid until the next read().
+    */
+    const T &read() {
+        if (middle.load(std::memory_order_relaxed) & FRESH) {
+            uint8_t previous = middle.exchange(front, std::memory_order_acq_rel);
+            front = previous & INDEX;
+        }
+        return buffers[front];
+    }
+
+private:
+    static const uint8_t INDEX = 0b011;
+    static const uint8_t FRESH = 0b100;
+
+    T buffers[3] {};
+    std::atomic<uint8_t> middle {1};
+    uint8_t back = 0;   // producer's
+    uint8_t front = 2;  // consumer's
+};
+
+/*
+    Bounded FIFO between one producer and one consumer, lock free. Holds
+    N - 1 items; push() fails instead of waiting when it is full.
+*/
+template<typename T, size_t N>
+class SpscQueue {
+public:
+    /* Producer side. */
+    bool push(const T &item) {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        size_t next = (head + 1) % N;
+        if (next == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        items[head] = item;
+        this->head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /* Consumer side, false when empty. */
+    bool pop(T &out) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        out = items[tail];
+        this->tail.store((tail + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[N];
+    std::atomic<size_t> head {0};
+    std::atomic<size_t> tail {0};
+};
+
+} // namespace ricecooker
+} // namespace esphome
@@ -0,0 +1,70 @@
+#include "temperature_filter.h"
+
+#include <algorithm>
+
+namespace esphome {
+namespace ricecooker {
+
+void TemperatureFilter::update(uint8_t reading) {
+    int32_t measured = (int32_t) reading << STATE_BITS;
+
+    if (!initialized) {
+        temperature = measured;
+        slope = 0;
+        initialized = true;
+        return;
+    }
+
+    int32_t predicted = temperature + slope;
+    int32_t residual = measured - predicted;
+
+    if (residual > SPIKE_LIMIT || residual < -SPIKE_LIMIT) {
+        if (rejected < SPIKE_SAMPLES) {
+            rejected++;
+            spikes++;
+            temperature = predicted;
+            return;
+        }
+
+        // Confirmed step, start over from it
+        rejected = 0;
+        temperature = measured;
+        slope = 0;
+        return;
+    }
+
+    rejected = 0;
+
+    // Arithmetic shifts: negative residuals round towards -inf, the bias
+    // is far below the Q8.8 outputs
+    temperature = predicted + (residual >> ALPHA_SHIFT);
+    slope += residual >> BETA_SHIFT;
+}
+
+void TemperatureFilter::set_sample_period(uint32_t period) {
+    if (initialized && sample_period != 0) {
+        // Same ºC per minute, in the new samples
+        slope = (int32_t) ((int64_t) slope * period / sample_period);
+    }
+    sample_period = period;
+}
+
+uint16_t TemperatureFilter::get_temperature() const {
+    int32_t value = temperature >> (STATE_BITS - FRACTION_BITS);
+    return (uint16_t) std::clamp<int32_t>(value, 0, UINT16_MAX);
+}
+
+int16_t TemperatureFilter::get_rate() const {
+    // slope is per sample, Q16.16 -> per minute Q8.8
+    int64_t per_minute = (int64_t) slope * (60000 / std::max<uint32_t>(sample_period, 1));
+    int64_t value = per_minute >> (STATE_BITS - FRACTION_BITS);
+    return (int16_t) std::clamp<int64_t>(value, INT16_MIN, INT16_MAX);
+}
+
+uint8_t TemperatureFilter::get_rounded() const {
+    uint32_t value = ((uint32_t) get_temperature() + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS;
+    return (uint8_t) std::min<uint32_t>(value, UINT8_MAX);
+}
+
+} // namespace ricecooker
+} // namespace esphome
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    Sub-degree temperature and slope from the whole-degree MCU readings.
+
+    An alpha-beta filter (the steady state of a two-state Kalman filter) in
+    fixed point, fed once per received frame. Gains are powers of two, so an
+    update is a few adds and shifts. Outputs are Q8.8, 256 = 1 ºC.
+
+    A reading more than SPIKE_LIMIT away from the prediction is ignored. If
+    it is confirmed by SPIKE_SAMPLES readings in a row it is a real step
+    (lid opened, probe reconnected) and the filter restarts from it.
+*/
+class TemperatureFilter {
+public:
+    static const int FRACTION_BITS = 8;
+
+    /*
+        Period between readings, converts the slope to ºC per minute. The
+        poll rate changes at run time, the slope tracked so far is rescaled.
+    */
+    void set_sample_period(uint32_t period);
+
+    void update(uint8_t reading);
+    void reset() { initialized = false; rejected = 0; }
+
+    /* Q8.8 ºC. */
+    uint16_t get_temperature() const;
+    /* Q8.8 ºC per minute. */
+    int16_t get_rate() const;
+    /* Filtered temperature rounded to whole degrees. */
+    uint8_t get_rounded() const;
+
+    uint32_t get_spikes() const { return spikes; }
+
+private:
+    // Internal state is Q16.16, outputs drop to Q8.8
+    static const int STATE_BITS = 16;
+    static const int ALPHA_SHIFT = 4;  // alpha = 1/16
+    static const int BETA_SHIFT = 9;   // beta = 1/512 ~ alpha^2 / (2 - alpha)
+    static const int32_t SPIKE_LIMIT = 4 << STATE_BITS;
+    static const uint8_t SPIKE_SAMPLES = 3;
+
+    int32_t temperature = 0;  // Q16.16 ºC
+    int32_t slope = 0;        // Q16.16 ºC per sample
+    bool initialized = false;
+    uint8_t rejected = 0;
+
+    uint32_t sample_period = 100;
+    uint32_t spikes = 0;
+};
+
+} // namespace ricecooker
+} // namespace esphome
@@ -0,0 +1,82 @@
+#include "tick_scheduler.h"
+
+#include <algorithm>
+
+namespace esphome {
+namespace ricecooker {
+
+uint8_t TickScheduler::add(const char *name, uint32_t period, uint32_t phase, Callback callback) {
+    tasks.push_back(Task{name, period, phase, phase, std::move(callback), 0, 0, 0, 0});
+    return tasks.size() - 1;
+}
+
+void TickScheduler::set_period(uint8_t id, uint32_t period) {
+    tasks[id].period = period;
+}
+
+void TickScheduler::start(uint32_t now) {
+    for (auto &task : tasks) {
+        task.next = now + task.phase;
+    }
+}
+
+void TickScheduler::restart(uint8_t id, uint32_t now) {
+    tasks[id].next = now + tasks[id].phase;
+}
+
+void TickScheduler::run(uint32_t now) {
+    for (auto &task : tasks) {
+        if (!is_due(now, task.next)) {
+            continue;
+        }
+
+        uint32_t lateness = now - task.next;
+        task.runs++;
+        task.lateness_sum += lateness;
+        if (lateness > task.max_lateness) {
+            task.max_lateness = lateness;
+        }
+
+        task.callback();
+
+        // Fixed rate: the next deadline is one period after the previous
+        // one, not after now. If whole periods were missed, skip them but
+        // keep the phase.
+        task.next += task.period;
+        if (is_due(now, task.next)) {
+            uint32_t missed = (now - task.next) / task.period + 1;
+            task.skipped += missed;
+            task.next += missed * task.period;
+        }
+    }
+}
+
+uint32_t TickScheduler::time_to_next(uint32_t now) const {
+    uint32_t wait = UINT32_MAX;
+    for (const auto &task : tasks) {
+        if (is_due(now, task.next)) {
+            return 0;
+        }
+        wait = std::min(wait, task.next - now);
+    }
+    return wait;
+}
+
+float TickScheduler::get_average_lateness(uint8_t id) const {
+    const Task &task = tasks[id];
+    if (task.runs == 0) {
+        return 0.0f;
+    }
+    return (float) task.lateness_sum / task.runs;
+}
+
+void TickScheduler::reset_stats(uint8_t id) {
+    Task &task = tasks[id];
+    task.runs = 0;
+    task.lateness_sum = 0;
+    task.max_lateness = 0;
+    task.skipped = 0;
+}
+
+} // namespace ricecooker
+} // namespace esphome
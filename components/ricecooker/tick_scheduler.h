@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    Fixed-rate scheduler for the cooker's periodic work.
+
+    Every task has its own period and phase offset. Deadlines advance by
+    exactly one period per run, so the loop period does not accumulate as
+    drift, and are compared as a signed difference, which keeps working
+    across the 32-bit millis() wrap (~49 days).
+
+    Lateness (how long after its deadline a task actually ran) is tracked
+    per task as a measure of tick jitter.
+*/
+class TickScheduler {
+public:
+    using Callback = std::function<void()>;
+
+    /* Registers a task and returns its id. The first run is due at `now + phase`. */
+    uint8_t add(const char *name, uint32_t period, uint32_t phase, Callback callback);
+
+    /* Changes the period of a task, keeping its next deadline. */
+    void set_period(uint8_t id, uint32_t period);
+    uint32_t get_period(uint8_t id) const { return tasks[id].period; }
+
+    /* Restarts every task relative to `now`. */
+    void start(uint32_t now);
+
+    /* Brings the next run of a task forward to `now` plus its phase. */
+    void restart(uint8_t id, uint32_t now);
+
+    /* Runs the tasks whose deadline has passed. */
+    void run(uint32_t now);
+
+    /* Milliseconds from `now` until the next deadline, 0 if one is due. */
+    uint32_t time_to_next(uint32_t now) const;
+
+    /* Worst lateness of a task since the last reset_stats(), in ms. */
+    uint32_t get_max_lateness(uint8_t id) const { return tasks[id].max_lateness; }
+    /* Average lateness of a task since the last reset_stats(), in ms. */
+    float get_average_lateness(uint8_t id) const;
+    /* Deadlines a task missed completely since the last reset_stats(). */
+    uint32_t get_skipped(uint8_t id) const { return tasks[id].skipped; }
+
+    void reset_stats(uint8_t id);
+
+    static bool is_due(uint32_t now, uint32_t deadline) { return (int32_t) (now - deadline) >= 0; }
+
+private:
+    struct Task {
+        const char *name;
+        uint32_t period;
+        uint32_t phase;
+        uint32_t next;
+        Callback callback;
+
+        // Statistics
+        uint32_t runs;
+        uint32_t lateness_sum;
+        uint32_t max_lateness;
+        uint32_t skipped;
+    };
+
+    std::vector<Task> tasks;
+};
+
+} // namespace ricecooker
+} // namespace esphome
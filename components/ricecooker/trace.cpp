@@ -0,0 +1,62 @@
+#include "trace.h"
+
+#include "esphome/core/hal.h"
+
+namespace esphome {
+namespace ricecooker {
+
+Trace global_trace;
+
+void Trace::record(TraceEvent event, uint8_t argc, int32_t a0, int32_t a1, int32_t a2, int32_t a3) {
+    size_t index = (head + count) % CAPACITY;
+
+    if (count == CAPACITY) {
+        // Overwrite the oldest record
+        head = (head + 1) % CAPACITY;
+        lost++;
+    } else {
+        count++;
+    }
+
+    Record &r = records[index];
+    r.timestamp = millis();
+    r.event = (uint8_t) event;
+    r.argc = argc;
+    r.args[0] = a0;
+    r.args[1] = a1;
+    r.args[2] = a2;
+    r.args[3] = a3;
+}
+
+bool Trace::pop(Record &out) {
+    if (count == 0) {
+        return false;
+    }
+
+    out = records[head];
+    head = (head + 1) % CAPACITY;
+    count--;
+    return true;
+}
+
+static size_t put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+    return 4;
+}
+
+size_t Trace::encode(const Record &record, uint8_t *out) {
+    size_t n = put_u32(out, record.timestamp);
+    out[n++] = record.event;
+    out[n++] = record.argc;
+
+    for (uint8_t i = 0; i < record.argc && i < MAX_ARGS; i++) {
+        n += put_u32(out + n, (uint32_t) record.args[i]);
+    }
+    return n;
+}
+
+} // namespace ricecooker
+} // namespace esphome
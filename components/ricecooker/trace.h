@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace ricecooker {
+
+/*
+    Control loop trace events.
+
+    Only the event id and raw integer arguments are stored on the device,
+    format strings live in tools/trace_decode.py. Append new events at the
+    end and keep the decoder in sync.
+*/
+enum class TraceEvent : uint8_t {
+    HEATER_POWER = 0,   // power
+    HEATER_ESTIMATE,    // error ms/ºC, diff ºC
+    HEATER_ON,          // on time ms, thermal mass ms/ºC
+    HEATER_HOLD,        // power remaining ms, power waiting ms, thermal mass ms/ºC
+    KEEPWARM_STEP,      // stage, top ºC, bottom ºC, target ºC
+    RICE_STEP,          // stage, top ºC, bottom ºC, target ºC
+    RECIPE_STEP,        // stage index (-1 waiting), top ºC, bottom ºC, target ºC
+    HEATER_PREDICT,     // predicted peak ºC x10, aim ºC x10, heat gain mºC per sample, duty x1000
+    RELAY_WINDOW,       // planned on time ms, carried on time ms, cycle tokens
+};
+
+/*
+    Fixed-size ring of trace records. When full the oldest records are
+    overwritten and counted as lost.
+
+    Not thread safe: on the device only the control task records and
+    drains it.
+*/
+class Trace {
+public:
+    static const size_t CAPACITY = 128;
+    static const uint8_t MAX_ARGS = 4;
+
+    struct Record {
+        uint32_t timestamp;
+        uint8_t event;
+        uint8_t argc;
+        int32_t args[MAX_ARGS];
+    };
+
+    void record(TraceEvent event, uint8_t argc, int32_t a0 = 0, int32_t a1 = 0, int32_t a2 = 0, int32_t a3 = 0);
+
+    /* Number of records waiting to be drained. */
+    size_t size() const { return count; }
+
+    /* Records overwritten before they were drained. */
+    uint32_t get_lost() const { return lost; }
+
+    /* Removes the oldest record into `out`; false when empty. */
+    bool pop(Record &out);
+
+    /*
+        Serializes a record as little-endian bytes:
+        timestamp (4), event (1), argc (1), args (4 each, argc of them).
+        Returns the number of bytes written, `out` must hold ENCODED_MAX.
+    */
+    static size_t encode(const Record &record, uint8_t *out);
+    static const size_t ENCODED_MAX = 6 + 4 * MAX_ARGS;
+
+    void clear() { head = 0; count = 0; lost = 0; }
+
+private:
+    Record records[CAPACITY];
+    size_t head = 0;
+    size_t count = 0;
+    uint32_t lost = 0;
+};
+
+extern Trace global_trace;
+
+inline void trace(TraceEvent event) {
+    global_trace.record(event, 0);
+}
+
+inline void trace(TraceEvent event, int32_t a0) {
+    global_trace.record(event, 1, a0);
+}
+
+inline void trace(TraceEvent event, int32_t a0, int32_t a1) {
+    global_trace.record(event, 2, a0, a1);
+}
+
+inline void trace(TraceEvent event, int32_t a0, int32_t a1, int32_t a2) {
+    global_trace.record(event, 3, a0, a1, a2);
+}
+
+inline void trace(TraceEvent event, int32_t a0, int32_t a1, int32_t a2, int32_t a3) {
+    global_trace.record(event, 4, a0, a1, a2, a3);
+}
+
+} // namespace ricecooker
+} // namespace esphome
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "esphome/components/uart/uart.h"
+
+#include "mcu_transport.h"
+
+namespace esphome {
+namespace ricecooker {
+
+/* MCUTransport over an ESPHome UART. */
+class UARTTransport : public MCUTransport {
+public:
+    explicit UARTTransport(uart::UARTDevice *device) : device(device) {}
+
+    size_t available() override { return device->available(); }
+    bool read(uint8_t *data, size_t len) override { return device->read_array(data, len); }
+    void write(const uint8_t *data, size_t len) override { device->write_array(data, len); }
+
+private:
+    uart::UARTDevice *device;
+};
+
+} // namespace ricecooker
+} // namespace esphome
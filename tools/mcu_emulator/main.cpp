@@ -0,0 +1,187 @@
+/*
+    The MCU emulator on its own, in real time: opens a pseudo-terminal,
+    prints the path of its serial port and answers whatever speaks the
+    MCU protocol on it, e.g. a host build of the component or a serial
+    terminal. The display and LEDs are printed as they change; keys are
+    typed on stdin.
+
+    See README.md, "MCU emulator", for build and usage.
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+
+#include "mcu_emulator.h"
+#include "pty.h"
+
+using mcu_emulator::Faults;
+using mcu_emulator::FdTransport;
+using mcu_emulator::MCUEmulator;
+using mcu_emulator::Panel;
+using mcu_emulator::Pty;
+using ricecooker_sim::PlantConfig;
+using ricecooker_sim::ThermalPlant;
+
+static const uint32_t STEP = 1;
+static const uint32_t PLANT_STEP = 50;
+
+struct Options {
+    const char *link = nullptr;
+    uint32_t answer_delay = 5;
+    Faults faults;
+    PlantConfig plant;
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  --link=PATH          symlink to the serial port, e.g. /tmp/ttyMCU\n"
+        "  --answer-delay=MS    command to answer (default 5)\n"
+        "  --corrupt=P --drop=P --silence=P --seed=N  line faults, chance per answer\n"
+        "  --ambient=C --water=KG --power=W           the pot\n"
+        "\n"
+        "Keys on stdin, one per line, held 200 ms or the time given:\n"
+        "  timer|cancel|select|start [MS]\n",
+        argv0);
+}
+
+static bool parse_args(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+
+        auto eq = arg.find('=');
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        }
+
+        const char *v = value.c_str();
+
+        if (arg == "--link") options.link = argv[i] + strlen("--link=");
+        else if (arg == "--answer-delay") options.answer_delay = strtoul(v, nullptr, 10);
+        else if (arg == "--corrupt") options.faults.corrupt = atof(v);
+        else if (arg == "--drop") options.faults.drop = atof(v);
+        else if (arg == "--silence") options.faults.silence = atof(v);
+        else if (arg == "--seed") options.faults.seed = strtoul(v, nullptr, 10);
+        else if (arg == "--ambient") options.plant.ambient = options.plant.initial_temperature = atof(v);
+        else if (arg == "--water") options.plant.water_mass = atof(v);
+        else if (arg == "--power") options.plant.element_power = atof(v);
+        else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint32_t now_ms() {
+    auto since = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(since).count();
+}
+
+// "start", "cancel 1500", ...
+static void handle_line(const char *line, MCUEmulator &emulator, uint32_t now) {
+    static const char *const KEYS[] = {"timer", "cancel", "select", "start"};
+
+    char name[16];
+    unsigned hold = 200;
+    if (sscanf(line, "%15s %u", name, &hold) < 1) {
+        return;
+    }
+    for (int key = 0; key < 4; key++) {
+        if (strcmp(name, KEYS[key]) == 0) {
+            emulator.press(1 << key, now, hold);
+            printf("%s held %u ms\n", name, hold);
+            fflush(stdout);
+            return;
+        }
+    }
+    printf("unknown key \"%s\", one of timer, cancel, select, start\n", name);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    Options options;
+
+    if (!parse_args(argc, argv, options)) {
+        return 2;
+    }
+
+    Pty pty;
+    if (!pty.open()) {
+        perror("pty");
+        return 2;
+    }
+    if (options.link != nullptr) {
+        unlink(options.link);
+        if (symlink(pty.slave_path.c_str(), options.link) != 0) {
+            perror(options.link);
+            return 2;
+        }
+    }
+
+    // The slave stays open here too, clients can come and go
+    printf("MCU on %s%s%s, 9600 8N1\n", pty.slave_path.c_str(),
+        options.link != nullptr ? " linked from " : "", options.link != nullptr ? options.link : "");
+    fflush(stdout);
+
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+    FdTransport port(pty.master);
+    ThermalPlant plant(options.plant);
+    MCUEmulator emulator(&port, &plant);
+    emulator.set_faults(options.faults);
+    emulator.set_answer_delay(options.answer_delay);
+
+    const uint32_t start = now_ms();
+    uint32_t plant_time = start;
+    Panel shown;
+    std::string input;
+
+    for (;;) {
+        uint32_t now = now_ms();
+
+        while ((int32_t) (now - plant_time) >= (int32_t) PLANT_STEP) {
+            plant.step(PLANT_STEP / 1000.0, emulator.get_relay());
+            plant_time += PLANT_STEP;
+        }
+
+        emulator.step(now);
+
+        if (emulator.get_panel() != shown) {
+            shown = emulator.get_panel();
+            printf("[%8.1f s] %s  (bottom %.1f ºC, top %.1f ºC)\n", (now - start) / 1000.0,
+                shown.describe().c_str(), plant.get_bottom(), plant.get_top());
+            fflush(stdout);
+        }
+
+        char chunk[64];
+        ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n == 0) {
+            // stdin closed, keep serving the port
+            close(STDIN_FILENO);
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (chunk[i] == '\n') {
+                handle_line(input.c_str(), emulator, now);
+                input.clear();
+            } else {
+                input += chunk[i];
+            }
+        }
+
+        // Commands wake us early, answers go out on the millisecond
+        pollfd readable = {pty.master, POLLIN, 0};
+        poll(&readable, 1, STEP);
+    }
+}
@@ -0,0 +1,251 @@
+#include "mcu_emulator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "ricecooker/crc16.h"
+#include "ricecooker/display.h"
+
+namespace mcu_emulator {
+
+using esphome::ricecooker::crc16;
+using esphome::ricecooker::glyph;
+
+// Command frame bytes, see MCUCommunicator
+static const uint8_t CONTROL_ON = 0b00000001;
+static const uint8_t CONTROL_POWER = 0b00000100;
+static const uint8_t CONTROL_BEEP = 0b00010000;
+static const uint8_t CONTROL_SLEEP = 0b00100000;
+
+static const uint8_t SEGMENTS[] = {
+    0b00111111, 0b00000110, 0b01011011, 0b01001111, 0b01100110,
+    0b01101101, 0b01111101, 0b00000111, 0b01111111, 0b01101111,
+};
+static const uint8_t SEGMENT_DOT = 0b10000000;
+
+static char decode_digit(uint8_t segments) {
+    segments &= ~SEGMENT_DOT;
+    if (segments == 0) {
+        return ' ';
+    }
+    for (int digit = 0; digit < 10; digit++) {
+        if (SEGMENTS[digit] == segments) {
+            return '0' + digit;
+        }
+    }
+    // Text pages, the first character with that shape
+    for (char c = 'A'; c <= 'z'; c++) {
+        if (glyph(c) == segments) {
+            return c;
+        }
+    }
+    if (segments == glyph('-')) return '-';
+    if (segments == glyph('*')) return '*';
+    return '?';
+}
+
+bool Panel::operator==(const Panel &other) const {
+    return on == other.on && power == other.power && beep == other.beep && sleep == other.sleep
+        && strcmp(digits, other.digits) == 0 && dots == other.dots && leds == other.leds;
+}
+
+std::string Panel::describe() const {
+    std::string text;
+    text += digits[0];
+    text += digits[1];
+    if (dots) text += ':';
+    text += digits[2];
+    text += digits[3];
+
+    if (power) text += " relay";
+    if (beep) text += " beep";
+    if (sleep) text += " sleep";
+    if (!on) text += " off";
+
+    static const char *const LED_NAMES[] = {
+        "LED1", "LED2", "LED3", "LED4", "LED5", "LED6", "LED7", "LED8", "LED9o", "LED9b",
+    };
+    for (int led = 0; led < 10; led++) {
+        if (leds & (1 << led)) {
+            text += ' ';
+            text += LED_NAMES[led];
+        }
+    }
+    return text;
+}
+
+void MCUEmulator::set_faults(const Faults &faults) {
+    this->faults = faults;
+    rng.seed(faults.seed);
+}
+
+void MCUEmulator::press(uint8_t keys, uint32_t at, uint32_t duration) {
+    presses.push_back({keys, at, duration});
+}
+
+uint8_t MCUEmulator::keys_held(uint32_t now) {
+    uint8_t keys = 0;
+    for (const Press &press : presses) {
+        if (now - press.at < press.duration) {
+            keys |= press.keys;
+        }
+    }
+
+    // Presses over for good are forgotten, the list stays short on a long soak
+    presses.erase(std::remove_if(presses.begin(), presses.end(), [now](const Press &press) {
+        int32_t since = now - press.at;
+        return since >= 0 && (uint32_t) since >= press.duration;
+    }), presses.end());
+
+    return keys;
+}
+
+void MCUEmulator::step(uint32_t now) {
+    receive(now);
+    send_due(now);
+}
+
+uint32_t MCUEmulator::next_event(uint32_t now) const {
+    if (!outgoing.empty()) {
+        uint32_t at = outgoing.front().at;
+        return (int32_t) (at - now) <= 0 ? now : at;
+    }
+    return now + 1000;
+}
+
+void MCUEmulator::restart(bool power_lost) {
+    uint8_t chunk[64];
+    while (size_t available = port->available()) {
+        if (!port->read(chunk, std::min(available, sizeof(chunk)))) {
+            break;
+        }
+    }
+    command.clear();
+    outgoing.clear();
+
+    if (power_lost) {
+        panel = Panel();
+        presses.clear();
+        seen_command = false;
+    }
+}
+
+void MCUEmulator::receive(uint32_t now) {
+    uint8_t chunk[64];
+
+    while (size_t available = port->available()) {
+        size_t len = std::min(available, sizeof(chunk));
+        if (!port->read(chunk, len)) {
+            break;
+        }
+        command.insert(command.end(), chunk, chunk + len);
+    }
+
+    // Frames anywhere in the buffer, garbage before a header is skipped
+    for (;;) {
+        auto header = std::find(command.begin(), command.end(), COMMAND_HEADER);
+        command.erase(command.begin(), header);
+        if (command.size() < COMMAND_LENGTH) {
+            return;
+        }
+
+        uint16_t crc = crc16(command.data() + 1, COMMAND_LENGTH - 3);
+        if (command[COMMAND_LENGTH - 2] != (crc >> 8) || command[COMMAND_LENGTH - 1] != (crc & 0xff)) {
+            stats.bad_commands++;
+            command.erase(command.begin());
+            continue;
+        }
+
+        handle_command(command.data(), now);
+        command.erase(command.begin(), command.begin() + COMMAND_LENGTH);
+    }
+}
+
+void MCUEmulator::handle_command(const uint8_t *frame, uint32_t now) {
+    if (seen_command) {
+        stats.max_command_gap = std::max(stats.max_command_gap, now - last_command);
+    }
+    seen_command = true;
+    last_command = now;
+    stats.commands++;
+
+    uint8_t control = frame[2];
+    panel.on = control & CONTROL_ON;
+    panel.power = control & CONTROL_POWER;
+    panel.beep = control & CONTROL_BEEP;
+    panel.sleep = control & CONTROL_SLEEP;
+
+    for (int i = 0; i < 4; i++) {
+        panel.digits[i] = decode_digit(frame[3 + i]);
+    }
+    // The colon is the dot of the two middle digits
+    panel.dots = frame[4] & SEGMENT_DOT;
+
+    panel.leds = (frame[7] & 0x1f) | ((frame[8] & 0x1f) << 5);
+
+    answer(now);
+}
+
+void MCUEmulator::answer(uint32_t now) {
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    if (chance(rng) < faults.silence) {
+        stats.silenced++;
+        return;
+    }
+
+    uint8_t keys = keys_held(now);
+    if (keys != 0) {
+        stats.key_answers++;
+    }
+
+    // Same layout as the README example, {0xaa,0x06,0x80,0x14,0x14,0x00,0x30,0x00,0x2c,0x9a}
+    uint8_t frame[STATUS_LENGTH] = {
+        STATUS_HEADER, 0x06, (uint8_t) (0x80 | keys),
+        plant->read_top(), plant->read_bottom(),
+        0x00, 0x30, 0x00,
+    };
+    uint16_t crc = crc16(frame + 1, STATUS_LENGTH - 3);
+    frame[8] = crc >> 8;
+    frame[9] = crc & 0xff;
+
+    size_t length = STATUS_LENGTH;
+    stats.answers++;
+
+    if (chance(rng) < faults.corrupt) {
+        std::uniform_int_distribution<int> bit(8, STATUS_LENGTH * 8 - 1);
+        int flip = bit(rng);
+        frame[flip / 8] ^= 1 << (flip % 8);
+        stats.corrupted++;
+    } else if (chance(rng) < faults.drop) {
+        std::uniform_int_distribution<size_t> index(0, STATUS_LENGTH - 1);
+        size_t lost = index(rng);
+        memmove(frame + lost, frame + lost + 1, STATUS_LENGTH - lost - 1);
+        length--;
+        stats.dropped++;
+    }
+
+    // After whatever is still going out
+    uint32_t at = now + answer_delay;
+    if (!outgoing.empty() && (int32_t) (outgoing.back().at + BYTE_TIME - at) > 0) {
+        at = outgoing.back().at + BYTE_TIME;
+    }
+    for (size_t i = 0; i < length; i++) {
+        outgoing.push_back({at + (uint32_t) i * BYTE_TIME, frame[i]});
+    }
+}
+
+void MCUEmulator::send_due(uint32_t now) {
+    uint8_t chunk[STATUS_LENGTH * 4];
+    size_t len = 0;
+
+    while (!outgoing.empty() && (int32_t) (now - outgoing.front().at) >= 0 && len < sizeof(chunk)) {
+        chunk[len++] = outgoing.front().value;
+        outgoing.pop_front();
+    }
+    if (len > 0) {
+        port->write(chunk, len);
+    }
+}
+
+} // namespace mcu_emulator
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ricecooker/mcu_transport.h"
+
+#include "thermal_plant.h"
+
+namespace mcu_emulator {
+
+using esphome::ricecooker::MCUTransport;
+using ricecooker_sim::ThermalPlant;
+
+/* What the ESP32 last told the MCU to show, decoded from its frames. */
+struct Panel {
+    bool on = false;
+    bool power = false;     // the relay
+    bool beep = false;
+    bool sleep = false;
+
+    // Four digits, ' ' blank and '?' for a segment pattern the font does not have
+    char digits[5] = "    ";
+    bool dots = false;
+
+    // LED1 in bit 0 up to LED9 blue in bit 9, as MCUCommunicator::led_mask()
+    uint16_t leds = 0;
+
+    bool operator==(const Panel &other) const;
+    bool operator!=(const Panel &other) const { return !(*this == other); }
+
+    /* One line, e.g. "12:34 relay LED2 LED9b" or "Cook LED2". */
+    std::string describe() const;
+};
+
+/*
+    Line faults, each a chance per answer. A corrupted answer has one bit
+    flipped, a short one loses a byte, a silent command gets no answer.
+*/
+struct Faults {
+    double corrupt = 0.0;
+    double drop = 0.0;
+    double silence = 0.0;
+    uint32_t seed = 1;
+};
+
+/*
+    The MCU side of the UART: takes the ESP32's 11 byte 0x55 command
+    frames, switches the relay of a ThermalPlant and shows the display and
+    LEDs they carry, and answers each with a 10 byte 0xAA status frame
+    holding the plant readings and the keys held.
+
+    Answers go out a byte per millisecond, about 9600 baud, so they arrive
+    across several reads as on the device. Everything runs on the clock
+    passed to step(); the owner steps the plant.
+*/
+class MCUEmulator {
+public:
+    MCUEmulator(MCUTransport *port, ThermalPlant *plant) : port(port), plant(plant) {}
+
+    void set_plant(ThermalPlant *plant) { this->plant = plant; }
+    void set_faults(const Faults &faults);
+
+    /* From the end of a command to the first byte of its answer. */
+    void set_answer_delay(uint32_t delay) { answer_delay = delay; }
+
+    /* Holds `keys` (status frame bits, 1 TIMER, 2 CANCEL, 4 SELECT, 8 START) from `at` for `duration` ms. */
+    void press(uint8_t keys, uint32_t at, uint32_t duration);
+
+    /*
+        The ESP32 reset: commands it left in the line and answers on their
+        way are lost. With `power_lost` the MCU lost power too, the relay
+        opens, the panel goes dark and the silence does not count as a gap.
+    */
+    void restart(bool power_lost);
+
+    /* Reads commands, answers them and sends the bytes due by `now`. */
+    void step(uint32_t now);
+
+    /* When step() next has something to do without a new command, `now` + 1 s at most. */
+    uint32_t next_event(uint32_t now) const;
+
+    const Panel &get_panel() const { return panel; }
+    bool get_relay() const { return panel.power; }
+
+    /* Counters since start. */
+    struct Stats {
+        uint32_t commands = 0;      // valid command frames
+        uint32_t bad_commands = 0;  // failed the CRC
+        uint32_t answers = 0;       // started, faults included
+        uint32_t corrupted = 0;
+        uint32_t dropped = 0;
+        uint32_t silenced = 0;
+        uint32_t key_answers = 0;   // answers with a key held
+        uint32_t max_command_gap = 0;   // ms, the longest the ESP32 was silent
+    };
+
+    const Stats &get_stats() const { return stats; }
+
+    static constexpr uint8_t COMMAND_HEADER = 0x55;
+    static constexpr size_t COMMAND_LENGTH = 11;
+    static constexpr uint8_t STATUS_HEADER = 0xaa;
+    static constexpr size_t STATUS_LENGTH = 10;
+
+private:
+    struct Press {
+        uint8_t keys;
+        uint32_t at;
+        uint32_t duration;
+    };
+
+    struct Byte {
+        uint32_t at;
+        uint8_t value;
+    };
+
+    void receive(uint32_t now);
+    void handle_command(const uint8_t *frame, uint32_t now);
+    void answer(uint32_t now);
+    void send_due(uint32_t now);
+    uint8_t keys_held(uint32_t now);
+
+    MCUTransport *port;
+    ThermalPlant *plant;
+
+    uint32_t answer_delay = 5;
+    static const uint32_t BYTE_TIME = 1;
+
+    Faults faults;
+    std::mt19937 rng {1};
+
+    std::vector<uint8_t> command;
+
+    // Answers on their way, each byte with the time it is due
+    std::deque<Byte> outgoing;
+
+    std::vector<Press> presses;
+
+    Panel panel;
+    bool seen_command = false;
+    uint32_t last_command = 0;
+    Stats stats;
+};
+
+} // namespace mcu_emulator
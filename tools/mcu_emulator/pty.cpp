@@ -0,0 +1,101 @@
+#include "pty.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace mcu_emulator {
+
+bool Pty::open() {
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        close();
+        return false;
+    }
+
+    const char *name = ptsname(master);
+    if (name == nullptr) {
+        close();
+        return false;
+    }
+    slave_path = name;
+
+    slave = ::open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (slave < 0) {
+        close();
+        return false;
+    }
+
+    // No echo, no line editing, no CR/LF translation: a plain byte pipe
+    termios attributes;
+    if (tcgetattr(slave, &attributes) != 0) {
+        close();
+        return false;
+    }
+    cfmakeraw(&attributes);
+    cfsetspeed(&attributes, B9600);
+    if (tcsetattr(slave, TCSANOW, &attributes) != 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void Pty::close() {
+    if (slave >= 0) {
+        ::close(slave);
+        slave = -1;
+    }
+    if (master >= 0) {
+        ::close(master);
+        master = -1;
+    }
+}
+
+size_t pending_bytes(int fd) {
+    int pending = 0;
+    if (ioctl(fd, FIONREAD, &pending) != 0) {
+        return 0;
+    }
+    return pending;
+}
+
+size_t FdTransport::available() {
+    return pending_bytes(fd);
+}
+
+bool FdTransport::read(uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::read(fd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+        rx_bytes += n;
+    }
+    return true;
+}
+
+void FdTransport::write(const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EAGAIN) {
+            pollfd writable = {fd, POLLOUT, 0};
+            poll(&writable, 1, 100);
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= n;
+        tx_bytes += n;
+    }
+}
+
+} // namespace mcu_emulator
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ricecooker/mcu_transport.h"
+
+namespace mcu_emulator {
+
+using esphome::ricecooker::MCUTransport;
+
+/*
+    A pseudo-terminal pair in raw mode, both ends non-blocking. The
+    emulator keeps the master; the slave is the "serial port" the ESP32
+    side opens, by path from another process or by fd in the same one.
+*/
+struct Pty {
+    int master = -1;
+    int slave = -1;
+    std::string slave_path;
+
+    bool open();
+    void close();
+};
+
+/* MCUTransport on a file descriptor, counting what goes through. */
+class FdTransport : public MCUTransport {
+public:
+    explicit FdTransport(int fd) : fd(fd) {}
+
+    size_t available() override;
+    bool read(uint8_t *data, size_t len) override;
+    void write(const uint8_t *data, size_t len) override;
+
+    uint64_t get_rx_bytes() const { return rx_bytes; }
+    uint64_t get_tx_bytes() const { return tx_bytes; }
+
+private:
+    int fd;
+    uint64_t rx_bytes = 0;
+    uint64_t tx_bytes = 0;
+};
+
+/* Bytes waiting to be read on `fd`. */
+size_t pending_bytes(int fd);
+
+} // namespace mcu_emulator
@@ -0,0 +1,709 @@
+/*
+    End to end soak test: the real RiceCooker component, built for the
+    host, talks over a pseudo-terminal to the MCU emulator, which answers
+    from the thermal plant. Simulated time runs as fast as the CPU allows,
+    so days of back-to-back cooks and keep warm take minutes.
+
+    Each cycle starts a cook, from the panel keys or as Home Assistant
+    would, waits for the switch to keep warm, keeps warm for a while,
+    clears the program with a long CANCEL and rests idle with a fresh pot.
+    With --finish-in the Home Assistant cooks are scheduled to be ready
+    that much later instead, and must neither heat early nor finish late.
+    With --reboot-at every cook is cut by a reset, or a power loss with
+    --outage, and must resume from its checkpoint when the pot allows.
+    The clock starts an hour short of the millis() wrap.
+
+    Fails (exit code 1) when a cook does not start or finish, keep warm
+    drifts out of its band, the panel LEDs are wrong, the relay closes
+    while idle, the ESP32 stops polling, the link sees errors nobody
+    injected, or the heap keeps growing.
+
+    See README.md, "MCU emulator", for build and usage.
+*/
+
+#include <algorithm>
+#include <cstdarg>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sched.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/uart/uart.h"
+#include "freertos/task.h"
+
+#include "ricecooker/ricecooker.h"
+
+#include "mcu_emulator.h"
+#include "pty.h"
+
+namespace esphome {
+
+static uint32_t soak_millis = 0;
+
+uint32_t millis() { return soak_millis; }
+
+namespace host {
+
+int log_level = 0;
+
+void set_millis(uint32_t now) { soak_millis = now; }
+
+}
+}
+
+using namespace esphome::ricecooker;
+using esphome::sensor::Sensor;
+using esphome::uart::UARTComponent;
+using mcu_emulator::Faults;
+using mcu_emulator::FdTransport;
+using mcu_emulator::MCUEmulator;
+using mcu_emulator::Panel;
+using mcu_emulator::Pty;
+using ricecooker_sim::PlantConfig;
+using ricecooker_sim::ThermalPlant;
+
+// ESPHome runs its loop about this often
+static const uint32_t LOOP_INTERVAL = 16;
+static const uint32_t PLANT_STEP = 50;
+
+// Status frame key bits
+static const uint8_t KEY_CANCEL = 0x02;
+static const uint8_t KEY_START = 0x08;
+
+// Idle, the MCU is polled once a second and a tap in between goes unseen:
+// on an idle panel a key is held until the display answers
+static const uint32_t IDLE_PRESS_TIME = 1200;
+
+// What RiceCooker switches to after a cook, KeepWarm(65, 2)
+static const int KEEP_WARM_TARGET = 65;
+
+// checkpoint: max_drift, the default
+static const int RESUME_MAX_DRIFT = 15;
+// From the reboot until the resumed program must show
+static const uint32_t RESUME_TIME = 15000;
+
+struct Options {
+    double hours = 24.0;
+    uint32_t clock_offset = UINT32_MAX - 3600u * 1000u + 1;
+    double keep_warm_hours = 2.0;
+    double rest_minutes = 30.0;
+    double max_cook_minutes = 90.0;
+    double max_keep_warm_error = 10.0;
+    double finish_in_minutes = 0.0;
+    double max_early_minutes = 15.0;
+    double reboot_at_minutes = 0.0;
+    double outage_seconds = 0.0;
+    size_t max_heap_growth = 64 * 1024;
+    Faults faults;
+    bool panel = false;
+    PlantConfig plant;
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Soak:\n"
+        "  --hours=H               simulated time (default 24)\n"
+        "  --clock-offset=MS       millis() at start (default an hour before the wrap)\n"
+        "  --keep-warm=H           keep warm after each cook (default 2)\n"
+        "  --rest=MIN              idle between cycles (default 30)\n"
+        "\n"
+        "Faults, chance per answer:\n"
+        "  --corrupt=P --drop=P --silence=P --seed=N\n"
+        "\n"
+        "Checks (exit code 1 when exceeded):\n"
+        "  --max-cook=MIN          (default 90)\n"
+        "  --max-keep-warm-error=C bottom sensor off the keep warm target (default 10)\n"
+        "  --max-heap-growth=B     heap growth after the first cycle (default 65536)\n"
+        "  --finish-in=MIN         schedule the API cooks to be ready then (default off)\n"
+        "  --max-early=MIN         ready this much before the deadline at most (default 15)\n"
+        "  --reboot-at=MIN         reset the ESP32 this far into every cook (default off)\n"
+        "  --outage=S              make it a power loss this long, RTC memory lost (default 0)\n"
+        "\n"
+        "Output:\n"
+        "  --panel                 print the display and LEDs as they change\n"
+        "  --verbose               print the component log\n",
+        argv0);
+}
+
+static bool parse_args(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+
+        auto eq = arg.find('=');
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        }
+
+        const char *v = value.c_str();
+
+        if (arg == "--hours") options.hours = atof(v);
+        else if (arg == "--clock-offset") options.clock_offset = strtoul(v, nullptr, 10);
+        else if (arg == "--keep-warm") options.keep_warm_hours = atof(v);
+        else if (arg == "--rest") options.rest_minutes = atof(v);
+        else if (arg == "--corrupt") options.faults.corrupt = atof(v);
+        else if (arg == "--drop") options.faults.drop = atof(v);
+        else if (arg == "--silence") options.faults.silence = atof(v);
+        else if (arg == "--seed") options.faults.seed = strtoul(v, nullptr, 10);
+        else if (arg == "--max-cook") options.max_cook_minutes = atof(v);
+        else if (arg == "--max-keep-warm-error") options.max_keep_warm_error = atof(v);
+        else if (arg == "--max-heap-growth") options.max_heap_growth = strtoul(v, nullptr, 10);
+        else if (arg == "--finish-in") options.finish_in_minutes = atof(v);
+        else if (arg == "--max-early") options.max_early_minutes = atof(v);
+        else if (arg == "--reboot-at") options.reboot_at_minutes = atof(v);
+        else if (arg == "--outage") options.outage_seconds = atof(v);
+        else if (arg == "--panel") options.panel = true;
+        else if (arg == "--verbose") esphome::host::log_level = 4;
+        else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Heap in use, 0 where it cannot be told (other libcs, ASan)
+static size_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+/*
+    The pty hands bytes over asynchronously. Simulated time only moves on
+    once everything written on either side can be read on the other.
+*/
+struct Link {
+    const Pty &pty;
+    const UARTComponent &uart;
+    const FdTransport &mcu_port;
+
+    bool settle() {
+        uint64_t to_esp = mcu_port.get_tx_bytes() - uart.get_rx_bytes();
+        uint64_t to_mcu = uart.get_tx_bytes() - mcu_port.get_rx_bytes();
+        if (to_esp == settled_to_esp && to_mcu == settled_to_mcu) {
+            // Nothing written since, what was there still is
+            return true;
+        }
+
+        for (int attempt = 0; attempt < 100000; attempt++) {
+            if (mcu_emulator::pending_bytes(pty.slave) == to_esp && mcu_emulator::pending_bytes(pty.master) == to_mcu) {
+                settled_to_esp = to_esp;
+                settled_to_mcu = to_mcu;
+                return true;
+            }
+            sched_yield();
+        }
+        return false;
+    }
+
+    uint64_t settled_to_esp = 0;
+    uint64_t settled_to_mcu = 0;
+};
+
+class Soak {
+public:
+    Soak(const Options &options, RiceCooker *cooker, MCUEmulator &emulator)
+        : options(options), cooker(cooker), emulator(emulator), plant(options.plant) {
+        emulator.set_plant(&plant);
+    }
+
+    void step(uint32_t now);
+    void step_plant(uint32_t now);
+
+    /* Set when the cook is due for a reset, main() reboots the component. */
+    bool reboot_due() const { return reboot_requested; }
+
+    /* The component after a reboot, `checkpoint` what it will resume from. */
+    void rebooted(RiceCooker *cooker, const Checkpoint &checkpoint, uint32_t now);
+
+    int get_failures() const { return failures; }
+    int get_reboots() const { return reboots; }
+    int get_cycles() const { return cycles; }
+
+    /* Reports a cycle cut short by the end of the soak. */
+    void finish() {
+        if (phase == KEEPING_WARM) {
+            report();
+        }
+    }
+
+private:
+    enum Phase {
+        REST,
+        STARTING,
+        COOKING,
+        KEEPING_WARM,
+        CLEARING,
+    };
+
+    void fail(uint32_t now, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    void enter(Phase phase, uint32_t now);
+    bool program_is(const char *name) const { return strcmp(cooker->get_program_name(), name) == 0; }
+    void check_leds(uint32_t now, uint16_t expected, const char *what);
+    void report();
+
+    const Options &options;
+    RiceCooker *cooker;
+    MCUEmulator &emulator;
+
+    ThermalPlant plant;
+    uint32_t plant_time = 0;
+    bool plant_started = false;
+
+    Phase phase = REST;
+    uint32_t phase_started = 0;
+    bool phase_checked = false;
+
+    int cycles = 0;
+    int failures = 0;
+
+    bool from_panel = true;
+    const char *cook_name = nullptr;
+    uint16_t cook_led = 0;
+
+    double cook_minutes = 0;
+    // Finish-by cooks only
+    bool scheduled = false;
+    uint32_t deadline = 0;
+    double held_minutes = 0;
+    double early_minutes = 0;
+    uint8_t keep_warm_min = 255;
+    uint8_t keep_warm_max = 0;
+
+    size_t heap_baseline = 0;
+    // Each reboot leaks the old component, the heap is measured from the next cycle
+    bool rebase_heap = false;
+
+    // --reboot-at
+    bool reboot_requested = false;
+    bool reboot_done = false;
+    bool resume_expected = false;
+    bool resume_checked = false;
+    uint32_t rebooted_at = 0;
+    int reboots = 0;
+};
+
+void Soak::fail(uint32_t now, const char *format, ...) {
+    char message[200];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    printf("FAIL at %u ms, cycle %d: %s\n", now, cycles, message);
+    failures++;
+}
+
+void Soak::enter(Phase phase, uint32_t now) {
+    this->phase = phase;
+    phase_started = now;
+    phase_checked = false;
+}
+
+void Soak::rebooted(RiceCooker *cooker, const Checkpoint &checkpoint, uint32_t now) {
+    this->cooker = cooker;
+    reboot_requested = false;
+    reboots++;
+    rebase_heap = true;
+    rebooted_at = now;
+    resume_checked = false;
+    // After a power loss that is the NVS copy, older than the last control step
+    resume_expected = checkpoint.program.kind != ProgramCheckpoint::NONE
+        && std::abs(plant.read_bottom() - checkpoint.bottom_temperature) <= RESUME_MAX_DRIFT;
+}
+
+void Soak::check_leds(uint32_t now, uint16_t expected, const char *what) {
+    // Mode LEDs only, the WiFi LED is not the program's
+    uint16_t leds = emulator.get_panel().leds & 0xff;
+    if (leds != expected) {
+        fail(now, "%s: mode LEDs %03x, expected %03x", what, leds, expected);
+    }
+}
+
+void Soak::report() {
+    printf("cycle %d: %-9s %5.1f min", cycles, cook_name, cook_minutes);
+    if (scheduled) {
+        printf(" (held %.1f min, ready %.1f min early)", held_minutes, early_minutes);
+    }
+    if (keep_warm_max != 0) {
+        printf(", keep warm %u-%u ºC", keep_warm_min, keep_warm_max);
+    }
+    if (heap_in_use() != 0) {
+        printf(", heap %zu B", heap_in_use());
+    }
+    printf("\n");
+}
+
+void Soak::step_plant(uint32_t now) {
+    if (!plant_started) {
+        plant_started = true;
+        plant_time = now;
+    }
+    while ((int32_t) (now - plant_time) >= (int32_t) PLANT_STEP) {
+        plant.step(PLANT_STEP / 1000.0, emulator.get_relay());
+        plant_time += PLANT_STEP;
+    }
+}
+
+void Soak::step(uint32_t now) {
+    uint32_t in_phase = now - phase_started;
+
+    switch (phase) {
+        case REST:
+            if (!cooker->is_ready()) {
+                phase_started = now;
+                break;
+            }
+            if (in_phase > 5000 && emulator.get_relay()) {
+                fail(now, "relay closed while resting");
+                enter(REST, now);
+                break;
+            }
+            if (in_phase < options.rest_minutes * 60000) {
+                break;
+            }
+            if (cycles > 0 && !cooker->is_idle()) {
+                fail(now, "not idle after %.0f min of rest", options.rest_minutes);
+            }
+
+            // The first cycle warms up allocations, later ones must not grow
+            if (cycles == 1 || rebase_heap) {
+                heap_baseline = heap_in_use();
+                rebase_heap = false;
+            } else if (cycles > 1 && heap_baseline != 0 && heap_in_use() > heap_baseline + options.max_heap_growth) {
+                fail(now, "heap grew by %zu bytes since the first cycle", heap_in_use() - heap_baseline);
+            }
+
+            cycles++;
+            // Alternately from the panel (Rice, the menu default) and as
+            // Home Assistant would (Fast Rice)
+            from_panel = cycles % 2 == 1;
+            scheduled = false;
+            held_minutes = 0;
+            reboot_done = false;
+            if (from_panel) {
+                cook_name = "Rice";
+                cook_led = 1 << 1;
+                emulator.press(KEY_START, now, cooker->is_idle() ? IDLE_PRESS_TIME : 200);
+            } else {
+                cook_name = "Fast Rice";
+                cook_led = 1 << 2;
+                cooker->emplace_program<RiceProgram>(15, true);
+                if (options.finish_in_minutes > 0) {
+                    scheduled = true;
+                    deadline = now + (uint32_t) (options.finish_in_minutes * 60000);
+                    cooker->finish_in((uint32_t) (options.finish_in_minutes * 60));
+                } else {
+                    cooker->start();
+                }
+            }
+            enter(STARTING, now);
+            break;
+
+        case STARTING:
+            if (program_is(cook_name)) {
+                enter(COOKING, now);
+            } else if (in_phase > 3000) {
+                fail(now, "%s did not start from the %s", cook_name, from_panel ? "panel" : "API");
+                enter(CLEARING, now);
+                emulator.press(KEY_CANCEL, now, 1500);
+            }
+            break;
+
+        case COOKING:
+            if (!phase_checked && in_phase > 5000) {
+                phase_checked = true;
+                check_leds(now, cook_led, cook_name);
+            }
+            if (scheduled && held_minutes == 0) {
+                if (cooker->is_scheduled()) {
+                    if (in_phase > 5000 && emulator.get_relay()) {
+                        fail(now, "relay closed before the planned start");
+                        held_minutes = in_phase / 60000.0;
+                    }
+                    break;
+                }
+                held_minutes = in_phase / 60000.0;
+            }
+            if (reboot_done && !resume_checked) {
+                bool resumed = cooker->is_ready() && program_is(cook_name);
+                if (resumed || now - rebooted_at < RESUME_TIME) {
+                    if (resumed) {
+                        resume_checked = true;
+                        if (!resume_expected) {
+                            fail(now, "%s resumed in a pot that cooled down", cook_name);
+                        }
+                    }
+                    break;
+                }
+                resume_checked = true;
+                if (resume_expected) {
+                    fail(now, "%s did not resume after the reboot", cook_name);
+                }
+                if (!program_is("None")) {
+                    fail(now, "%s after the reboot, expected no program", cooker->get_program_name());
+                }
+                printf("cycle %d: %-9s not resumed, pot at %u ºC\n", cycles, cook_name, plant.read_bottom());
+                plant = ThermalPlant(options.plant);
+                enter(REST, now);
+                break;
+            }
+            if (options.reboot_at_minutes > 0 && !reboot_done
+                && in_phase - held_minutes * 60000 >= options.reboot_at_minutes * 60000) {
+                reboot_requested = true;
+                reboot_done = true;
+                break;
+            }
+            if (program_is("Keep Warm")) {
+                cook_minutes = in_phase / 60000.0 - held_minutes;
+                if (scheduled) {
+                    early_minutes = (int32_t) (deadline - now) / 60000.0;
+                    // Done within the tick the deadline falls in is on time. A
+                    // power loss costs what the pot lost, no plan covers that
+                    bool lost_power = reboot_done && options.outage_seconds > 0;
+                    if (early_minutes < -0.1 && !lost_power) {
+                        fail(now, "%s ready %.1f min late", cook_name, -early_minutes);
+                    } else if (early_minutes > options.max_early_minutes) {
+                        fail(now, "%s ready %.1f min early", cook_name, early_minutes);
+                    }
+                }
+                keep_warm_min = 255;
+                keep_warm_max = 0;
+                enter(KEEPING_WARM, now);
+            } else if (in_phase > (options.max_cook_minutes + (scheduled ? options.finish_in_minutes : 0)) * 60000) {
+                fail(now, "%s still running after %.0f min", cook_name, options.max_cook_minutes);
+                enter(CLEARING, now);
+                emulator.press(KEY_CANCEL, now, 1500);
+            }
+            break;
+
+        case KEEPING_WARM:
+            if (!phase_checked && in_phase > 5000) {
+                phase_checked = true;
+                check_leds(now, 1 << 0, "Keep Warm");
+            }
+            // The pot cools down to the band first
+            if (in_phase > 30 * 60000) {
+                keep_warm_min = std::min(keep_warm_min, plant.read_bottom());
+                keep_warm_max = std::max(keep_warm_max, plant.read_bottom());
+            }
+            if (in_phase >= options.keep_warm_hours * 3600000) {
+                report();
+                if (keep_warm_max != 0 && (std::abs(keep_warm_max - KEEP_WARM_TARGET) > options.max_keep_warm_error
+                    || std::abs(keep_warm_min - KEEP_WARM_TARGET) > options.max_keep_warm_error)) {
+                    fail(now, "keep warm held %u-%u ºC", keep_warm_min, keep_warm_max);
+                }
+                // CANCEL stops it, held it clears the program
+                emulator.press(KEY_CANCEL, now, 1500);
+                enter(CLEARING, now);
+            }
+            break;
+
+        case CLEARING:
+            if (program_is("None")) {
+                check_leds(now, 0, "no program");
+                // A fresh pot for the next cycle
+                plant = ThermalPlant(options.plant);
+                enter(REST, now);
+            } else if (in_phase > 5000) {
+                fail(now, "long CANCEL did not clear %s", cooker->get_program_name());
+                enter(REST, now);
+            }
+            break;
+    }
+}
+
+// RTC_NOINIT_ATTR memory, see host/esp_attr.h
+extern "C" uint8_t __start_rtc_noinit[];
+extern "C" uint8_t __stop_rtc_noinit[];
+
+static uint32_t earliest(uint32_t a, uint32_t b, uint32_t now) {
+    return (int32_t) (a - now) < (int32_t) (b - now) ? a : b;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+
+    if (!parse_args(argc, argv, options)) {
+        return 2;
+    }
+
+    Pty pty;
+    if (!pty.open()) {
+        perror("pty");
+        return 2;
+    }
+
+    const uint32_t start = options.clock_offset;
+    esphome::host::set_millis(start);
+
+    UARTComponent uart(pty.slave);
+    FdTransport mcu_port(pty.master);
+    Link link {pty, uart, mcu_port};
+
+    ThermalPlant idle_plant(options.plant);
+    MCUEmulator emulator(&mcu_port, &idle_plant);
+    emulator.set_faults(options.faults);
+
+    Sensor top, bottom, remaining, button_latency;
+    Sensor link_sensors[MCUCommunicator::LINK_STAT_COUNT];
+
+    // As in the firmware, the component lives until the end, or until a reboot
+    // leaves it behind with its task stopped
+    auto boot = [&]() {
+        RiceCooker *cooker = new RiceCooker();
+        cooker->set_uart_parent(&uart);
+        cooker->set_sensor_temp_top(&top);
+        cooker->set_sensor_temp_bottom(&bottom);
+        cooker->set_sensor_remaining_time(&remaining);
+        cooker->set_sensor_button_latency(&button_latency);
+        for (int stat = 0; stat < MCUCommunicator::LINK_STAT_COUNT; stat++) {
+            cooker->set_link_sensor((MCUCommunicator::LinkStat) stat, &link_sensors[stat]);
+        }
+        cooker->setup();
+        return cooker;
+    };
+
+    RiceCooker *cooker = boot();
+    if (cooker->is_failed()) {
+        printf("FAIL: setup\n");
+        return 1;
+    }
+
+    Soak soak(options, cooker, emulator);
+
+    const uint64_t duration = (uint64_t) (options.hours * 3600000);
+    uint64_t elapsed = 0;
+    uint32_t now = start;
+    uint32_t next_loop = start;
+    float max_button_latency = 0;
+    Panel shown;
+    int stalls = 0;
+
+    auto wall_start = std::chrono::steady_clock::now();
+
+    while (elapsed < duration) {
+        soak.step_plant(now);
+
+        // Answers due by now go out, then the task reads them
+        emulator.step(now);
+        stalls += !link.settle();
+        esphome::host::run_tasks(now);
+        stalls += !link.settle();
+        emulator.step(now);
+
+        if ((int32_t) (now - next_loop) >= 0) {
+            cooker->loop();
+            next_loop += LOOP_INTERVAL;
+        }
+
+        soak.step(now);
+
+        if (soak.reboot_due()) {
+            esphome::host::stop_tasks();
+            bool power_lost = options.outage_seconds > 0;
+            emulator.restart(power_lost);
+            // Whatever the MCU had sent is lost with the old component
+            uint8_t byte;
+            while (uart.available() > 0 && uart.read_array(&byte, 1)) {
+            }
+            if (power_lost) {
+                // RTC memory holds garbage after a power up
+                memset(__start_rtc_noinit, 0xa5, __stop_rtc_noinit - __start_rtc_noinit);
+                uint32_t outage = options.outage_seconds * 1000;
+                now += outage;
+                elapsed += outage;
+                esphome::host::set_millis(now);
+                soak.step_plant(now);
+                next_loop = now;
+            }
+            // Read as the component will, RTC memory first
+            Checkpoint checkpoint {};
+            CheckpointStore store;
+            store.setup();
+            store.load(checkpoint);
+            cooker = boot();
+            soak.rebooted(cooker, checkpoint, now);
+        }
+
+        if (button_latency.has_state()) {
+            max_button_latency = std::max(max_button_latency, button_latency.state);
+        }
+        if (options.panel && emulator.get_panel() != shown) {
+            shown = emulator.get_panel();
+            printf("[%8.1f s] panel %s\n", (now - start) / 1000.0, shown.describe().c_str());
+        }
+
+        uint32_t next = earliest(esphome::host::next_task_time(now), next_loop, now);
+        elapsed += next - now;
+        now = next;
+        esphome::host::set_millis(now);
+    }
+
+    soak.finish();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    const MCUEmulator::Stats &stats = emulator.get_stats();
+    auto link_stat = [&](MCUCommunicator::LinkStat stat) { return (uint32_t) link_sensors[stat].state; };
+
+    printf("\n");
+    printf("simulated:       %.1f h in %.1f s, %.0fx\n", options.hours, wall, options.hours * 3600.0 / wall);
+    printf("cycles:          %d, %d reboots\n", soak.get_cycles(), soak.get_reboots());
+    printf("MCU:             %u commands, %u bad, %u answers, %u with keys, longest gap %u ms\n",
+        stats.commands, stats.bad_commands, stats.answers, stats.key_answers, stats.max_command_gap);
+    printf("faults:          %u corrupted, %u short, %u silent\n", stats.corrupted, stats.dropped, stats.silenced);
+    printf("ESP32 link:      %u sent, %u valid, %u CRC errors, %u resyncs, %u timeouts, %u retransmits\n",
+        link_stat(MCUCommunicator::SENT), link_stat(MCUCommunicator::VALID), link_stat(MCUCommunicator::CRC_ERRORS),
+        link_stat(MCUCommunicator::RESYNCS), link_stat(MCUCommunicator::TIMEOUTS), link_stat(MCUCommunicator::RETRANSMITS));
+    printf("latency:         %u ms, worst %u ms, button %.0f ms\n",
+        link_stat(MCUCommunicator::LATENCY), link_stat(MCUCommunicator::MAX_LATENCY), max_button_latency);
+
+    int failures = soak.get_failures();
+
+    if (stalls > 0) {
+        printf("FAIL: the pty stalled %d times\n", stalls);
+        failures++;
+    }
+    if (stats.bad_commands > 0) {
+        printf("FAIL: %u commands with a bad CRC\n", stats.bad_commands);
+        failures++;
+    }
+    // Idle polls are the slowest, a longer gap means polling stopped
+    if (stats.max_command_gap > 2000) {
+        printf("FAIL: no command for %u ms\n", stats.max_command_gap);
+        failures++;
+    }
+
+    uint32_t injected = stats.corrupted + stats.dropped + stats.silenced;
+    if (injected == 0) {
+        if (link_stat(MCUCommunicator::CRC_ERRORS) != 0 || link_stat(MCUCommunicator::TIMEOUTS) != 0) {
+            printf("FAIL: link errors without any fault injected\n");
+            failures++;
+        }
+    } else if (link_stat(MCUCommunicator::TIMEOUTS) > 2 * injected) {
+        // Each fault costs a timeout, and one more if the retransmit fails too
+        printf("FAIL: %u timeouts for %u faults\n", link_stat(MCUCommunicator::TIMEOUTS), injected);
+        failures++;
+    }
+
+    printf("%s\n", failures == 0 ? "OK" : "FAILED");
+    pty.close();
+    return failures == 0 ? 0 : 1;
+}
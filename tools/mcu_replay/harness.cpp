@@ -0,0 +1,317 @@
+#include "harness.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#include "esphome/core/hal.h"
+
+#include "ricecooker/frame_parser.h"
+#include "ricecooker/mcu_communicator.h"
+
+namespace esphome {
+
+static uint32_t host_millis = 0;
+
+uint32_t millis() { return host_millis; }
+
+namespace host {
+
+int log_level = 0;
+
+void set_millis(uint32_t now) { host_millis = now; }
+
+}
+}
+
+using esphome::ricecooker::ButtonDecoder;
+using esphome::ricecooker::FrameParser;
+using esphome::ricecooker::MCUCommunicator;
+
+namespace mcu_replay {
+
+bool ReplayTransport::read(uint8_t *out, size_t n) {
+    if (n > len) {
+        return false;
+    }
+    memcpy(out, data, n);
+    data += n;
+    len -= n;
+    return true;
+}
+
+std::vector<size_t> make_chunks(size_t length, uint32_t seed, size_t max_chunk) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<size_t> size(1, max_chunk);
+
+    std::vector<size_t> chunks;
+    for (size_t offset = 0; offset < length;) {
+        size_t chunk = std::min(size(rng), length - offset);
+        chunks.push_back(chunk);
+        offset += chunk;
+    }
+    return chunks;
+}
+
+uint32_t Clock::at(size_t offset) const {
+    return start + (uint32_t) ((uint64_t) offset * poll_interval / FrameParser::LENGTH);
+}
+
+Decoded run_communicator(const std::vector<uint8_t> &stream, const std::vector<size_t> &chunks, const Clock &clock) {
+    ReplayTransport transport;
+    MCUCommunicator communicator(&transport);
+    Decoded decoded;
+
+    uint32_t frames = 0;
+    size_t offset = 0;
+
+    for (size_t chunk : chunks) {
+        esphome::host::set_millis(clock.at(offset));
+        transport.offer(stream.data() + offset, chunk);
+        communicator.receive_data();
+        offset += chunk;
+
+        if (communicator.get_frame_count() != frames) {
+            frames = communicator.get_frame_count();
+            decoded.readings.push_back({communicator.get_top_temperature(), communicator.get_bottom_temperature()});
+        }
+
+        ButtonEvent event;
+        while (communicator.pop_button_event(event)) {
+            decoded.events.push_back(event);
+        }
+    }
+
+    MCUCommunicator::LinkStats stats;
+    communicator.get_link_stats(stats);
+    decoded.crc_errors = stats.values[MCUCommunicator::CRC_ERRORS];
+    decoded.resyncs = stats.values[MCUCommunicator::RESYNCS];
+    return decoded;
+}
+
+static uint16_t crc16_bitwise(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static bool valid_frame(const uint8_t *frame) {
+    if (frame[0] != FrameParser::HEADER) {
+        return false;
+    }
+    uint16_t crc = crc16_bitwise(frame + 1, FrameParser::LENGTH - 3);
+    return frame[FrameParser::LENGTH - 2] == (crc >> 8) && frame[FrameParser::LENGTH - 1] == (crc & 0xff);
+}
+
+Decoded run_reference(const std::vector<uint8_t> &stream, const std::vector<size_t> &chunks, const Clock &clock) {
+    Decoded decoded;
+    ButtonDecoder buttons;
+
+    // Start of the read each byte arrives in, the time the real code sees it at
+    std::vector<uint32_t> times(stream.size());
+    size_t offset = 0;
+    for (size_t chunk : chunks) {
+        uint32_t time = clock.at(offset);
+        for (size_t i = 0; i < chunk; i++) {
+            times[offset + i] = time;
+        }
+        offset += chunk;
+    }
+
+    for (size_t i = 0; i + FrameParser::LENGTH <= stream.size();) {
+        const uint8_t *frame = stream.data() + i;
+        if (!valid_frame(frame)) {
+            i++;
+            continue;
+        }
+
+        decoded.readings.push_back({frame[3], frame[4]});
+        buttons.feed(frame[2] & ButtonDecoder::KEY_MASK, times[i + FrameParser::LENGTH - 1]);
+
+        ButtonEvent event;
+        while (buttons.pop(event)) {
+            decoded.events.push_back(event);
+        }
+        i += FrameParser::LENGTH;
+    }
+    return decoded;
+}
+
+std::string compare(const Decoded &got, const Decoded &expected) {
+    char message[160];
+
+    size_t readings = std::min(got.readings.size(), expected.readings.size());
+    for (size_t i = 0; i < readings; i++) {
+        if (!(got.readings[i] == expected.readings[i])) {
+            snprintf(message, sizeof(message), "frame %zu: got %u/%u ºC, expected %u/%u ºC", i,
+                got.readings[i].top, got.readings[i].bottom,
+                expected.readings[i].top, expected.readings[i].bottom);
+            return message;
+        }
+    }
+    if (got.readings.size() != expected.readings.size()) {
+        snprintf(message, sizeof(message), "got %zu frames, expected %zu", got.readings.size(), expected.readings.size());
+        return message;
+    }
+
+    size_t events = std::min(got.events.size(), expected.events.size());
+    for (size_t i = 0; i < events; i++) {
+        const ButtonEvent &a = got.events[i];
+        const ButtonEvent &b = expected.events[i];
+        if (a.key != b.key || a.type != b.type || a.time != b.time) {
+            snprintf(message, sizeof(message), "event %zu: got %s %s at %u, expected %s %s at %u", i,
+                ButtonEvent::key_name(a.key), ButtonEvent::type_name(a.type), a.time,
+                ButtonEvent::key_name(b.key), ButtonEvent::type_name(b.type), b.time);
+            return message;
+        }
+    }
+    if (got.events.size() != expected.events.size()) {
+        snprintf(message, sizeof(message), "got %zu key events, expected %zu", got.events.size(), expected.events.size());
+        return message;
+    }
+
+    return "";
+}
+
+static void parse_hex(const char *text, std::vector<uint8_t> &stream) {
+    // Tokens of hex digits; odd ones are not bytes (the "0" of a colour reset)
+    const char *p = text;
+    while (*p != '\0') {
+        if (!isxdigit((unsigned char) *p)) {
+            p++;
+            continue;
+        }
+        const char *start = p;
+        while (isxdigit((unsigned char) *p)) {
+            p++;
+        }
+        size_t digits = p - start;
+        if (digits % 2 != 0) {
+            continue;
+        }
+        for (size_t i = 0; i < digits; i += 2) {
+            char byte[3] = {start[i], start[i + 1], '\0'};
+            stream.push_back((uint8_t) strtoul(byte, nullptr, 16));
+        }
+    }
+}
+
+bool read_capture(const char *path, bool rx, std::vector<uint8_t> &stream) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    const char *marker = rx ? "<<<" : ">>>";
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t at = line.find(marker);
+        if (at == std::string::npos) {
+            continue;
+        }
+        // Up to an escape sequence, anything after it is decoration
+        std::string hex = line.substr(at + 3);
+        size_t escape = hex.find('\033');
+        if (escape != std::string::npos) {
+            hex.resize(escape);
+        }
+        parse_hex(hex.c_str(), stream);
+    }
+    return true;
+}
+
+void make_status_frame(uint8_t top, uint8_t bottom, uint8_t keys, uint8_t *frame) {
+    // Same layout as the README example, {0xaa,0x06,0x80,0x14,0x14,0x00,0x30,0x00,0x2c,0x9a}
+    frame[0] = FrameParser::HEADER;
+    frame[1] = 0x06;
+    frame[2] = 0x80 | (keys & ButtonDecoder::KEY_MASK);
+    frame[3] = top;
+    frame[4] = bottom;
+    frame[5] = 0x00;
+    frame[6] = 0x30;
+    frame[7] = 0x00;
+    uint16_t crc = crc16_bitwise(frame + 1, FrameParser::LENGTH - 3);
+    frame[8] = crc >> 8;
+    frame[9] = crc & 0xff;
+}
+
+void make_session(std::vector<uint8_t> &stream, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> jitter(-1, 1);
+
+    float top = 22.0f;
+    float bottom = 22.0f;
+    uint8_t frame[FrameParser::LENGTH];
+
+    auto frames = [&](int count, uint8_t keys, float heating) {
+        for (int i = 0; i < count; i++) {
+            bottom = std::min(bottom + heating, 100.0f);
+            top += (bottom - top) * 0.01f;
+            make_status_frame(top + jitter(rng), bottom + jitter(rng), keys, frame);
+            stream.insert(stream.end(), frame, frame + FrameParser::LENGTH);
+        }
+    };
+
+    const uint8_t TIMER = 1 << ButtonEvent::TIMER;
+    const uint8_t CANCEL = 1 << ButtonEvent::CANCEL;
+    const uint8_t SELECT = 1 << ButtonEvent::SELECT;
+    const uint8_t START = 1 << ButtonEvent::START;
+
+    frames(50, 0, 0.0f);
+    frames(2, SELECT, 0.0f);
+    frames(20, 0, 0.0f);
+    frames(20, TIMER, 0.0f);
+    frames(20, 0, 0.0f);
+    frames(1, START, 0.0f);
+    frames(800, 0, 0.1f);
+    frames(12, CANCEL, 0.0f);
+    frames(50, 0, 0.0f);
+}
+
+void add_noise(std::vector<uint8_t> &stream, double rate, uint32_t seed) {
+    if (rate <= 0.0) {
+        return;
+    }
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::uniform_int_distribution<int> kind(0, 3);
+    std::uniform_int_distribution<int> value(0, 255);
+
+    std::vector<uint8_t> noisy;
+    noisy.reserve(stream.size() + stream.size() / 16);
+
+    for (uint8_t byte : stream) {
+        if (chance(rng) >= rate) {
+            noisy.push_back(byte);
+            continue;
+        }
+        switch (kind(rng)) {
+            case 0:
+                noisy.push_back(byte ^ (1 << (value(rng) & 7)));
+                break;
+            case 1:
+                // Dropped
+                break;
+            case 2:
+                noisy.push_back((uint8_t) FrameParser::HEADER);
+                noisy.push_back(byte);
+                break;
+            default:
+                noisy.push_back(value(rng));
+                noisy.push_back(byte);
+                break;
+        }
+    }
+    stream.swap(noisy);
+}
+
+} // namespace mcu_replay
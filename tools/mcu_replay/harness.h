@@ -0,0 +1,113 @@
+#pragma once
+
+/*
+    Shared by the capture replay (mcu_replay.cpp) and the fuzz target
+    (fuzz_receive.cpp): runs a received byte stream through the real
+    MCUCommunicator receive path, and through a deliberately naive
+    reference decoder, so the two can be compared.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ricecooker/buttons.h"
+#include "ricecooker/mcu_transport.h"
+
+namespace mcu_replay {
+
+using esphome::ricecooker::ButtonEvent;
+using esphome::ricecooker::MCUTransport;
+
+/* MCUTransport serving a byte stream one chunk at a time, writes are dropped. */
+class ReplayTransport : public MCUTransport {
+public:
+    void offer(const uint8_t *data, size_t len) { this->data = data; this->len = len; }
+
+    size_t available() override { return len; }
+    bool read(uint8_t *out, size_t n) override;
+    void write(const uint8_t *, size_t n) override { written += n; }
+
+    size_t get_written() const { return written; }
+
+private:
+    const uint8_t *data = nullptr;
+    size_t len = 0;
+    size_t written = 0;
+};
+
+struct Reading {
+    uint8_t top;
+    uint8_t bottom;
+
+    bool operator==(const Reading &other) const { return top == other.top && bottom == other.bottom; }
+};
+
+/* What came out of a stream: one reading per valid frame, and the key events. */
+struct Decoded {
+    std::vector<Reading> readings;
+    std::vector<ButtonEvent> events;
+    uint32_t crc_errors = 0;
+    uint32_t resyncs = 0;
+};
+
+/*
+    Read sizes the UART would hand over, 1 to `max_chunk` bytes, from a
+    seed. Up to 9 bytes at most one frame completes per read, so every
+    reading can be checked.
+*/
+std::vector<size_t> make_chunks(size_t length, uint32_t seed, size_t max_chunk = 9);
+
+/*
+    Replay clock. The MCU answers once per poll, so a frame's worth of
+    bytes takes a poll interval: key hold times come out as on the device.
+*/
+struct Clock {
+    uint32_t start = 0;
+    uint32_t poll_interval = 100;
+
+    /* millis() when the byte at `offset` is read. */
+    uint32_t at(size_t offset) const;
+};
+
+/* Through MCUCommunicator::receive_data(), read by read. */
+Decoded run_communicator(const std::vector<uint8_t> &stream, const std::vector<size_t> &chunks, const Clock &clock);
+
+/*
+    The reference: a brute force scan that tries a frame at every offset,
+    with a bit-by-bit CRC, and takes the first valid one. Any frame the
+    real parser misses or makes up shows as a difference.
+*/
+Decoded run_reference(const std::vector<uint8_t> &stream, const std::vector<size_t> &chunks, const Clock &clock);
+
+/* First difference in readings or events, empty when they agree. */
+std::string compare(const Decoded &got, const Decoded &expected);
+
+/*
+    Bytes of one direction of a UARTDebug::log_hex capture (logger.yaml):
+    `<<<` lines are the MCU answers, `>>>` lines the ESP32 commands.
+    Timestamps, log prefixes and colour codes around them are skipped.
+    Lines are split anywhere the sniffer saw a delimiter, so only the
+    concatenated stream means anything.
+*/
+bool read_capture(const char *path, bool rx, std::vector<uint8_t> &stream);
+
+/* A valid status frame, the bytes an MCU would answer with. */
+void make_status_frame(uint8_t top, uint8_t bottom, uint8_t keys, uint8_t *frame);
+
+/*
+    A made-up session for when there is no capture at hand: idle, a
+    SELECT tap, TIMER held into repeats, START, a heat up and a long
+    CANCEL. Temperatures jitter by a degree, from `seed`.
+*/
+void make_session(std::vector<uint8_t> &stream, uint32_t seed);
+
+/*
+    Line noise: each byte has `rate` chance of a flipped bit, of being
+    dropped, or of a stray byte before it (a header half of the time, the
+    worst case for resynchronising).
+*/
+void add_noise(std::vector<uint8_t> &stream, double rate, uint32_t seed);
+
+} // namespace mcu_replay
@@ -0,0 +1,232 @@
+/*
+    Replays MCU traffic through the MCUCommunicator receive path.
+
+    The bytes come from UARTDebug captures (logger.yaml) or, without any,
+    from a made-up session. They go through the real receive code in
+    random read sizes and through the reference decoder in harness.cpp;
+    the two must agree frame by frame and key event by key event. The
+    temperatures and key events can also be checked against, or recorded
+    to, an expectations file, and a last pass measures throughput.
+
+    See README.md, "MCU replay", for build and usage.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "ricecooker/mcu_communicator.h"
+
+#include "harness.h"
+
+using namespace mcu_replay;
+using esphome::ricecooker::MCUCommunicator;
+
+struct Options {
+    std::vector<const char *> captures;
+    const char *expect = nullptr;
+    const char *record = nullptr;
+    double noise = 0.0;
+    uint32_t seed = 1;
+    uint32_t repeat = 200;
+    Clock clock;
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] [CAPTURE...]\n"
+        "\n"
+        "Without a capture a made-up session is replayed.\n"
+        "\n"
+        "Input:\n"
+        "  --noise=P           chance per byte of a flipped, dropped or stray byte\n"
+        "  --seed=N            read sizes, noise and made-up temperatures (default 1)\n"
+        "  --clock-offset=MS   millis() at start, e.g. 4294967000 to cross the wrap\n"
+        "  --poll-interval=MS  time one answer takes in the replay (default 100)\n"
+        "\n"
+        "Checks (exit code 1 on a difference):\n"
+        "  --expect=FILE       temperatures and key events the replay must produce\n"
+        "  --record=FILE       write them, to check later captures against\n"
+        "\n"
+        "Throughput:\n"
+        "  --repeat=N          passes over the stream (default 200, 0 to skip)\n"
+        "  --verbose           print the component log\n",
+        argv0);
+}
+
+static bool parse_args(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+
+        auto eq = arg.find('=');
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        }
+
+        const char *v = value.c_str();
+
+        if (arg == "--expect") options.expect = argv[i] + strlen("--expect=");
+        else if (arg == "--record") options.record = argv[i] + strlen("--record=");
+        else if (arg == "--noise") options.noise = atof(v);
+        else if (arg == "--seed") options.seed = strtoul(v, nullptr, 10);
+        else if (arg == "--repeat") options.repeat = strtoul(v, nullptr, 10);
+        else if (arg == "--clock-offset") options.clock.start = strtoul(v, nullptr, 10);
+        else if (arg == "--poll-interval") options.clock.poll_interval = strtoul(v, nullptr, 10);
+        else if (arg == "--verbose") esphome::host::log_level = 4;
+        else if (arg.compare(0, 2, "--") != 0) options.captures.push_back(argv[i]);
+        else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    return options.clock.poll_interval != 0;
+}
+
+/*
+    One line per fact: the frame and CRC error counts, the temperatures
+    each time they change, and the key events without their times, so a
+    capture replayed at another poll interval still matches.
+*/
+static std::string expectations(const Decoded &decoded) {
+    std::ostringstream out;
+    out << "frames " << decoded.readings.size() << "\n";
+    out << "crc_errors " << decoded.crc_errors << "\n";
+
+    Reading last = {0, 0};
+    for (size_t i = 0; i < decoded.readings.size(); i++) {
+        const Reading &reading = decoded.readings[i];
+        if (i == 0 || !(reading == last)) {
+            out << "temperature " << (int) reading.top << " " << (int) reading.bottom << "\n";
+            last = reading;
+        }
+    }
+
+    for (const ButtonEvent &event : decoded.events) {
+        out << "key " << ButtonEvent::key_name(event.key) << " " << ButtonEvent::type_name(event.type) << "\n";
+    }
+    return out.str();
+}
+
+static bool check_expectations(const char *path, const std::string &got) {
+    std::ifstream file(path);
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    std::istringstream actual(got);
+    std::string expected_line;
+    std::string actual_line;
+    int line = 0;
+
+    for (;;) {
+        bool more_expected = static_cast<bool>(std::getline(file, expected_line));
+        bool more_actual = static_cast<bool>(std::getline(actual, actual_line));
+        line++;
+
+        if (!more_expected && !more_actual) {
+            return true;
+        }
+        if (!more_expected) expected_line = "(end)";
+        if (!more_actual) actual_line = "(end)";
+
+        if (expected_line != actual_line) {
+            printf("FAIL %s:%d: expected \"%s\", got \"%s\"\n", path, line, expected_line.c_str(), actual_line.c_str());
+            return false;
+        }
+    }
+}
+
+/* Large reads, as the UART buffer hands them over under load. */
+static void measure_throughput(const std::vector<uint8_t> &stream, uint32_t repeat) {
+    ReplayTransport transport;
+    MCUCommunicator communicator(&transport);
+
+    const size_t CHUNK = 64;
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t pass = 0; pass < repeat; pass++) {
+        for (size_t offset = 0; offset < stream.size(); offset += CHUNK) {
+            transport.offer(stream.data() + offset, std::min(CHUNK, stream.size() - offset));
+            communicator.receive_data();
+
+            ButtonEvent event;
+            while (communicator.pop_button_event(event)) {
+            }
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double bytes = (double) stream.size() * repeat;
+
+    printf("throughput: %u frames in %.3f s, %.0f frames/s, %.1f MB/s\n",
+        communicator.get_frame_count(), seconds,
+        communicator.get_frame_count() / seconds, bytes / seconds / 1e6);
+}
+
+int main(int argc, char **argv) {
+    Options options;
+
+    if (!parse_args(argc, argv, options)) {
+        return 2;
+    }
+
+    std::vector<uint8_t> stream;
+    for (const char *capture : options.captures) {
+        if (!read_capture(capture, true, stream)) {
+            perror(capture);
+            return 2;
+        }
+    }
+    if (options.captures.empty()) {
+        make_session(stream, options.seed);
+    }
+    add_noise(stream, options.noise, options.seed);
+
+    std::vector<size_t> chunks = make_chunks(stream.size(), options.seed);
+    Decoded got = run_communicator(stream, chunks, options.clock);
+    Decoded reference = run_reference(stream, chunks, options.clock);
+
+    printf("%zu bytes, %zu frames, %u CRC errors, %u resyncs, %zu key events\n",
+        stream.size(), got.readings.size(), got.crc_errors, got.resyncs, got.events.size());
+
+    bool ok = true;
+
+    std::string difference = compare(got, reference);
+    if (!difference.empty()) {
+        printf("FAIL against the reference decoder: %s\n", difference.c_str());
+        ok = false;
+    }
+
+    std::string facts = expectations(got);
+    if (options.record != nullptr) {
+        std::ofstream file(options.record);
+        file << facts;
+        if (!file) {
+            perror(options.record);
+            return 2;
+        }
+    }
+    if (options.expect != nullptr && !check_expectations(options.expect, facts)) {
+        ok = false;
+    }
+
+    if (options.repeat > 0 && !stream.empty()) {
+        measure_throughput(stream, options.repeat);
+    }
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
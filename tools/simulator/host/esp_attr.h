@@ -0,0 +1,10 @@
+#pragma once
+
+/*
+    Host replacement for esp_attr.h. Plain memory outlives a component
+    rebuilt in the same process as RTC memory outlives a reset; the named
+    section lets a test fill it with garbage, as a power up does, through
+    the linker's __start_rtc_noinit and __stop_rtc_noinit.
+*/
+
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit")))
@@ -0,0 +1,29 @@
+#pragma once
+
+/*
+    Host replacement for esphome/components/sensor/sensor.h. Keeps the last
+    published value and counts publishes, for host programs to check.
+*/
+
+namespace esphome {
+namespace sensor {
+
+class Sensor {
+public:
+    void publish_state(float state) {
+        this->state = state;
+        has_state_ = true;
+        publishes++;
+    }
+
+    bool has_state() const { return has_state_; }
+
+    float state = 0.0f;
+    unsigned publishes = 0;
+
+private:
+    bool has_state_ = false;
+};
+
+}
+}
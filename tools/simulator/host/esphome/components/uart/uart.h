@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Host replacement for esphome/components/uart/uart.h. UARTComponent is a
+    file descriptor, normally the slave side of a pseudo-terminal, so the
+    component talks to tools/mcu_emulator exactly as to the MCU.
+*/
+
+namespace esphome {
+namespace uart {
+
+class UARTComponent {
+public:
+    /* `fd` non-blocking and raw, see tools/mcu_emulator/pty.h. */
+    explicit UARTComponent(int fd) : fd(fd) {}
+
+    size_t available();
+    bool read_array(uint8_t *data, size_t len);
+    void write_array(const uint8_t *data, size_t len);
+
+    // Host only, bytes through so far
+    uint64_t get_rx_bytes() const { return rx_bytes; }
+    uint64_t get_tx_bytes() const { return tx_bytes; }
+
+private:
+    int fd;
+    uint64_t rx_bytes = 0;
+    uint64_t tx_bytes = 0;
+};
+
+class UARTDevice {
+public:
+    UARTDevice() = default;
+    explicit UARTDevice(UARTComponent *parent) : parent_(parent) {}
+
+    void set_uart_parent(UARTComponent *parent) { parent_ = parent; }
+
+    int available() { return parent_ != nullptr ? (int) parent_->available() : 0; }
+    bool read_array(uint8_t *data, size_t len) { return parent_ != nullptr && parent_->read_array(data, len); }
+    void write_array(const uint8_t *data, size_t len) {
+        if (parent_ != nullptr) {
+            parent_->write_array(data, len);
+        }
+    }
+
+protected:
+    UARTComponent *parent_ {nullptr};
+};
+
+}
+}
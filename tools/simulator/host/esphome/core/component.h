@@ -0,0 +1,28 @@
+#pragma once
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+/*
+    Host replacement for esphome/core/component.h, as much of Component
+    as RiceCooker uses. Nothing calls setup() or loop() for you: the host
+    program does, in the order ESPHome would.
+*/
+
+namespace esphome {
+
+class Component {
+public:
+    virtual ~Component() = default;
+
+    virtual void setup() {}
+    virtual void loop() {}
+
+    void mark_failed() { failed = true; }
+    bool is_failed() const { return failed; }
+
+private:
+    bool failed = false;
+};
+
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+/*
+    Host replacement for the esphome/core/defines.h ESPHome generates from
+    the YAML. Nothing optional is enabled: no profiler, full CRC table.
+*/
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+    Host replacement for esphome/core/hal.h.
+
+    The simulator owns the clock: millis() returns simulated time, so a
+    full cook runs as fast as the CPU allows.
+*/
+
+namespace esphome {
+
+uint32_t millis();
+
+namespace host {
+
+void set_millis(uint32_t now);
+
+}
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/*
+    Host replacement for esphome/core/helpers.h, the helpers the component
+    uses.
+*/
+
+namespace esphome {
+
+uint32_t fnv1_hash(const std::string &str);
+
+}
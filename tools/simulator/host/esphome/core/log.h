@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdio>
+
+#include "esphome/core/hal.h"
+
+/*
+    Host replacement for esphome/core/log.h.
+
+    Log lines are printed only when the simulator runs with --verbose,
+    prefixed with the simulated time.
+*/
+
+namespace esphome {
+namespace host {
+
+extern int log_level;
+
+}
+}
+
+#define ESPHOME_HOST_LOG(level, letter, tag, format, ...) \
+    do { \
+        if (::esphome::host::log_level >= level) { \
+            uint32_t host_now_ = ::esphome::millis(); \
+            printf("[%6u.%03u][" letter "][%s]: " format "\n", \
+                host_now_ / 1000, host_now_ % 1000, tag, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESPHOME_HOST_LOG(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESPHOME_HOST_LOG(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESPHOME_HOST_LOG(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESPHOME_HOST_LOG(4, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESPHOME_HOST_LOG(5, "V", tag, format, ##__VA_ARGS__)
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+/*
+    Host replacement for esphome/core/preferences.h. Preferences live in
+    memory for as long as the process, which is what a soak test that
+    restarts the component wants: saved values survive the "reboot".
+*/
+
+namespace esphome {
+
+class ESPPreferenceObject {
+public:
+    ESPPreferenceObject() = default;
+    ESPPreferenceObject(std::vector<uint8_t> *slot, size_t size) : slot(slot), size(size) {}
+
+    template<typename T> bool save(const T *src) {
+        if (slot == nullptr || sizeof(T) != size) {
+            return false;
+        }
+        slot->assign((const uint8_t *) src, (const uint8_t *) src + size);
+        return true;
+    }
+
+    template<typename T> bool load(T *dest) {
+        if (slot == nullptr || sizeof(T) != size || slot->size() != size) {
+            return false;
+        }
+        memcpy(dest, slot->data(), size);
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> *slot = nullptr;
+    size_t size = 0;
+};
+
+class ESPPreferences {
+public:
+    template<typename T> ESPPreferenceObject make_preference(uint32_t type, bool in_flash) {
+        (void) in_flash;
+        return ESPPreferenceObject(&slots[type], sizeof(T));
+    }
+    template<typename T> ESPPreferenceObject make_preference(uint32_t type) {
+        return make_preference<T>(type, false);
+    }
+
+    bool sync() { return true; }
+
+    /* Host only: forgets everything, as a fresh flash. */
+    void clear() { slots.clear(); }
+
+private:
+    std::map<uint32_t, std::vector<uint8_t>> slots;
+};
+
+extern ESPPreferences *global_preferences;
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+    Host replacement for freertos/FreeRTOS.h: the types and macros the
+    component uses, one tick per millisecond.
+*/
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdPASS 1
+#define pdFAIL 0
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define portMAX_DELAY ((TickType_t) 0xffffffff)
+
+#ifndef CONFIG_FREERTOS_UNICORE
+#define CONFIG_FREERTOS_UNICORE 1
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+
+/*
+    Host replacement for freertos/task.h, on simulated time.
+
+    Each task is a thread, but only one thing runs at a time: a task runs
+    when the host program calls host::run_tasks() and its wait is over,
+    until it waits again. Waits are in simulated milliseconds, so a task
+    that sleeps a minute costs nothing, and runs are repeatable.
+*/
+
+struct HostTask;
+typedef HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack, void *arg,
+    unsigned priority, TaskHandle_t *handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack, void *arg,
+    unsigned priority, TaskHandle_t *handle, int core);
+
+/* Waits until notified or `ticks` pass, from inside a task. */
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+void xTaskNotifyGive(TaskHandle_t task);
+
+namespace esphome {
+namespace host {
+
+/* Runs every task that is due at `now`, each until it waits again. */
+void run_tasks(uint32_t now);
+
+/* Simulated time the next task is due, `now` when one is already due. */
+uint32_t next_task_time(uint32_t now);
+
+/* The tasks created so far never run again, as after a reset. */
+void stop_tasks();
+
+}
+}
@@ -0,0 +1,219 @@
+/*
+    Definitions behind the host headers that need more than a header:
+    preferences, the UART on a file descriptor and the FreeRTOS tasks.
+
+    millis() and the log level stay with each host program, they own the
+    clock.
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/uart/uart.h"
+#include "freertos/task.h"
+
+namespace esphome {
+
+static ESPPreferences host_preferences;
+ESPPreferences *global_preferences = &host_preferences;
+
+uint32_t fnv1_hash(const std::string &str) {
+    uint32_t hash = 2166136261UL;
+    for (char c : str) {
+        hash *= 16777619UL;
+        hash ^= (uint8_t) c;
+    }
+    return hash;
+}
+
+namespace uart {
+
+size_t UARTComponent::available() {
+    int pending = 0;
+    if (ioctl(fd, FIONREAD, &pending) != 0) {
+        return 0;
+    }
+    return pending;
+}
+
+bool UARTComponent::read_array(uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::read(fd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+        rx_bytes += n;
+    }
+    return true;
+}
+
+void UARTComponent::write_array(const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EAGAIN) {
+            // The other side is behind, as a full TX FIFO
+            pollfd writable = {fd, POLLOUT, 0};
+            poll(&writable, 1, 100);
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= n;
+        tx_bytes += n;
+    }
+}
+
+}
+}
+
+/*
+    Tasks hand the CPU back and forth under one lock: `running` says whose
+    turn it is, the host program's or the task's.
+*/
+struct HostTask {
+    TaskFunction_t function;
+    void *arg;
+
+    bool running = false;
+    bool finished = false;
+    bool notified = false;
+    bool forever = false;
+    uint32_t wake_at = 0;
+};
+
+// Never destroyed, tasks still wait on them when the program exits
+static std::mutex &task_mutex = *new std::mutex;
+static std::condition_variable &task_turn = *new std::condition_variable;
+static std::vector<HostTask *> &host_tasks = *new std::vector<HostTask *>;
+static thread_local HostTask *current_task = nullptr;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *, uint32_t, void *arg, unsigned, TaskHandle_t *handle) {
+    HostTask *task = new HostTask {function, arg};
+    task->wake_at = esphome::millis();
+
+    std::thread([task]() {
+        std::unique_lock<std::mutex> lock(task_mutex);
+        task_turn.wait(lock, [task]() { return task->running; });
+        lock.unlock();
+
+        current_task = task;
+        task->function(task->arg);
+
+        lock.lock();
+        task->finished = true;
+        task->running = false;
+        task_turn.notify_all();
+    }).detach();
+
+    std::lock_guard<std::mutex> lock(task_mutex);
+    host_tasks.push_back(task);
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack, void *arg,
+    unsigned priority, TaskHandle_t *handle, int) {
+    return xTaskCreate(function, name, stack, arg, priority, handle);
+}
+
+// Gives the turn back until the task is due again
+static void yield_turn(std::unique_lock<std::mutex> &lock, HostTask *task, TickType_t ticks) {
+    task->forever = ticks == portMAX_DELAY;
+    task->wake_at = esphome::millis() + ticks;
+    task->running = false;
+    task_turn.notify_all();
+    task_turn.wait(lock, [task]() { return task->running; });
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    HostTask *task = current_task;
+    std::unique_lock<std::mutex> lock(task_mutex);
+
+    if (!task->notified) {
+        yield_turn(lock, task, ticks);
+    }
+
+    uint32_t value = task->notified ? 1 : 0;
+    if (clear) {
+        task->notified = false;
+    }
+    return value;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> lock(task_mutex);
+    task->notified = true;
+}
+
+static bool task_due(const HostTask *task, uint32_t now) {
+    if (task->finished) {
+        return false;
+    }
+    if (task->notified) {
+        return true;
+    }
+    return !task->forever && (int32_t) (now - task->wake_at) >= 0;
+}
+
+namespace esphome {
+namespace host {
+
+void run_tasks(uint32_t now) {
+    std::unique_lock<std::mutex> lock(task_mutex);
+
+    for (HostTask *task : host_tasks) {
+        if (!task_due(task, now)) {
+            continue;
+        }
+        task->running = true;
+        task_turn.notify_all();
+        task_turn.wait(lock, [task]() { return !task->running; });
+    }
+}
+
+void stop_tasks() {
+    std::lock_guard<std::mutex> lock(task_mutex);
+
+    // Their threads stay parked, waiting for a turn that never comes
+    for (HostTask *task : host_tasks) {
+        task->finished = true;
+    }
+}
+
+uint32_t next_task_time(uint32_t now) {
+    std::lock_guard<std::mutex> lock(task_mutex);
+
+    uint32_t next = now + 0x7fffffff;
+    for (const HostTask *task : host_tasks) {
+        if (task->finished || (task->forever && !task->notified)) {
+            continue;
+        }
+        uint32_t at = task->notified ? now : task->wake_at;
+        if ((int32_t) (at - now) <= 0) {
+            return now;
+        }
+        if ((int32_t) (at - next) < 0) {
+            next = at;
+        }
+    }
+    return next;
+}
+
+}
+}
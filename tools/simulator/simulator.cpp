@@ -0,0 +1,445 @@
+/*
+    Accelerated-time simulator for the ricecooker control code.
+
+    Builds heater.cpp and program.cpp natively against a simulated clock and
+    the thermal plant in thermal_plant.h, runs a whole program in a few
+    milliseconds and prints control-quality figures per stage.
+
+    See README.md, "Simulator", for build and usage.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "ricecooker/heater.h"
+#include "ricecooker/program.h"
+#include "ricecooker/temperature_filter.h"
+#include "ricecooker/tick_scheduler.h"
+#include "ricecooker/trace.h"
+
+#include "thermal_plant.h"
+
+namespace esphome {
+
+static uint32_t sim_millis = 0;
+
+uint32_t millis() { return sim_millis; }
+
+namespace host {
+
+int log_level = 0;
+
+void set_millis(uint32_t now) { sim_millis = now; }
+
+}
+}
+
+using namespace esphome::ricecooker;
+using ricecooker_sim::PlantConfig;
+using ricecooker_sim::ThermalPlant;
+
+static const char *const TAG = "simulator";
+
+// Same periods and phases RiceCooker uses
+static const uint32_t MCU_INTERVAL = 200;
+static const uint32_t MCU_FAST_INTERVAL = 100;
+static const uint32_t CONTROL_INTERVAL = 500;
+static const uint32_t CONTROL_PHASE = 50;
+
+static const uint32_t SIM_STEP = 10;
+
+struct Options {
+    std::string program = "rice";
+    uint8_t cooking_time = 15;
+    uint8_t keep_warm_target = 70;
+    uint32_t minutes = 120;
+    uint32_t clock_offset = 0;
+    std::string controller = "predictive";
+    bool filter = true;
+    double relay_window = -1;
+    double min_on_time = -1;
+    double min_off_time = -1;
+    int cycle_budget = -1;
+
+    double max_overshoot = -1;
+    int max_switches = -1;
+
+    const char *csv = nullptr;
+    bool trace = false;
+
+    PlantConfig plant;
+};
+
+struct StageStats {
+    std::string program;
+    std::string stage;
+
+    uint32_t entered = 0;
+    uint32_t left = 0;
+
+    uint8_t min_target = 0;
+    uint8_t max_target = 0;
+
+    // Time from entering the stage until the bottom sensor is inside the target band
+    int64_t reached = -1;
+    int overshoot = 0;
+
+    uint8_t peak_bottom = 0;
+    uint8_t peak_top = 0;
+
+    int switches = 0;
+    double energy_wh = 0;
+
+    // Program::remaining_time() on entering the stage, -1 if none
+    int64_t eta = -1;
+};
+
+// Same format as RiceCooker::dump_trace
+static void dump_trace() {
+    Trace::Record record;
+    uint8_t bytes[Trace::ENCODED_MAX];
+
+    while (global_trace.pop(record)) {
+        size_t len = Trace::encode(record, bytes);
+        printf("TRACE:");
+        for (size_t i = 0; i < len; i++) {
+            printf("%02x", bytes[i]);
+        }
+        printf("\n");
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Program:\n"
+        "  --program=rice|fast-rice|keep-warm  (default rice)\n"
+        "  --cooking-time=MIN                  rice cooking time (default 15)\n"
+        "  --keep-warm-target=C                keep warm target (default 70)\n"
+        "  --minutes=MIN                       simulated time (default 120)\n"
+        "  --clock-offset=MS                   millis() at start, e.g. 4294000000 to cross the wrap\n"
+        "  --controller=predictive|thermal-mass heater controller (default predictive)\n"
+        "  --no-filter                         feed the heater whole-degree readings\n"
+        "  --relay-window=S --min-on=S --min-off=S --cycle-budget=N  relay scheduler\n"
+        "\n"
+        "Plant:\n"
+        "  --ambient=C --initial=C --power=W --element-tau=S\n"
+        "  --bottom-capacity=J/K --dry-capacity=J/K --water=KG\n"
+        "  --bottom-to-top=W/K --bottom-loss=W/K --top-loss=W/K\n"
+        "  --noise=C --seed=N\n"
+        "\n"
+        "Checks (exit code 1 when exceeded):\n"
+        "  --max-overshoot=C --max-switches=N\n"
+        "\n"
+        "Output:\n"
+        "  --csv=FILE    write a 1 s time series\n"
+        "  --verbose     print the component log\n"
+        "  --trace       print the control trace, decode with tools/trace_decode.py\n",
+        argv0);
+}
+
+static bool parse_args(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+
+        auto eq = arg.find('=');
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        }
+
+        const char *v = value.c_str();
+
+        if (arg == "--program") options.program = value;
+        else if (arg == "--cooking-time") options.cooking_time = atoi(v);
+        else if (arg == "--keep-warm-target") options.keep_warm_target = atoi(v);
+        else if (arg == "--minutes") options.minutes = atoi(v);
+        else if (arg == "--clock-offset") options.clock_offset = strtoul(v, nullptr, 10);
+        else if (arg == "--controller") options.controller = value;
+        else if (arg == "--no-filter") options.filter = false;
+        else if (arg == "--relay-window") options.relay_window = atof(v);
+        else if (arg == "--min-on") options.min_on_time = atof(v);
+        else if (arg == "--min-off") options.min_off_time = atof(v);
+        else if (arg == "--cycle-budget") options.cycle_budget = atoi(v);
+        else if (arg == "--ambient") options.plant.ambient = atof(v);
+        else if (arg == "--initial") options.plant.initial_temperature = atof(v);
+        else if (arg == "--power") options.plant.element_power = atof(v);
+        else if (arg == "--element-tau") options.plant.element_tau = atof(v);
+        else if (arg == "--bottom-capacity") options.plant.bottom_capacity = atof(v);
+        else if (arg == "--dry-capacity") options.plant.dry_capacity = atof(v);
+        else if (arg == "--water") options.plant.water_mass = atof(v);
+        else if (arg == "--bottom-to-top") options.plant.bottom_to_top = atof(v);
+        else if (arg == "--bottom-loss") options.plant.bottom_loss = atof(v);
+        else if (arg == "--top-loss") options.plant.top_loss = atof(v);
+        else if (arg == "--noise") options.plant.noise = atof(v);
+        else if (arg == "--seed") options.plant.seed = strtoul(v, nullptr, 10);
+        else if (arg == "--max-overshoot") options.max_overshoot = atof(v);
+        else if (arg == "--max-switches") options.max_switches = atoi(v);
+        else if (arg == "--csv") options.csv = argv[i] + strlen("--csv=");
+        else if (arg == "--verbose") esphome::host::log_level = 4;
+        else if (arg == "--trace") options.trace = true;
+        else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static Program* make_program(const Options &options, ProgramStorage &storage) {
+    if (options.program == "rice") {
+        return &storage.emplace<RiceProgram>(options.cooking_time);
+    } else if (options.program == "fast-rice") {
+        return &storage.emplace<RiceProgram>(options.cooking_time, true);
+    } else if (options.program == "keep-warm") {
+        return &storage.emplace<KeepWarm>(options.keep_warm_target, 5);
+    }
+    return nullptr;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+
+    if (!parse_args(argc, argv, options)) {
+        return 2;
+    }
+
+    FILE *csv = nullptr;
+    if (options.csv != nullptr) {
+        csv = fopen(options.csv, "w");
+        if (csv == nullptr) {
+            perror(options.csv);
+            return 2;
+        }
+        fprintf(csv, "time_s,program,stage,relay,bottom,top,bottom_filtered,bottom_rate,bottom_real,top_real,min_target,max_target,water_kg\n");
+    }
+
+    ThermalPlant plant(options.plant);
+    Heater heater;
+    if (options.controller == "predictive") {
+        heater.set_controller(Heater::ControllerType::PREDICTIVE);
+    } else if (options.controller == "thermal-mass") {
+        heater.set_controller(Heater::ControllerType::THERMAL_MASS);
+    } else {
+        usage(argv[0]);
+        return 2;
+    }
+    if (options.relay_window >= 0) heater.set_relay_window(options.relay_window * 1000);
+    if (options.min_on_time >= 0) heater.set_relay_min_on_time(options.min_on_time * 1000);
+    if (options.min_off_time >= 0) heater.set_relay_min_off_time(options.min_off_time * 1000);
+    if (options.cycle_budget >= 0) heater.set_relay_cycle_budget(options.cycle_budget);
+
+    esphome::host::set_millis(options.clock_offset);
+
+    ProgramStorage storage;
+    Program* program = make_program(options, storage);
+    if (program == nullptr) {
+        usage(argv[0]);
+        return 2;
+    }
+    program->start();
+
+    std::vector<StageStats> stages;
+    bool last_power = false;
+    int total_switches = 0;
+    int64_t finished_at = -1;
+
+    const uint32_t duration = options.minutes * 60 * 1000;
+    const uint32_t start = options.clock_offset;
+
+    uint8_t top_temp = plant.read_top();
+    uint8_t bottom_temp = plant.read_bottom();
+
+    TemperatureFilter top_filter;
+    TemperatureFilter bottom_filter;
+    top_filter.set_sample_period(MCU_INTERVAL);
+    bottom_filter.set_sample_period(MCU_INTERVAL);
+
+    TickScheduler scheduler;
+    uint8_t mcu_task = 0;
+
+    mcu_task = scheduler.add("mcu", MCU_INTERVAL, 0, [&]() {
+        top_temp = plant.read_top();
+        bottom_temp = plant.read_bottom();
+
+        // Mirrors the per-frame filtering in RiceCooker::loop
+        top_filter.update(top_temp);
+        bottom_filter.update(bottom_temp);
+        if (options.filter) {
+            heater.update(top_filter.get_temperature(), bottom_filter.get_temperature(), bottom_filter.get_rate());
+        } else {
+            heater.update(top_temp << 8, bottom_temp << 8, 0);
+        }
+
+        // Mirrors RiceCooker::update_poll
+        uint32_t poll = heater.is_modulating() ? MCU_FAST_INTERVAL : MCU_INTERVAL;
+        if (scheduler.get_period(mcu_task) != poll) {
+            scheduler.set_period(mcu_task, poll);
+            top_filter.set_sample_period(poll);
+            bottom_filter.set_sample_period(poll);
+        }
+    });
+
+    // Mirrors RiceCooker::control
+    scheduler.add("control", CONTROL_INTERVAL, CONTROL_PHASE, [&]() {
+        if (options.trace) {
+            dump_trace();
+        }
+
+        uint32_t now = esphome::millis();
+        uint32_t elapsed = now - start;
+
+        program->step(&heater);
+        heater.step(now);
+
+        if (stages.empty()
+            || stages.back().stage != program->get_stage_name()
+            || stages.back().program != program->get_name()) {
+            if (!stages.empty()) {
+                stages.back().left = elapsed;
+            }
+            StageStats stats;
+            stats.program = program->get_name();
+            stats.stage = program->get_stage_name();
+            stats.entered = elapsed;
+            std::optional<uint32_t> eta = program->remaining_time(&heater);
+            if (eta.has_value()) {
+                stats.eta = *eta * 1000LL;
+            }
+            stages.push_back(stats);
+        }
+
+        StageStats &stage = stages.back();
+        stage.min_target = heater.get_min_target();
+        stage.max_target = heater.get_max_target();
+        stage.peak_bottom = std::max(stage.peak_bottom, bottom_temp);
+        stage.peak_top = std::max(stage.peak_top, top_temp);
+
+        if (stage.max_target > 0) {
+            if (stage.reached < 0
+                && bottom_temp >= stage.min_target
+                && bottom_temp <= stage.max_target) {
+                stage.reached = elapsed - stage.entered;
+            }
+            if (stage.reached >= 0) {
+                stage.overshoot = std::max(stage.overshoot, (int) bottom_temp - (int) stage.max_target);
+            }
+        }
+
+        std::optional<uint32_t> remaining = program->remaining_time(&heater);
+        if (remaining.has_value() && *remaining == 0) {
+            ESP_LOGI(TAG, "%s finished, switching to keep warm", program->get_name());
+            if (finished_at < 0) {
+                finished_at = elapsed;
+            }
+            heater.power_off();
+            heater.reset();
+            program = &storage.emplace<KeepWarm>(65, 2);
+            program->start();
+        }
+    });
+
+    scheduler.start(start);
+
+    for (uint32_t elapsed = 0; elapsed <= duration; elapsed += SIM_STEP) {
+        uint32_t now = start + elapsed;
+        esphome::host::set_millis(now);
+
+        plant.step(SIM_STEP / 1000.0, heater.get_power());
+
+        scheduler.run(now);
+
+        bool power = heater.get_power();
+        if (power && !last_power) {
+            total_switches++;
+            if (!stages.empty()) {
+                stages.back().switches++;
+            }
+        }
+        last_power = power;
+
+        if (!stages.empty() && power) {
+            stages.back().energy_wh += options.plant.element_power * SIM_STEP / 1000.0 / 3600.0;
+        }
+
+        if (csv != nullptr && elapsed % 1000 == 0) {
+            fprintf(csv, "%u,%s,%s,%d,%u,%u,%.2f,%.2f,%.2f,%.2f,%u,%u,%.3f\n",
+                elapsed / 1000, program->get_name(), program->get_stage_name(), power,
+                bottom_temp, top_temp,
+                bottom_filter.get_temperature() / 256.0, bottom_filter.get_rate() / 256.0,
+                plant.get_bottom(), plant.get_top(),
+                heater.get_min_target(), heater.get_max_target(), plant.get_water());
+        }
+    }
+
+    if (!stages.empty()) {
+        stages.back().left = duration;
+    }
+
+    if (csv != nullptr) {
+        fclose(csv);
+    }
+
+    printf("%-10s %-6s %8s %8s %8s %9s %9s %9s %7s %5s %8s %9s\n",
+        "program", "stage", "start_s", "length_s", "eta_s", "target", "reach_s", "overshoot",
+        "peak_b", "peak_t", "switches", "energy_wh");
+
+    int worst_overshoot = 0;
+
+    for (const auto &stage : stages) {
+        char target[16] = "-";
+        if (stage.max_target > 0) {
+            snprintf(target, sizeof(target), "%u-%u", stage.min_target, stage.max_target);
+        }
+
+        char reached[16] = "-";
+        if (stage.reached >= 0) {
+            snprintf(reached, sizeof(reached), "%.1f", stage.reached / 1000.0);
+        }
+
+        char eta[16] = "-";
+        if (stage.eta >= 0) {
+            snprintf(eta, sizeof(eta), "%.1f", stage.eta / 1000.0);
+        }
+
+        printf("%-10s %-6s %8.1f %8.1f %8s %9s %9s %9d %7u %5u %8d %9.1f\n",
+            stage.program.c_str(), stage.stage.c_str(),
+            stage.entered / 1000.0, (stage.left - stage.entered) / 1000.0,
+            eta, target, reached, stage.overshoot,
+            stage.peak_bottom, stage.peak_top, stage.switches, stage.energy_wh);
+
+        worst_overshoot = std::max(worst_overshoot, stage.overshoot);
+    }
+
+    printf("\n");
+    if (finished_at >= 0) {
+        printf("finished:        %.1f min\n", finished_at / 60000.0);
+    } else {
+        printf("finished:        no\n");
+    }
+    printf("max overshoot:   %d ºC\n", worst_overshoot);
+    printf("relay switches:  %d\n", total_switches);
+    printf("energy:          %.1f Wh\n", plant.get_energy_wh());
+    printf("water left:      %.0f g\n", plant.get_water() * 1000.0);
+
+    int result = 0;
+    if (options.max_overshoot >= 0 && worst_overshoot > options.max_overshoot) {
+        printf("FAIL: overshoot %d ºC above limit %.0f ºC\n", worst_overshoot, options.max_overshoot);
+        result = 1;
+    }
+    if (options.max_switches >= 0 && total_switches > options.max_switches) {
+        printf("FAIL: %d relay switches above limit %d\n", total_switches, options.max_switches);
+        result = 1;
+    }
+    return result;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+namespace ricecooker_sim {
+
+/*
+    Parameters of the simulated cooker.
+
+    The defaults describe a pot with ~600 g of water and rice on a 700 W
+    plate, close to what the bottom/top sensors show on a real unit.
+*/
+struct PlantConfig {
+    double ambient = 22.0;              // ºC
+    double initial_temperature = 22.0;  // ºC, both nodes
+
+    double element_power = 700.0;       // W while the relay is closed
+    double element_tau = 20.0;          // s, lag between relay and heat reaching the pot
+
+    double bottom_capacity = 900.0;     // J/K, plate + pot bottom
+    double dry_capacity = 1500.0;       // J/K, pot walls + rice, without free water
+    double water_mass = 0.6;            // kg of water that can boil off
+
+    double bottom_to_top = 30.0;        // W/K, pot bottom to contents
+    double bottom_loss = 1.0;           // W/K, pot bottom to ambient
+    double top_loss = 2.5;              // W/K, contents and lid to ambient
+
+    double noise = 0.0;                 // ºC, peak amplitude of sensor noise
+    uint32_t seed = 1;
+};
+
+/*
+    Two-node thermal model: the pot bottom (read by the bottom sensor) is
+    heated by the element through a first-order lag and leaks heat into the
+    contents (read by the top sensor). Contents clamp at 100 ºC while there
+    is water left to boil off.
+*/
+class ThermalPlant {
+    public:
+        explicit ThermalPlant(const PlantConfig &config)
+            : config(config)
+            , bottom(config.initial_temperature)
+            , top(config.initial_temperature)
+            , water(config.water_mass)
+            , rng(config.seed)
+        {}
+
+        void step(double dt, bool relay) {
+            const double latent_heat = 2.26e6;  // J/kg
+            const double water_capacity = 4186.0;  // J/(kg K)
+
+            double target_power = relay ? config.element_power : 0.0;
+            element += (target_power - element) * std::min(1.0, dt / config.element_tau);
+
+            double to_top = config.bottom_to_top * (bottom - top);
+            double bottom_net = element - to_top - config.bottom_loss * (bottom - config.ambient);
+            double top_net = to_top - config.top_loss * (top - config.ambient);
+
+            bottom += bottom_net * dt / config.bottom_capacity;
+
+            if (top >= 100.0 && water > 0.0 && top_net > 0.0) {
+                water = std::max(0.0, water - top_net * dt / latent_heat);
+                top = 100.0;
+            } else {
+                top += top_net * dt / (config.dry_capacity + water * water_capacity);
+            }
+
+            if (relay) {
+                energy += config.element_power * dt;
+            }
+        }
+
+        uint8_t read_bottom() { return quantize(bottom); }
+        uint8_t read_top() { return quantize(top); }
+
+        double get_bottom() const { return bottom; }
+        double get_top() const { return top; }
+        double get_water() const { return water; }
+
+        /* Electrical energy drawn by the element, in Wh. */
+        double get_energy_wh() const { return energy / 3600.0; }
+
+    private:
+        // The MCU reports whole degrees
+        uint8_t quantize(double temperature) {
+            if (config.noise > 0.0) {
+                rng = rng * 1664525u + 1013904223u;
+                temperature += config.noise * (2.0 * (rng >> 8) / 16777216.0 - 1.0);
+            }
+            return (uint8_t) std::clamp(temperature, 0.0, 255.0);
+        }
+
+        PlantConfig config;
+
+        double bottom;
+        double top;
+        double water;
+        double element = 0.0;
+        double energy = 0.0;
+
+        uint32_t rng;
+};
+
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Decodes the ricecooker control trace.
+
+The device stores only event ids and raw integers, and prints them as
+`TRACE:<hex>` lines when `dump_trace()` is called (see rice.yaml). Feed a
+log capture to this script to get readable lines back:
+
+    esphome logs rice.yaml | tee capture.log
+    python3 tools/trace_decode.py capture.log
+
+Keep EVENTS in sync with TraceEvent in components/ricecooker/trace.h.
+"""
+
+import re
+import struct
+import sys
+
+KEEPWARM_STAGES = ["Wait", "Warm"]
+RICE_STAGES = ["Wait", "Start", "Soak", "Heat", "Cook", "Vapor", "Rest"]
+
+
+def stage(names):
+    return lambda value: names[value] if 0 <= value < len(names) else str(value)
+
+
+# id: (format, argument converters)
+EVENTS = {
+    0: ("Heater power: {}", [lambda v: "on" if v else "off"]),
+    1: ("In last heating: error {} ms/ºC, diff {}ºC", [int, int]),
+    2: ("Power modulating: heating ON for {} ms, Thermal mass {} ms/ºC", [int, int]),
+    3: ("Power modulating: power remaining {} ms, power waiting {} ms, Thermal mass {} ms/ºC", [int, int, int]),
+    4: ("Keep Warm: {}, Temperature: top: {}ºC, bottom: {}ºC, target: {}ºC", [stage(KEEPWARM_STAGES), int, int, int]),
+    5: ("Rice: {}, Temperature: top: {}ºC, bottom: {}ºC, target: {}ºC", [stage(RICE_STAGES), int, int, int]),
+    6: ("Recipe: stage {}, Temperature: top: {}ºC, bottom: {}ºC, target: {}ºC",
+        [lambda v: "wait" if v < 0 else v, int, int, int]),
+    7: ("Predicted peak {}ºC, aim {}ºC, heat gain {}ºC per sample, duty {}",
+        [lambda v: v / 10, lambda v: v / 10, lambda v: v / 1000, lambda v: v / 1000]),
+    8: ("Relay window: on {} ms, carried {} ms, {} cycles left", [int, int, int]),
+}
+
+TRACE_RE = re.compile(r"TRACE:([0-9a-fA-F]+)")
+
+
+def decode(data):
+    timestamp, event, argc = struct.unpack_from("<IBB", data)
+    args = struct.unpack_from("<%di" % argc, data, 6)
+
+    if event not in EVENTS:
+        return timestamp, "unknown event %d %s" % (event, list(args))
+
+    fmt, converters = EVENTS[event]
+    values = [convert(arg) for convert, arg in zip(converters, args)]
+    return timestamp, fmt.format(*values)
+
+
+def main():
+    source = open(sys.argv[1], encoding="utf-8", errors="replace") if len(sys.argv) > 1 else sys.stdin
+
+    for line in source:
+        match = TRACE_RE.search(line)
+        if match is None:
+            continue
+
+        timestamp, text = decode(bytes.fromhex(match.group(1)))
+        print("[%6d.%03d] %s" % (timestamp // 1000, timestamp % 1000, text))
+
+
+if __name__ == "__main__":
+    main()